@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+# MicroSEL
+# bench/run.py
+#
+# Runs the benchmark scripts in this directory on each engine, reports the
+# median wall time of several runs and compares it with a stored baseline.
+#
+#   python3 bench/run.py --interp path/to/interpreter-tutorial
+#   python3 bench/run.py --interp ... --update      (record a new baseline)
+#   python3 bench/run.py --interp ... --stress 8    (concurrency check)
+#
+# A benchmark regresses when its median is more than --threshold (default
+# 10%) above the baseline, or when its output differs from the recorded
+# one. The exit status is 1 if anything regressed, 0 otherwise. Baselines
+# are only meaningful on the machine and build they were recorded with.
+#
+# --stress N times nothing. It runs N copies of every script at once in one
+# --batch process, each in its own interpreter on its own worker thread, and
+# fails unless every copy prints exactly what a lone run of the script does.
+# It also runs the scripts in checks/, which must print what the .out file
+# next to them holds on every engine, alone and concurrently.
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+CHECKS_DIR = os.path.join(BENCH_DIR, "checks")
+
+# Engines and the options selecting them.
+ENGINES = {
+    "jit": [],
+    "tree": ["--no-jit"],
+    "vm": ["--vm"],
+}
+
+# Scripts and what they exercise. bigparse.nvs is generated at run time.
+SCRIPTS = [
+    ("fib", "recursion"),
+    ("loops", "nested for and while"),
+    ("matrix", "multi-dimensional arr"),
+    ("pointer", "@ pointer walks"),
+    ("calls", "small function calls"),
+    ("bigparse", "lexing and parsing a large script"),
+]
+
+
+def write_bigparse(path, functions=20000):
+    """Writes a script made mostly of definitions, so lexing and parsing
+    dominate; every function is called once at the end."""
+    with open(path, "w") as f:
+        for i in range(functions):
+            f.write("func f%d(a, b, c) { t = a * %d + b - c / 3; "
+                    "if t > %d then { return t %% 7 } else { arr v[4]; v[%d] = t; return v[%d] + (b && c || !a) } }\n"
+                    % (i, i % 17 + 1, i % 50, i % 4, i % 4))
+        f.write("s = 0\n")
+        for i in range(functions):
+            f.write("s = s + f%d(%d, %d, %d)\n" % (i, i % 9, i % 5, i % 3 + 1))
+        f.write("println(s)\n")
+
+
+def run_once(interp, options, script):
+    """Runs a script once and returns its wall time, its output and whether
+    it failed. Scripts print to stderr, like the interpreter's messages."""
+    start = time.perf_counter()
+    proc = subprocess.run([interp] + options + [script], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                          universal_newlines=True)
+    elapsed = time.perf_counter() - start
+    output = proc.stdout.replace("\nExecution finished.\n", "").strip()
+    failed = proc.returncode != 0 or "Error" in output
+    return elapsed, output, failed
+
+
+def split_batch(stdout):
+    """Splits the stdout of --batch into the output of each job, in order."""
+    jobs = []
+    for line in stdout.splitlines(True):
+        if line.startswith("==> ") and line.rstrip("\n").endswith(" <=="):
+            jobs.append("")
+        elif jobs:
+            jobs[-1] += line
+    return [job.strip() for job in jobs]
+
+
+def checks():
+    """The scripts in checks/ and the output each must print."""
+    found = []
+    for name in sorted(os.listdir(CHECKS_DIR)):
+        if name.endswith(".nvs"):
+            with open(os.path.join(CHECKS_DIR, name[:-4] + ".out")) as f:
+                found.append(("checks/" + name[:-4], os.path.join(CHECKS_DIR, name), f.read().strip()))
+    return found
+
+
+def stress(interp, copies, scripts, engines):
+    """Runs copies of each script concurrently on every engine and compares
+    each copy's output with a single run, which must print the expected
+    output if one is given. Returns True if all matched."""
+    ok = True
+    print("%-20s %8s %8s  %s" % ("stress", "copies", "matched", ""))
+    for name, script, want in scripts:
+        for engine in engines:
+            key = "%s/%s" % (name, engine)
+            _, expected, failed = run_once(interp, ENGINES[engine], script)
+            if want is not None and expected != want:
+                failed = True
+            proc = subprocess.run([interp] + ENGINES[engine] + ["--batch", "--jobs", str(copies)] + [script] * copies,
+                                  stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+            outputs = split_batch(proc.stdout)
+            matched = sum(1 for out in outputs if out == expected)
+            note = ""
+            if failed or proc.returncode != 0 or "Error" in proc.stderr:
+                note = "FAILED"
+            elif len(outputs) != copies or matched != copies:
+                note = "MISMATCH"
+            if note:
+                ok = False
+            print("%-20s %8d %8d  %s" % (key, copies, matched, note))
+    if not ok:
+        print("some runs failed or printed something else than a single run or the expected output")
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description="MicroSEL benchmark harness")
+    parser.add_argument("--interp", required=True, help="interpreter executable")
+    parser.add_argument("--runs", type=int, default=5, help="runs per benchmark (default 5)")
+    parser.add_argument("--engines", default=",".join(ENGINES), help="comma-separated engines (default all)")
+    parser.add_argument("--only", default="", help="comma-separated scripts to run (default all)")
+    parser.add_argument("--baseline", default=os.path.join(BENCH_DIR, "baseline.json"))
+    parser.add_argument("--threshold", type=float, default=None,
+                        help="allowed slowdown as a fraction (default: the baseline's, else 0.10)")
+    parser.add_argument("--update", action="store_true", help="write the results as the new baseline")
+    parser.add_argument("--json", default="", help="also write the results to this file")
+    parser.add_argument("--stress", type=int, default=0, metavar="N",
+                        help="instead of timing, run N copies of each script at once and compare their output")
+    args = parser.parse_args()
+
+    engines = [e for e in args.engines.split(",") if e]
+    for e in engines:
+        if e not in ENGINES:
+            sys.exit("unknown engine '%s'; choose from %s" % (e, ", ".join(ENGINES)))
+    only = set(s for s in args.only.split(",") if s)
+
+    baseline = {}
+    if os.path.exists(args.baseline) and not args.update:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    threshold = args.threshold
+    if threshold is None:
+        threshold = baseline.get("threshold", 0.10)
+    known = baseline.get("results", {})
+
+    tmpdir = tempfile.mkdtemp(prefix="msel-bench-")
+    bigparse = os.path.join(tmpdir, "bigparse.nvs")
+    write_bigparse(bigparse)
+
+    if args.stress > 0:
+        scripts = [(name, bigparse if name == "bigparse" else os.path.join(BENCH_DIR, name + ".nvs"), None)
+                   for name, _ in SCRIPTS if not only or name in only]
+        scripts += [check for check in checks() if not only or check[0] in only]
+        ok = stress(args.interp, args.stress, scripts, engines)
+        os.remove(bigparse)
+        os.rmdir(tmpdir)
+        return 0 if ok else 1
+
+    results = {}
+    regressed = False
+    print("%-20s %10s %10s %10s %8s  %s" % ("benchmark", "median s", "min s", "baseline", "change", ""))
+    for name, _ in SCRIPTS:
+        if only and name not in only:
+            continue
+        script = bigparse if name == "bigparse" else os.path.join(BENCH_DIR, name + ".nvs")
+        for engine in engines:
+            key = "%s/%s" % (name, engine)
+            times, output, failed = [], None, False
+            for _ in range(max(args.runs, 1)):
+                elapsed, out, bad = run_once(args.interp, ENGINES[engine], script)
+                times.append(elapsed)
+                failed = failed or bad or (output is not None and out != output)
+                output = out
+            median = statistics.median(times)
+            results[key] = {"median": round(median, 4), "min": round(min(times), 4), "output": output}
+
+            note, base, change = "", "-", "-"
+            ref = known.get(key)
+            if failed:
+                note = "FAILED"
+            elif ref is not None:
+                base = "%.4f" % ref["median"]
+                ratio = median / ref["median"] - 1 if ref["median"] > 0 else 0.0
+                change = "%+.1f%%" % (ratio * 100)
+                if ref.get("output") is not None and ref["output"] != output:
+                    note = "WRONG OUTPUT"
+                elif ratio > threshold:
+                    note = "REGRESSION"
+            if note:
+                regressed = True
+            print("%-20s %10.4f %10.4f %10s %8s  %s" % (key, median, min(times), base, change, note))
+
+    os.remove(bigparse)
+    os.rmdir(tmpdir)
+
+    record = {"threshold": threshold, "runs": args.runs, "results": results}
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(record, f, indent=2, sort_keys=True)
+    if args.update:
+        with open(args.baseline, "w") as f:
+            json.dump(record, f, indent=2, sort_keys=True)
+        print("baseline written to %s" % args.baseline)
+        return 0
+    if regressed:
+        print("some benchmarks regressed by more than %.0f%% or failed" % (threshold * 100))
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
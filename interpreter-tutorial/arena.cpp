@@ -0,0 +1,38 @@
+
+// MicroSEL
+// arena.cpp
+
+#include "arena.h"
+#include <cstdlib>
+
+void* Arena::allocateSlow(size_t Size, size_t Align)
+{
+    // Oversized requests get a block of their own so the current block
+    // keeps serving small nodes.
+    size_t Need = Size + Align;
+    if (Need > MaxBlockSize / 4)
+    {
+        char* Block = (char*)malloc(Need);
+        if (!Block) throw std::bad_alloc();
+        Blocks.push_back(Block);
+        Used += Size;
+        return (void*)(((size_t)Block + Align - 1) & ~(Align - 1));
+    }
+
+    while (BlockSize < Need) BlockSize *= 2;
+    char* Block = (char*)malloc(BlockSize);
+    if (!Block) throw std::bad_alloc();
+    Blocks.push_back(Block);
+    Cur = Block;
+    End = Block + BlockSize;
+    if (BlockSize < MaxBlockSize) BlockSize *= 2;
+    return allocate(Size, Align);
+}
+
+Arena::~Arena()
+{
+    for (DtorRecord* R = Dtors; R != nullptr; R = R->Next)
+        R->Dtor(R->Obj);
+    for (char* Block : Blocks)
+        free(Block);
+}
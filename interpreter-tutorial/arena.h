@@ -0,0 +1,114 @@
+
+// MicroSEL
+// arena.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// ArenaList - a fixed-size array whose elements live in an Arena.
+template <typename T>
+class ArenaList
+{
+    T* Data = nullptr;
+    unsigned int Count = 0;
+
+public:
+    ArenaList() = default;
+    ArenaList(T* Data, unsigned int Count) : Data(Data), Count(Count) {}
+
+    T* begin() const { return Data; }
+    T* end() const { return Data + Count; }
+    unsigned int size() const { return Count; }
+    bool empty() const { return Count == 0; }
+    T& operator[](unsigned int i) const { return Data[i]; }
+    T& back() const { return Data[Count - 1]; }
+};
+
+/// Arena - bump allocator that owns every node of one compilation unit
+/// (a function definition or a top-level expression). Nodes are never
+/// freed one by one; destroying the arena runs the destructors that are
+/// needed and releases all blocks at once.
+class Arena
+{
+    struct DtorRecord
+    {
+        void (*Dtor)(void*);
+        void* Obj;
+        DtorRecord* Next;
+    };
+
+    // Blocks start small since most units are a line or a short function,
+    // then double up to MaxBlockSize.
+    static const size_t MinBlockSize = 1024;
+    static const size_t MaxBlockSize = 64 * 1024;
+
+    std::vector<char*> Blocks;
+    size_t BlockSize = MinBlockSize;
+    char* Cur = nullptr;
+    char* End = nullptr;
+    DtorRecord* Dtors = nullptr;
+    size_t Used = 0;
+    size_t Objects = 0; // calls to make(), i.e. nodes of a syntax tree
+
+    void* allocateSlow(size_t Size, size_t Align);
+
+    template <typename T>
+    static void destroy(void* Obj) { static_cast<T*>(Obj)->~T(); }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena();
+
+    void* allocate(size_t Size, size_t Align)
+    {
+        char* P = (char*)(((size_t)Cur + Align - 1) & ~(Align - 1));
+        if (Cur == nullptr || P + Size > End) return allocateSlow(Size, Align);
+        Cur = P + Size;
+        Used += Size;
+        return P;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... A)
+    {
+        T* Obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(A)...);
+        Objects++;
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            DtorRecord* R = new (allocate(sizeof(DtorRecord), alignof(DtorRecord))) DtorRecord;
+            R->Dtor = &destroy<T>;
+            R->Obj = Obj;
+            R->Next = Dtors;
+            Dtors = R;
+        }
+        return Obj;
+    }
+
+    /// copyList - moves the contents of a parser scratch vector into the arena.
+    template <typename T>
+    ArenaList<T> copyList(const std::vector<T>& V)
+    {
+        return copyList(V.data(), V.size());
+    }
+
+    template <typename T>
+    ArenaList<T> copyList(const T* Items, size_t Count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "ArenaList holds plain values only");
+        if (Count == 0) return ArenaList<T>();
+        T* Data = static_cast<T*>(allocate(sizeof(T) * Count, alignof(T)));
+        memcpy(Data, Items, sizeof(T) * Count);
+        return ArenaList<T>(Data, (unsigned int)Count);
+    }
+
+    size_t getBytesUsed() const { return Used; }
+    size_t getObjectCount() const { return Objects; }
+};
@@ -5,18 +5,154 @@
 #pragma once
 
 #include "value.h"
+#include "arena.h"
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+
+class CodeGen;
+class Resolver;
+class JitCompiler;
+class Folder;
+class Purity;
+class FunctionAST;
+struct Chunk;
+class TokenStream;
+struct JitCode;
+struct MemoCache;
+
+struct JitCodeDeleter
+{
+    void operator()(JitCode* Code) const;
+};
+
+/// JitSlot - tier-up state of a function body or a loop: the call or
+/// back-edge counter, and the native code once it has been compiled.
+struct JitSlot
+{
+    unsigned int Counter = 0;
+    bool Failed = false;
+    std::unique_ptr<JitCode, JitCodeDeleter> Code;
+};
+
+struct MemoCacheDeleter
+{
+    void operator()(MemoCache* Cache) const;
+};
+
+/// MemoSlot - memoization state of a function: whether it is pure, its
+/// result cache once it has been called, and the cache counters.
+struct MemoSlot
+{
+    bool Pure = false;
+    unsigned long long Hits = 0;
+    unsigned long long Misses = 0;
+    std::unique_ptr<MemoCache, MemoCacheDeleter> Cache;
+};
+
+/// ProfileSlot - where a function or loop shows up in --profile: the line
+/// and column a loop starts at, and its site in the running profiler, 0
+/// until it is first profiled.
+struct ProfileSlot
+{
+    unsigned int Line = 0;
+    unsigned int Col = 0;
+    unsigned int Site = 0;
+};
 
 typedef enum NodeType
 {
-    node_default = 0, // Ÿ  
-    node_var = 1, //   
-    node_deref = 2, //  
+    node_default = 0, // 기타 모든 노드
+    node_var = 1, // 변수 참조 노드
+    node_deref = 2, // 역참조 노드
+    node_number = 3, // 숫자 리터럴 노드
+    node_block = 4, // 블록 노드
+    node_call = 5, // 함수 호출 노드
 } nodeType;
 
-/// ExprAST -  Ʈ ⺻ 
+typedef enum BinOp
+{
+    binop_none = 0, // 이항 연산자가 아님
+    binop_assign,
+    binop_or,
+    binop_and,
+    binop_eq,
+    binop_ne,
+    binop_lt,
+    binop_gt,
+    binop_le,
+    binop_ge,
+    binop_add,
+    binop_sub,
+    binop_mul,
+    binop_div,
+    binop_mod,
+    binop_pow,
+    binop_count,
+} binOp;
+
+typedef enum RefDepth
+{
+    ref_local = 0, // slot in the current frame
+    ref_global = 1, // entry in the global symbol table
+    ref_either = 2, // global if it exists at run time, otherwise the frame slot
+} refDepth;
+
+/// ArrShape - dimensions of an array and the row-major stride of each one,
+/// computed once when the declaration is parsed.
+struct ArrShape
+{
+    std::vector<int> Dims;
+    std::vector<int> Strides;
+    int Size = 1;
+
+    ArrShape() = default;
+    ArrShape(std::vector<int> ArrDims) : Dims(std::move(ArrDims)), Strides(Dims.size())
+    {
+        for (size_t k = Dims.size(); k-- > 0;)
+        {
+            Strides[k] = Size;
+            Size *= Dims[k];
+        }
+    }
+};
+
+/// VarRef - resolved location of an identifier, filled in by the resolver.
+struct VarRef
+{
+    unsigned char Depth = ref_global;
+    bool Declares = false; // top-level declaration that publishes a global
+    bool Outer = false; // bound outside a pfor body, so found at OuterBase
+    unsigned int Slot = 0;
+    unsigned int Global = 0;
+    const ArrShape* Shape = nullptr; // shape of a local array
+};
+
+typedef Value (*StdFunc)(const std::vector<Value>& Args);
+
+typedef enum LinkState
+{
+    link_none = 0, // not linked yet
+    link_std = 1, // standard library function
+    link_script = 2, // function defined by the script
+    link_unknown = 3, // no function of that name
+    link_arity = 4, // wrong number of arguments
+} linkState;
+
+/// CallLink - a call site bound to its callee. The binding is redone only
+/// when the callee's FuncTbl entry changes, e.g. when a func is redefined.
+struct CallLink
+{
+    unsigned int Func = 0; // index into FuncTbl
+    unsigned int Argc = 0;
+    unsigned int Version = 0; // entry version the link was made against
+    unsigned char State = link_none;
+    StdFunc Std = nullptr;
+    FunctionAST* Script = nullptr;
+};
+
+/// ExprAST - 구문 트리의 기본 노드
 class ExprAST
 {
     int NodeType = node_default;
@@ -25,175 +161,351 @@ public:
     void setNodeType(int Type) { NodeType = Type; }
     virtual ~ExprAST() = default;
     virtual Value execute() = 0;
+    virtual void compile(CodeGen& CG) = 0;
+    virtual void resolve(Resolver& R) = 0;
+    virtual void jit(JitCompiler& J) = 0;
+    virtual ExprAST* fold(Folder& F) = 0;
+    virtual void dump(int Depth) = 0;
+    virtual bool isPure(Purity& P) = 0;
+    // Marks 'return f(...)' reachable without passing through an operator.
+    virtual void markTailCalls() {}
 };
 
-/// NumberExprAST - "1.0"   ͷ ǥ.
+typedef ArenaList<ExprAST*> ExprList;
+
+/// NumberExprAST - "1.0"과 같은 숫자 리터럴 표현.
 class NumberExprAST : public ExprAST
 {
     Value Val;
 
 public:
-    NumberExprAST(Value Val) : Val(Val) {}
+    NumberExprAST(Value Val) : Val(Val) {
+        setNodeType(nodeType::node_number);
+    }
+    double getNum() { return Val.getNum(); }
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// VariableExprAST - "i" "ar[2][3]"   迭 Ҹ ϴ ǥ.
+/// VariableExprAST - "i"나 "ar[2][3]"와 같이 변수나 배열 요소를 참조하는 표현.
 class VariableExprAST : public ExprAST
 {
     std::string Name;
-    std::vector<std::shared_ptr<ExprAST>> Indices;
+    ExprList Indices;
+    VarRef Ref;
 
 public:
-    VariableExprAST(std::string Name, std::vector<std::shared_ptr<ExprAST>> Indices)
-        : Name(Name), Indices(std::move(Indices)) {
+    VariableExprAST(std::string Name, ExprList Indices)
+        : Name(Name), Indices(Indices) {
         setNodeType(nodeType::node_var);
     }
     VariableExprAST(std::string Name) : Name(Name) {
         setNodeType(nodeType::node_var);
     }
-    std::string getName() const { return Name; }
-    const std::vector<std::shared_ptr<ExprAST>>& getIndices() const { return Indices; }
+    const std::string& getName() const { return Name; }
+    const ExprList& getIndices() const { return Indices; }
+    const VarRef& getRef() const { return Ref; }
+    void setRef(const VarRef& R) { Ref = R; }
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// DeRefExprAST - "@a" "@(ptr + 10)"  ޸ ּҸ ϴ ǥ.
+/// DeRefExprAST - "@a"나 "@(ptr + 10)"와 같이 메모리 주소를 역참조하는 표현.
 class DeRefExprAST : public ExprAST
 {
-    std::shared_ptr<ExprAST> AddrExpr;
+    ExprAST* AddrExpr;
 
 public:
-    DeRefExprAST(std::shared_ptr<ExprAST> Addr) : AddrExpr(std::move(Addr)) {
+    DeRefExprAST(ExprAST* Addr) : AddrExpr(Addr) {
         setNodeType(nodeType::node_deref);
     }
-    std::shared_ptr<ExprAST> getExpr() const { return AddrExpr; }
+    ExprAST* getExpr() const { return AddrExpr; }
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// ArrDeclExprAST - "arr ar[2][2][2]"  迭 ϴ ǥ.
+/// ArrDeclExprAST - "arr ar[2][2][2]"와 같이 배열을 선언하는 표현.
 class ArrDeclExprAST : public ExprAST
 {
     std::string Name;
-    std::vector<int> Indices;
+    ArrShape Shape;
+    VarRef Ref;
 
 public:
-    ArrDeclExprAST(std::string Name, std::vector<int> Indices) : Name(Name), Indices(std::move(Indices)) {}
+    ArrDeclExprAST(std::string Name, std::vector<int> Indices) : Name(Name), Shape(std::move(Indices)) {}
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// UnaryExprAST -   ǥ.
+/// UnaryExprAST - 단항 연산 표현.
 class UnaryExprAST : public ExprAST
 {
     char Opcode;
-    std::shared_ptr<ExprAST> Operand;
+    ExprAST* Operand;
 
 public:
-    UnaryExprAST(char Opcode, std::shared_ptr<ExprAST> Operand)
-        : Opcode(Opcode), Operand(std::move(Operand)) {}
+    UnaryExprAST(char Opcode, ExprAST* Operand)
+        : Opcode(Opcode), Operand(Operand) {}
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// BinaryExprAST -   ǥ.
+/// BinaryExprAST - 이항 연산 표현.
 class BinaryExprAST : public ExprAST
 {
-    std::string Op;
-    std::shared_ptr<ExprAST> LHS, RHS;
+    binOp Op;
+    ExprAST *LHS, *RHS;
 
 public:
-    BinaryExprAST(std::string Op, std::shared_ptr<ExprAST> LHS,
-        std::shared_ptr<ExprAST> RHS)
-        : Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+    BinaryExprAST(binOp Op, ExprAST* LHS,
+        ExprAST* RHS)
+        : Op(Op), LHS(LHS), RHS(RHS) {}
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// CallExprAST - Լ ȣ ǥ.
+/// LogicalExprAST - "&&", "||" 연산 표현. 결과가 LHS만으로 정해지면
+/// RHS는 평가하지 않는다.
+class LogicalExprAST : public ExprAST
+{
+    binOp Op;
+    ExprAST *LHS, *RHS;
+
+public:
+    LogicalExprAST(binOp Op, ExprAST* LHS,
+        ExprAST* RHS)
+        : Op(Op), LHS(LHS), RHS(RHS) {}
+    Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
+};
+
+/// CallExprAST - 함수 호출 표현.
 class CallExprAST : public ExprAST
 {
     std::string Callee;
-    std::vector<std::shared_ptr<ExprAST>> Args;
+    ExprList Args;
+    CallLink Link;
 
 public:
     CallExprAST(std::string Callee, 
-        std::vector<std::shared_ptr<ExprAST>> Args)
-        : Callee(Callee), Args(std::move(Args)) {}
+        ExprList Args)
+        : Callee(Callee), Args(Args) {
+        setNodeType(nodeType::node_call);
+    }
+    const std::string& getCallee() const { return Callee; }
+    unsigned int getArgsSize() const { return Args.size(); }
+    CallLink& getLink() { return Link; }
     Value execute() override;
+    Value executeTail();
+    void compileTail(CodeGen& CG);
+    void jitTail(JitCompiler& J);
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// IfExprAST - if/then/else ǹ ǥ.
+/// IfExprAST - if/then/else 조건문 표현.
 class IfExprAST : public ExprAST
 {
-    std::shared_ptr<ExprAST> CondExpr, ThenExpr, ElseExpr;
+    ExprAST *CondExpr, *ThenExpr, *ElseExpr;
 
 public:
-    IfExprAST(std::shared_ptr<ExprAST> Cond, std::shared_ptr<ExprAST> Then)
-        : CondExpr(std::move(Cond)), ThenExpr(std::move(Then)) {
+    IfExprAST(ExprAST* Cond, ExprAST* Then)
+        : CondExpr(Cond), ThenExpr(Then) {
         ElseExpr = nullptr;
     }
-    IfExprAST(std::shared_ptr<ExprAST> Cond, std::shared_ptr<ExprAST> Then,
-        std::shared_ptr<ExprAST> Else)
-        : IfExprAST(std::move(Cond), std::move(Then)) {
-        ElseExpr = std::move(Else);
+    IfExprAST(ExprAST* Cond, ExprAST* Then,
+        ExprAST* Else)
+        : IfExprAST(Cond, Then) {
+        ElseExpr = Else;
     }
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
+    void markTailCalls() override;
 };
 
-/// ForExprAST - for  ǥ.
+/// ForExprAST - for 제어문 표현.
 class ForExprAST : public ExprAST
 {
     std::string VarName;
-    std::shared_ptr<ExprAST> Start, End, Step, Body;
+    ExprAST *Start, *End, *Step, *Body;
+    VarRef Ref;
 
 public:
-    ForExprAST(std::string VarName, std::shared_ptr<ExprAST> Start,
-        std::shared_ptr<ExprAST> End, std::shared_ptr<ExprAST> Step,
-        std::shared_ptr<ExprAST> Body)
-        : VarName(VarName), Start(std::move(Start)), End(std::move(End)),
-        Step(std::move(Step)), Body(std::move(Body)) {}
+    ForExprAST(std::string VarName, ExprAST* Start,
+        ExprAST* End, ExprAST* Step,
+        ExprAST* Body)
+        : VarName(VarName), Start(Start), End(End),
+        Step(Step), Body(Body) {}
+    JitSlot Jit;
+    ProfileSlot Prof;
+    const std::string& getVarName() const { return VarName; }
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
+    void markTailCalls() override;
 };
 
-/// WhileExprAST - while  ǥ.
+/// WhileExprAST - while 제어문 표현.
 class WhileExprAST : public ExprAST
 {
-    std::shared_ptr<ExprAST> Cond, Body;
+    ExprAST *Cond, *Body;
 
 public:
-    WhileExprAST(std::shared_ptr<ExprAST> Cond, std::shared_ptr<ExprAST> Body)
-        : Cond(std::move(Cond)), Body(std::move(Body)) {}
+    WhileExprAST(ExprAST* Cond, ExprAST* Body)
+        : Cond(Cond), Body(Body) {}
+    JitSlot Jit;
+    ProfileSlot Prof;
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
+    void markTailCalls() override;
 };
 
-/// BlockExprAST -   ӵ ǥ ǥ.
+typedef enum ReduceOp
+{
+    reduce_none = 0,
+    reduce_sum = 1,
+    reduce_min = 2,
+    reduce_max = 3,
+} reduceOp;
+
+/// PforExprAST - pfor 병렬 반복문 표현. [Start, End) 구간의 반복을 작업
+/// 스레드들에 나누어 실행하고, 리덕션이 있으면 각 반복의 값을 모아 Acc에 대입한다.
+class PforExprAST : public ExprAST
+{
+    std::string VarName, AccName;
+    ExprAST *Start, *End, *Body;
+    reduceOp Reduce;
+    VarRef Ref, AccRef;
+    bool Nested = false; // inside another pfor; always runs on one thread
+    unsigned int PrivateLo = 0, PrivateHi = 0; // frame slots private to an iteration
+    std::vector<CallLink*> Calls; // call sites in the body
+
+    bool runRange(double First, size_t From, size_t To, double& Acc, const std::atomic<bool>* Stop);
+
+public:
+    PforExprAST(std::string VarName, ExprAST* Start, ExprAST* End,
+        reduceOp Reduce, std::string AccName, ExprAST* Body)
+        : VarName(VarName), AccName(AccName), Start(Start), End(End),
+        Body(Body), Reduce(Reduce) {}
+    ProfileSlot Prof;
+    const std::string& getVarName() const { return VarName; }
+    Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
+};
+
+/// BlockExprAST - 블록으로 묶인 연속된 표현식 표현.
 class BlockExprAST : public ExprAST
 {
-    std::vector<std::shared_ptr<ExprAST>> Expressions;
+    ExprList Expressions;
 
 public:
-    BlockExprAST(std::vector<std::shared_ptr<ExprAST>> Expressions)
-        : Expressions(std::move(Expressions)) {}
+    BlockExprAST(ExprList Expressions)
+        : Expressions(Expressions) {
+        setNodeType(nodeType::node_block);
+    }
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
+    void markTailCalls() override;
 };
 
-/// BreakExprAST - ݺ Ż ǥ.
+/// BreakExprAST - 반복문 탈출 표현.
 class BreakExprAST : public ExprAST
 {
-    std::shared_ptr<ExprAST> Expr;
+    ExprAST* Expr;
 
 public:
-    BreakExprAST(std::shared_ptr<ExprAST> Expr) : Expr(std::move(Expr)) {}
+    BreakExprAST(ExprAST* Expr) : Expr(Expr) {}
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
 };
 
-/// ReturnExprAST - Լ  ǥ.
+/// ReturnExprAST - 함수의 리턴 표현.
 class ReturnExprAST : public ExprAST
 {
-    std::shared_ptr<ExprAST> Expr;
+    ExprAST* Expr;
+    bool TailCall = false;
 
 public:
-    ReturnExprAST(std::shared_ptr<ExprAST> Expr) : Expr(std::move(Expr)) {}
+    ReturnExprAST(ExprAST* Expr) : Expr(Expr) {}
     Value execute() override;
+    void compile(CodeGen& CG) override;
+    void resolve(Resolver& R) override;
+    void jit(JitCompiler& J) override;
+    ExprAST* fold(Folder& F) override;
+    void dump(int Depth) override;
+    bool isPure(Purity& P) override;
+    void markTailCalls() override;
 };
 
-/// PrototypeAST - Լ Ÿ
+/// PrototypeAST - 함수의 프로토타입
 class PrototypeAST
 {
     std::string Name;
@@ -208,64 +520,84 @@ public:
     const std::vector<std::string>& getArgs() const { return Args; }
 };
 
-/// PrototypeAST - Լ ü
+/// PrototypeAST - 함수의 본체
+/// Nodes owns the prototype and every node of the body.
 class FunctionAST
 {
-    std::shared_ptr<PrototypeAST> Proto;
-    std::shared_ptr<ExprAST> Body;
+    std::unique_ptr<Arena> Nodes;
+    PrototypeAST* Proto;
+    ExprAST* Body;
+    std::shared_ptr<Chunk> Bytecode;
+    unsigned int FrameSize = 0;
+    unsigned int KeepSlots = 0; // slots of __anon_expr that hold new globals
+    JitSlot Jit;
+    MemoSlot Memo;
+    ProfileSlot Prof;
+
+    Value run(unsigned int Base);
+    Value runProfiled(unsigned int Base);
 
 public:
-    FunctionAST(std::shared_ptr<PrototypeAST> Proto,
-        std::shared_ptr<ExprAST> Body)
-        : Proto(std::move(Proto)), Body(std::move(Body)) {}
-    Value execute(std::vector<Value> Ops);
+    FunctionAST(std::unique_ptr<Arena> Nodes, PrototypeAST* Proto, ExprAST* Body)
+        : Nodes(std::move(Nodes)), Proto(Proto), Body(Body) {}
+    Value execute(unsigned int Base);
+    bool runJit(unsigned int Base, Value& Result);
+    const Chunk& getBytecode();
+    void optimize();
+    void resolve();
+    MemoSlot& getMemo() { return Memo; }
+    ProfileSlot& getProfile() { return Prof; }
+    unsigned int getFrameSize() const { return FrameSize; }
+    unsigned int getKeepSlots() const { return KeepSlots; }
     std::string getFuncName() const { return Proto->getName(); }
+    ExprAST* getBody() const { return Body; }
+    const Arena& getNodes() const { return *Nodes; }
     const std::vector<std::string>& getFuncArgs() const { return Proto->getArgs(); }
     int argsSize() const { return Proto->getArgsSize(); }
 };
 
-void InitBinopPrec();
+int GetNextToken(TokenStream& Toks);
 
-int GetNextToken(const std::string& Code, int& Idx);
+int GetPrecedence(binOp Op);
 
-int GetPrecedence(std::string Op);
+ExprAST* LogError(const char* Str);
 
-std::shared_ptr<ExprAST> LogError(const char* Str);
+PrototypeAST* LogErrorP(const char* Str);
 
-std::shared_ptr<PrototypeAST> LogErrorP(const char* Str);
+ExprAST* ParseNumberExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseNumberExpr(const std::string& Code, int& Idx);
+ExprAST* ParseParenExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseParenExpr(const std::string& Code, int& Idx);
+ExprAST* ParseIdentifierExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseIdentifierExpr(const std::string& Code, int& Idx);
+ExprAST* ParseDeRefExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseDeRefExpr(const std::string& Code, int& Idx);
+ExprAST* ParseArrDeclExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseArrDeclExpr(const std::string& Code, int& Idx);
+ExprAST* ParseIfExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseIfExpr(const std::string& Code, int& Idx);
+ExprAST* ParseForExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseForExpr(const std::string& Code, int& Idx);
+ExprAST* ParsePforExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseWhileExpr(const std::string& Code, int& Idx);
+ExprAST* ParseWhileExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseBreakExpr(const std::string& Code, int& Idx);
+ExprAST* ParseBreakExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseReturnExpr(const std::string& Code, int& Idx);
+ExprAST* ParseReturnExpr(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParsePrimary(const std::string& Code, int& Idx);
+ExprAST* ParsePrimary(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseUnary(const std::string& Code, int& Idx);
+ExprAST* ParseUnary(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseBinOpRHS(const std::string& Code, int& Idx, int ExprPrec, std::shared_ptr<ExprAST> LHS);
+ExprAST* ParseBinOpRHS(TokenStream& Toks, int ExprPrec, ExprAST* LHS);
 
-std::shared_ptr<ExprAST> ParseExpression(const std::string& Code, int& Idx);
+ExprAST* ParseExpression(TokenStream& Toks);
 
-std::shared_ptr<ExprAST> ParseBlockExpression(const std::string& Code, int& Idx);
+ExprAST* ParseBlockExpression(TokenStream& Toks);
 
-std::shared_ptr<PrototypeAST> ParsePrototype(const std::string& Code, int& Idx);
+PrototypeAST* ParsePrototype(TokenStream& Toks);
 
-std::shared_ptr<FunctionAST> ParseDefinition(const std::string& Code, int& Idx);
+std::shared_ptr<FunctionAST> ParseDefinition(TokenStream& Toks);
 
-std::shared_ptr<FunctionAST> ParseTopLevelExpr(const std::string& Code, int& Idx);
\ No newline at end of file
+std::shared_ptr<FunctionAST> ParseTopLevelExpr(TokenStream& Toks);
\ No newline at end of file
@@ -0,0 +1,132 @@
+
+// MicroSEL
+// batch.cpp
+
+#include "batch.h"
+#include "execute.h"
+#include "jit.h"
+#include "memo.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+/// ReadManifest - appends the scripts listed in a manifest, one path per
+/// line. Blank lines and lines starting with '#' are skipped.
+bool ReadManifest(const char* FileName, std::vector<std::string>& Files)
+{
+    FILE* F = fopen(FileName, "r");
+    if (F == nullptr) return false;
+
+    char Line[4096];
+    while (fgets(Line, sizeof(Line), F))
+    {
+        std::string Path(Line);
+        size_t Begin = Path.find_first_not_of(" \t\r\n");
+        if (Begin == std::string::npos || Path[Begin] == '#') continue;
+        size_t End = Path.find_last_not_of(" \t\r\n");
+        Files.push_back(Path.substr(Begin, End - Begin + 1));
+    }
+    fclose(F);
+    return true;
+}
+
+/// ReadBack - returns everything written to a capture file and closes it.
+static std::string ReadBack(FILE* F)
+{
+    std::string Text;
+    if (F == nullptr) return Text;
+
+    rewind(F);
+    char Buf[4096];
+    size_t Len;
+    while ((Len = fread(Buf, 1, sizeof(Buf), F)) > 0) Text.append(Buf, Len);
+    fclose(F);
+    return Text;
+}
+
+/// RunJob - runs one script in a fresh interpreter whose input is empty and
+/// whose output and diagnostics go to capture files of its own.
+static void RunJob(BatchJob& Job, unsigned int StackMB)
+{
+    auto Start = std::chrono::steady_clock::now();
+
+    Interpreter Interp;
+    InterpreterScope Scope(Interp);
+    FILE* In = tmpfile();
+    FILE* Out = tmpfile();
+    FILE* Err = tmpfile();
+
+    if (!In || !Out || !Err)
+        Job.Err = "Error: Could not create capture files\n";
+    else
+    {
+        Interp.In = In;
+        Interp.Out = Out;
+        Interp.Err = Err;
+        if (!Interp.StackMemory.reserve((size_t)StackMB << 20))
+            fprintf(Err, "Error: Could not reserve %u MB for the stack\n", StackMB);
+        else Job.Ran = ExecuteScript(Job.FileName.c_str());
+
+        if (JitStats) PrintJitStats();
+        if (MemoStats) PrintMemoStats();
+    }
+
+    Job.Errors = Interp.Errors;
+    Job.Out = ReadBack(Out);
+    Job.Err += ReadBack(Err);
+    if (In) fclose(In);
+
+    Job.Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+}
+
+/// RunBatch - runs every script on a pool of Workers threads, each job in
+/// its own interpreter. The captured output is printed in the order the
+/// scripts were given, script output to stdout and diagnostics to stderr,
+/// followed by a timing summary. Returns nonzero if a script did not run.
+int RunBatch(const std::vector<std::string>& Files, unsigned int Workers, unsigned int StackMB)
+{
+    std::vector<BatchJob> Jobs(Files.size());
+    for (size_t i = 0; i < Files.size(); i++) Jobs[i].FileName = Files[i];
+
+    if (Workers == 0) Workers = std::thread::hardware_concurrency();
+    if (Workers == 0) Workers = 1;
+    if (Workers > Jobs.size()) Workers = Jobs.size() ? (unsigned int)Jobs.size() : 1;
+
+    auto Start = std::chrono::steady_clock::now();
+    std::atomic<size_t> Next(0);
+    std::vector<std::thread> Pool;
+    for (unsigned int i = 0; i < Workers; i++)
+    {
+        Pool.emplace_back([&] {
+            for (size_t Idx; (Idx = Next++) < Jobs.size();) RunJob(Jobs[Idx], StackMB);
+        });
+    }
+    for (auto& Worker : Pool) Worker.join();
+    double WallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+
+    int Failed = 0;
+    double JobMs = 0;
+    for (auto& Job : Jobs)
+    {
+        fprintf(stdout, "==> %s <==\n%s", Job.FileName.c_str(), Job.Out.c_str());
+        fflush(stdout);
+        fprintf(stderr, "==> %s <==\n%s", Job.FileName.c_str(), Job.Err.c_str());
+        Failed += !Job.Ran;
+        JobMs += Job.Ms;
+    }
+
+    fprintf(stderr, "\nBatch summary: %zu scripts on %u workers\n", Jobs.size(), Workers);
+    fprintf(stderr, "  %10s  %6s  %s\n", "ms", "errors", "script");
+    for (auto& Job : Jobs)
+    {
+        if (Job.Ran) fprintf(stderr, "  %10.3f  %6u  %s\n", Job.Ms, Job.Errors, Job.FileName.c_str());
+        else fprintf(stderr, "  %10.3f  %6s  %s (not run)\n", Job.Ms, "-", Job.FileName.c_str());
+    }
+    fprintf(stderr, "  wall time       %.3f ms\n", WallMs);
+    fprintf(stderr, "  sum of jobs     %.3f ms\n", JobMs);
+    fprintf(stderr, "  throughput      %.1f jobs/s\n", WallMs > 0 ? Jobs.size() / (WallMs / 1000) : 0.0);
+    if (Failed) fprintf(stderr, "  not run         %d\n", Failed);
+
+    return Failed != 0;
+}
@@ -0,0 +1,23 @@
+
+// MicroSEL
+// batch.h
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// BatchJob - one script of a batch run and what running it produced.
+struct BatchJob
+{
+    std::string FileName;
+    std::string Out; // captured script output
+    std::string Err; // captured diagnostics
+    bool Ran = false; // false if the script could not be started
+    unsigned int Errors = 0;
+    double Ms = 0; // wall time of the job
+};
+
+bool ReadManifest(const char* FileName, std::vector<std::string>& Files);
+
+int RunBatch(const std::vector<std::string>& Files, unsigned int Workers, unsigned int StackMB);
@@ -0,0 +1,538 @@
+
+// MicroSEL
+// bytecode.cpp
+
+#include "bytecode.h"
+#include "ast.h"
+#include "execute.h"
+#include <cstdio>
+#include <cstring>
+
+void CodeGen::emitOp(opCode Op, int StackEffect)
+{
+    C.Code.push_back(Op);
+    adjustDepth(StackEffect);
+}
+
+void CodeGen::emitArg(unsigned int Arg)
+{
+    unsigned char Bytes[4];
+    memcpy(Bytes, &Arg, 4);
+    C.Code.insert(C.Code.end(), Bytes, Bytes + 4);
+}
+
+void CodeGen::adjustDepth(int Delta)
+{
+    Depth += Delta;
+    if (Depth > C.MaxDepth) C.MaxDepth = Depth;
+}
+
+unsigned int CodeGen::addConst(double Val)
+{
+    for (unsigned int i = 0; i < C.Consts.size(); i++)
+        if (memcmp(&C.Consts[i], &Val, sizeof(double)) == 0) return i;
+    C.Consts.push_back(Val);
+    return C.Consts.size() - 1;
+}
+
+unsigned int CodeGen::addName(const std::string& Name)
+{
+    for (unsigned int i = 0; i < C.Names.size(); i++)
+        if (C.Names[i] == Name) return i;
+    C.Names.push_back(Name);
+    return C.Names.size() - 1;
+}
+
+unsigned int CodeGen::addRef(const VarRef& Ref, const std::string& Name)
+{
+    C.Refs.push_back({ Ref, addName(Name) });
+    return C.Refs.size() - 1;
+}
+
+unsigned int CodeGen::addCall(CallLink* Link)
+{
+    C.Calls.push_back(Link);
+    return C.Calls.size() - 1;
+}
+
+unsigned int CodeGen::addNode(ExprAST* Node)
+{
+    C.Nodes.push_back(Node);
+    return C.Nodes.size() - 1;
+}
+
+size_t CodeGen::emitJump(opCode Op)
+{
+    emitOp(Op, Op == op_jmp_false ? -1 : 0);
+    emitArg(0);
+    return C.Code.size() - 4;
+}
+
+void CodeGen::patchJump(size_t At)
+{
+    int Offset = (int)(C.Code.size() - (At + 4));
+    memcpy(&C.Code[At], &Offset, 4);
+}
+
+void CodeGen::emitLoop(size_t Target)
+{
+    emitOp(op_jmp, 0);
+    int Offset = (int)Target - (int)(C.Code.size() + 4);
+    emitArg((unsigned int)Offset);
+}
+
+/// emitLoad/emitStore - plain frame slots get their own opcodes so the
+/// common case needs no lookup at all.
+void CodeGen::emitLoad(const VarRef& Ref, const std::string& Name)
+{
+    if (Ref.Depth == ref_local)
+    {
+        emitOp(op_load_local, 1);
+        emitArg(Ref.Slot);
+        return;
+    }
+    emitOp(op_load_var, 1);
+    emitArg(addRef(Ref, Name));
+}
+
+void CodeGen::emitStore(const VarRef& Ref, const std::string& Name)
+{
+    if (Ref.Depth == ref_local && !Ref.Declares)
+    {
+        emitOp(op_store_local, 0);
+        emitArg(Ref.Slot);
+        return;
+    }
+    emitOp(op_store_var, 0);
+    emitArg(addRef(Ref, Name));
+}
+
+/// emitError - reports Msg when reached. Counts as producing a value so
+/// that the surrounding expression keeps a consistent stack depth.
+void CodeGen::emitError(const std::string& Msg)
+{
+    emitOp(op_error, 1);
+    emitArg(addName(Msg));
+}
+
+/// beginLoop - must be called with the loop result slot on top of the stack.
+void CodeGen::beginLoop()
+{
+    Loops.push_back({ Depth, {} });
+}
+
+/// emitBreak - the break value is on top of the stack. It replaces the loop
+/// result, and control continues after the loop.
+void CodeGen::emitBreak()
+{
+    if (Loops.empty()) // 'break' outside of a loop leaves the function.
+    {
+        emitReturn();
+        return;
+    }
+
+    // The previous result was popped before the body ran, so anything
+    // between it and the break value is a pending operand.
+    LoopInfo& L = Loops.back();
+    int Drop = Depth - L.Depth;
+    if (Drop > 0)
+    {
+        emitOp(op_unwind, -Drop);
+        emitArg(Drop);
+    }
+    L.BreakJumps.push_back(emitJump(op_jmp));
+    adjustDepth(Drop); // the fall-through path still sees the break value
+}
+
+/// endLoop - patches pending breaks to the current position.
+void CodeGen::endLoop()
+{
+    for (size_t At : Loops.back().BreakJumps) patchJump(At);
+    Loops.pop_back();
+}
+
+void CodeGen::emitReturn()
+{
+    emitOp(op_ret, -1);
+    adjustDepth(1);
+}
+
+void NumberExprAST::compile(CodeGen& CG)
+{
+    CG.emitOp(op_const, 1);
+    CG.emitArg(CG.addConst(Val.getNum()));
+}
+
+void VariableExprAST::compile(CodeGen& CG)
+{
+    if (Indices.empty())
+    {
+        CG.emitLoad(Ref, Name);
+        return;
+    }
+    for (auto& Idx : Indices) Idx->compile(CG);
+    CG.emitOp(op_load_elem, 1 - (int)Indices.size());
+    CG.emitArg(CG.addRef(Ref, Name));
+    CG.emitArg(Indices.size());
+}
+
+void DeRefExprAST::compile(CodeGen& CG)
+{
+    AddrExpr->compile(CG);
+    CG.emitOp(op_deref, 0);
+}
+
+void ArrDeclExprAST::compile(CodeGen& CG)
+{
+    CG.emitOp(op_decl_arr, 1);
+    CG.emitArg(CG.addRef(Ref, Name));
+}
+
+void UnaryExprAST::compile(CodeGen& CG)
+{
+    if (Opcode == '&') // reference operator
+    {
+        if (Operand->getNodeType() != node_var)
+        {
+            CG.emitError("Operand of '&' must be a variable");
+            return;
+        }
+
+        VariableExprAST* Op = static_cast<VariableExprAST*>(Operand);
+        const ExprList& Indices = Op->getIndices();
+        if (Indices.empty())
+        {
+            CG.emitOp(op_addr_var, 1);
+            CG.emitArg(CG.addRef(Op->getRef(), Op->getName()));
+            return;
+        }
+        for (auto& Idx : Indices) Idx->compile(CG);
+        CG.emitOp(op_addr_elem, 1 - (int)Indices.size());
+        CG.emitArg(CG.addRef(Op->getRef(), Op->getName()));
+        CG.emitArg(Indices.size());
+        return;
+    }
+
+    Operand->compile(CG);
+    switch (Opcode)
+    {
+    case '!':
+        CG.emitOp(op_not, 0);
+        break;
+    case '+':
+        break;
+    case '-':
+        CG.emitOp(op_neg, 0);
+        break;
+    default:
+        CG.emitOp(op_pop, -1);
+        CG.emitError("Unknown unary operator");
+        break;
+    }
+}
+
+void BinaryExprAST::compile(CodeGen& CG)
+{
+    if (Op == binop_assign)
+    {
+        RHS->compile(CG);
+
+        if (LHS->getNodeType() == node_deref)
+        {
+            static_cast<DeRefExprAST*>(LHS)->getExpr()->compile(CG);
+            CG.emitOp(op_store_deref, -1);
+            return;
+        }
+        if (LHS->getNodeType() != node_var)
+        {
+            CG.emitOp(op_pop, -1);
+            CG.emitError("Destination of '=' must be a variable");
+            return;
+        }
+
+        VariableExprAST* LHSE = static_cast<VariableExprAST*>(LHS);
+        const ExprList& Indices = LHSE->getIndices();
+        if (Indices.empty())
+        {
+            CG.emitStore(LHSE->getRef(), LHSE->getName());
+            return;
+        }
+        for (auto& Idx : Indices) Idx->compile(CG);
+        CG.emitOp(op_store_elem, -(int)Indices.size());
+        CG.emitArg(CG.addRef(LHSE->getRef(), LHSE->getName()));
+        CG.emitArg(Indices.size());
+        return;
+    }
+
+    LHS->compile(CG);
+    RHS->compile(CG);
+
+    // indexed by binOp; '=', '&&' and '||' never reach here
+    static const opCode BinOps[binop_count] = {
+        op_error, op_error, op_error, op_error, op_eq, op_ne, op_lt, op_gt, op_le, op_ge,
+        op_add, op_sub, op_mul, op_div, op_mod, op_pow,
+    };
+    CG.emitOp(BinOps[Op], -1);
+}
+
+/// The RHS is only reached when the LHS does not decide the result; either
+/// way exactly one value is left on the operand stack.
+void LogicalExprAST::compile(CodeGen& CG)
+{
+    LHS->compile(CG);
+    size_t RHSJump = 0;
+    size_t ShortJump;
+    if (Op == binop_and)
+    {
+        ShortJump = CG.emitJump(op_jmp_false);
+    }
+    else
+    {
+        RHSJump = CG.emitJump(op_jmp_false);
+        CG.emitOp(op_const, 1);
+        CG.emitArg(CG.addConst(1));
+        ShortJump = CG.emitJump(op_jmp);
+        CG.patchJump(RHSJump);
+        CG.adjustDepth(-1);
+    }
+
+    RHS->compile(CG);
+    CG.emitOp(op_bool, 0);
+
+    if (Op == binop_and)
+    {
+        size_t EndJump = CG.emitJump(op_jmp);
+        CG.patchJump(ShortJump);
+        CG.adjustDepth(-1);
+        CG.emitOp(op_const, 1);
+        CG.emitArg(CG.addConst(0));
+        CG.patchJump(EndJump);
+    }
+    else CG.patchJump(ShortJump);
+}
+
+void CallExprAST::compile(CodeGen& CG)
+{
+    for (auto& Arg : Args) Arg->compile(CG);
+    CG.emitOp(op_call, 1 - (int)Args.size());
+    CG.emitArg(CG.addCall(&Link));
+    CG.emitArg(Args.size());
+}
+
+/// compileTail - op_tail_call only falls through to the following op_ret
+/// when the callee is not a script function.
+void CallExprAST::compileTail(CodeGen& CG)
+{
+    for (auto& Arg : Args) Arg->compile(CG);
+    CG.emitOp(op_tail_call, 1 - (int)Args.size());
+    CG.emitArg(CG.addCall(&Link));
+    CG.emitArg(Args.size());
+}
+
+void IfExprAST::compile(CodeGen& CG)
+{
+    CondExpr->compile(CG);
+    size_t ElseJump = CG.emitJump(op_jmp_false);
+
+    ThenExpr->compile(CG);
+    size_t EndJump = CG.emitJump(op_jmp);
+
+    CG.patchJump(ElseJump);
+    CG.adjustDepth(-1);
+    if (ElseExpr != nullptr)
+    {
+        ElseExpr->compile(CG);
+    }
+    else
+    {
+        CG.emitOp(op_const, 1);
+        CG.emitArg(CG.addConst(0));
+    }
+    CG.patchJump(EndJump);
+}
+
+/// The loop variable address and the step stay on the operand stack below
+/// the loop result for the duration of the loop.
+void ForExprAST::compile(CodeGen& CG)
+{
+    Start->compile(CG);
+    CG.emitOp(op_for_var, 0);
+    CG.emitArg(CG.addRef(Ref, VarName));
+
+    if (Step) Step->compile(CG);
+    else
+    {
+        CG.emitOp(op_const, 1);
+        CG.emitArg(CG.addConst(1));
+    }
+    CG.emitOp(op_const, 1);
+    CG.emitArg(CG.addConst(0));
+
+    CG.beginLoop();
+    size_t LoopStart = CG.here();
+    End->compile(CG);
+    size_t ExitJump = CG.emitJump(op_jmp_false);
+    CG.emitOp(op_pop, -1);
+    Body->compile(CG);
+    CG.emitOp(op_for_step, 0);
+    CG.emitLoop(LoopStart);
+
+    CG.patchJump(ExitJump);
+    CG.endLoop();
+    CG.emitOp(op_unwind, -2);
+    CG.emitArg(2);
+}
+
+/// A pfor runs in the tree walker, which owns the worker threads; the VM
+/// only hands it the current frame.
+void PforExprAST::compile(CodeGen& CG)
+{
+    CG.emitOp(op_pfor, 1);
+    CG.emitArg(CG.addNode(this));
+}
+
+void WhileExprAST::compile(CodeGen& CG)
+{
+    CG.emitOp(op_const, 1);
+    CG.emitArg(CG.addConst(0));
+
+    CG.beginLoop();
+    size_t LoopStart = CG.here();
+    Cond->compile(CG);
+    size_t ExitJump = CG.emitJump(op_jmp_false);
+    CG.emitOp(op_pop, -1);
+    Body->compile(CG);
+    CG.emitLoop(LoopStart);
+
+    CG.patchJump(ExitJump);
+    CG.endLoop();
+}
+
+void BlockExprAST::compile(CodeGen& CG)
+{
+    for (size_t i = 0; i < Expressions.size(); i++)
+    {
+        Expressions[i]->compile(CG);
+        if (i + 1 != Expressions.size()) CG.emitOp(op_pop, -1);
+    }
+}
+
+void BreakExprAST::compile(CodeGen& CG)
+{
+    Expr->compile(CG);
+    CG.emitBreak();
+}
+
+void ReturnExprAST::compile(CodeGen& CG)
+{
+    if (TailCall) static_cast<CallExprAST*>(Expr)->compileTail(CG);
+    else Expr->compile(CG);
+    CG.emitReturn();
+}
+
+const Chunk& FunctionAST::getBytecode()
+{
+    if (Bytecode) return *Bytecode;
+
+    Bytecode = std::make_shared<Chunk>();
+    Bytecode->Name = Proto->getName();
+    Bytecode->FrameSize = FrameSize;
+    Bytecode->KeepSlots = KeepSlots;
+
+    CodeGen CG(*Bytecode);
+    Body->compile(CG);
+    CG.emitReturn();
+
+    if (DumpBytecode) DisassembleChunk(*Bytecode);
+    return *Bytecode;
+}
+
+static unsigned int ReadArg(const Chunk& C, size_t At)
+{
+    unsigned int Arg;
+    memcpy(&Arg, &C.Code[At], 4);
+    return Arg;
+}
+
+static const char* OpName(unsigned char Op)
+{
+    static const char* Names[] = {
+        "CONST", "POP", "UNWIND", "LOAD_LOCAL", "STORE_LOCAL", "LOAD_VAR",
+        "STORE_VAR", "ADDR_VAR", "LOAD_ELEM", "STORE_ELEM", "ADDR_ELEM",
+        "DEREF", "STORE_DEREF", "DECL_ARR", "NEG", "NOT", "ADD", "SUB", "MUL",
+        "DIV", "MOD", "POW", "EQ", "NE", "LT", "GT", "LE", "GE", "BOOL",
+        "JMP", "JMP_FALSE", "FOR_VAR", "FOR_STEP", "CALL", "TAIL_CALL", "RET",
+        "PFOR", "ERROR",
+    };
+    return Op <= op_error ? Names[Op] : "???";
+}
+
+static void PrintRef(const Chunk& C, unsigned int Idx)
+{
+    const ChunkRef& R = C.Refs[Idx];
+    static const char* Depths[] = { "local", "global", "either" };
+    fprintf(CurInterp->Err, "'%s' %s", C.Names[R.Name].c_str(), Depths[R.Ref.Depth]);
+    if (R.Ref.Depth != ref_global) fprintf(CurInterp->Err, " slot %u", R.Ref.Slot);
+    if (R.Ref.Declares) fprintf(CurInterp->Err, " (declares)");
+}
+
+void DisassembleChunk(const Chunk& C)
+{
+    fprintf(CurInterp->Err, "== %s (max stack %d, frame %u) ==\n", C.Name.c_str(), C.MaxDepth, C.FrameSize);
+
+    size_t At = 0;
+    while (At < C.Code.size())
+    {
+        unsigned char Op = C.Code[At];
+        fprintf(CurInterp->Err, "%04zu  %-12s", At, OpName(Op));
+        At++;
+
+        switch (Op)
+        {
+        case op_const:
+            fprintf(CurInterp->Err, "%u (%g)", ReadArg(C, At), C.Consts[ReadArg(C, At)]);
+            At += 4;
+            break;
+        case op_unwind:
+        case op_load_local:
+        case op_store_local:
+        case op_pfor:
+            fprintf(CurInterp->Err, "%u", ReadArg(C, At));
+            At += 4;
+            break;
+        case op_load_var:
+        case op_store_var:
+        case op_addr_var:
+        case op_for_var:
+        case op_decl_arr:
+            PrintRef(C, ReadArg(C, At));
+            At += 4;
+            break;
+        case op_load_elem:
+        case op_store_elem:
+        case op_addr_elem:
+            PrintRef(C, ReadArg(C, At));
+            fprintf(CurInterp->Err, " %u", ReadArg(C, At + 4));
+            At += 8;
+            break;
+        case op_error:
+            fprintf(CurInterp->Err, "'%s'", C.Names[ReadArg(C, At)].c_str());
+            At += 4;
+            break;
+        case op_call:
+        case op_tail_call:
+            fprintf(CurInterp->Err, "'%s' %u", CurInterp->FuncTbl[C.Calls[ReadArg(C, At)]->Func].Name.c_str(), ReadArg(C, At + 4));
+            At += 8;
+            break;
+        case op_jmp:
+        case op_jmp_false:
+            fprintf(CurInterp->Err, "-> %04d", (int)(At + 4) + (int)ReadArg(C, At));
+            At += 4;
+            break;
+        default:
+            break;
+        }
+        fprintf(CurInterp->Err, "\n");
+    }
+    fprintf(CurInterp->Err, "\n");
+}
@@ -0,0 +1,122 @@
+
+// MicroSEL
+// bytecode.h
+
+#pragma once
+
+#include "value.h"
+#include "ast.h"
+#include <string>
+#include <vector>
+
+/// Opcodes of the stack machine. Operands follow the opcode byte as
+/// 32-bit little-endian words; jump offsets are relative to the end of
+/// the instruction.
+typedef enum OpCode : unsigned char
+{
+    op_const = 0,     // [k]          push Consts[k]
+    op_pop,           //              drop the top value
+    op_unwind,        // [n]          drop n values below the top value
+    op_load_local,    // [slot]       push a frame slot
+    op_store_local,   // [slot]       assign a frame slot, keep the value
+    op_load_var,      // [ref]        push a global (or either) variable
+    op_store_var,     // [ref]        assign a variable, keep the value
+    op_addr_var,      // [ref]        push the address of a variable
+    op_load_elem,     // [ref, n]     pop n indices, push an array element
+    op_store_elem,    // [ref, n]     pop n indices, assign an array element
+    op_addr_elem,     // [ref, n]     pop n indices, push an element address
+    op_deref,         //              replace an address with the value it points to
+    op_store_deref,   //              pop an address, store the value below it
+    op_decl_arr,      // [ref]        zero an array and push its size
+    op_neg,
+    op_not,
+    op_add,
+    op_sub,
+    op_mul,
+    op_div,
+    op_mod,
+    op_pow,
+    op_eq,
+    op_ne,
+    op_lt,
+    op_gt,
+    op_le,
+    op_ge,
+    op_bool,          //              replace the top value with 0 or 1
+    op_jmp,           // [off]
+    op_jmp_false,     // [off]        pop the condition, jump if it is zero
+    op_for_var,       // [ref]        pop the start value, push the loop variable address
+    op_for_step,      //              add the step to the loop variable
+    op_call,          // [call, argc]  call Calls[call] with argc arguments
+    op_tail_call,     // [call, argc]  like op_call, but the callee replaces this frame
+    op_ret,
+    op_pfor,          // [node]       run Nodes[node] in the tree walker, push its value
+    op_error,         // [msg]        report Names[msg] and abort
+} opCode;
+
+/// ChunkRef - a resolved variable together with its name for messages.
+struct ChunkRef
+{
+    VarRef Ref;
+    unsigned int Name;
+};
+
+/// Chunk - the compiled form of a single FunctionAST.
+struct Chunk
+{
+    std::string Name;
+    std::vector<unsigned char> Code;
+    std::vector<double> Consts;
+    std::vector<std::string> Names;
+    std::vector<ChunkRef> Refs;
+    std::vector<CallLink*> Calls; // links of the call sites in the AST
+    std::vector<ExprAST*> Nodes; // nodes the VM leaves to the tree walker
+    int MaxDepth = 0; // deepest operand stack use, checked once per call
+    unsigned int FrameSize = 0;
+    unsigned int KeepSlots = 0;
+};
+
+/// CodeGen - emits bytecode into a chunk, tracking the operand stack depth
+/// so that 'break' knows how much to unwind.
+class CodeGen
+{
+    struct LoopInfo
+    {
+        int Depth; // operand depth with the loop result on top
+        std::vector<size_t> BreakJumps;
+    };
+
+    Chunk& C;
+    int Depth = 0;
+    std::vector<LoopInfo> Loops;
+
+public:
+    CodeGen(Chunk& C) : C(C) {}
+
+    void emitOp(opCode Op, int StackEffect);
+    void emitArg(unsigned int Arg);
+    void adjustDepth(int Delta);
+    int getDepth() const { return Depth; }
+
+    unsigned int addConst(double Val);
+    unsigned int addName(const std::string& Name);
+    unsigned int addRef(const VarRef& Ref, const std::string& Name);
+    unsigned int addCall(CallLink* Link);
+    unsigned int addNode(ExprAST* Node);
+
+    size_t emitJump(opCode Op);
+    void patchJump(size_t At);
+    void emitLoop(size_t Target);
+    size_t here() const { return C.Code.size(); }
+
+    void emitLoad(const VarRef& Ref, const std::string& Name);
+    void emitStore(const VarRef& Ref, const std::string& Name);
+    void emitError(const std::string& Msg);
+
+    void beginLoop();
+    void emitBreak();
+    void endLoop();
+    void emitReturn();
+};
+
+void DisassembleChunk(const Chunk& C);
@@ -7,17 +7,19 @@
 #include "ast.h"
 #include "execute.h"
 #include "stdfunc.h"
+#include "vm.h"
+#include "jit.h"
+#include "memo.h"
+#include "optimizer.h"
+#include "profile.h"
+#include "resolver.h"
 #include <map>
 #include <cmath>
+#include <chrono>
 
-static std::map<std::string, std::shared_ptr<FunctionAST>> Functions;
-static std::vector<namedValue> SymTbl;
-static Memory StackMemory;
+extern thread_local int CurTok;
 
-extern int CurTok;
-
-std::string MainCode;
-int MainIdx = 0;
+bool LexStats = false;
 
 typedef enum ArrAction
 {
@@ -26,12 +28,79 @@ typedef enum ArrAction
     setVal,
 } arrAction;
 
-bool IsInteractive = true; // true for default
+bool UseBytecode = false;
+bool DumpBytecode = false;
+bool CheckBounds = true;
 
+/// LogErrorV - reports an error; LogError leaves flow_err in Flow, so the
+/// running expression stops at the next node that checks.
 Value LogErrorV(const char* Str)
 {
     LogError(Str);
-    return Value(val_err);
+    return Value();
+}
+
+/// RefAddr - address of a resolved variable. Scalar lookups (AnyKind false)
+/// skip arrays, like the name lookups they replace.
+bool RefAddr(const VarRef& Ref, unsigned int Base, bool AnyKind, unsigned int& Addr)
+{
+    if (Ref.Outer) Base = OuterBase;
+    if (Ref.Depth == ref_local)
+    {
+        Addr = Base + Ref.Slot;
+        return true;
+    }
+
+    const namedValue& Global = CurInterp->SymTbl[Ref.Global];
+    if (Global.Defined && (AnyKind || !Global.IsArr))
+    {
+        Addr = Global.Addr;
+        return true;
+    }
+    if (Ref.Depth == ref_either)
+    {
+        Addr = Base + Ref.Slot;
+        return true;
+    }
+    return false;
+}
+
+bool ArrBase(const VarRef& Ref, unsigned int Base, unsigned int& Addr, const ArrShape*& Shape)
+{
+    if (Ref.Outer) Base = OuterBase;
+    if (Ref.Depth == ref_local)
+    {
+        Addr = Base + Ref.Slot;
+        Shape = Ref.Shape;
+        return Shape != nullptr;
+    }
+
+    const namedValue& Global = CurInterp->SymTbl[Ref.Global];
+    if (!Global.Defined || !Global.IsArr) return false;
+    Addr = Global.Addr;
+    Shape = &Global.Shape;
+    return true;
+}
+
+void StoreVar(const VarRef& Ref, unsigned int Base, Value Val)
+{
+    unsigned int Addr = 0; // stores resolve to a declared slot, see Resolver::declare
+    RefAddr(Ref, Base, true, Addr);
+    if (Ref.Declares) PublishGlobal(Ref, Addr, nullptr);
+    CurInterp->StackMemory.setValue(Addr, Val);
+}
+
+/// PublishGlobal - makes a top-level declaration visible to functions.
+void PublishGlobal(const VarRef& Ref, unsigned int Addr, const ArrShape* Shape)
+{
+    namedValue& Global = CurInterp->SymTbl[Ref.Global];
+    if (!Global.Defined || Global.Addr != Addr || Global.IsArr != (Shape != nullptr)
+        || (Shape && Global.Shape.Dims != Shape->Dims))
+        CurInterp->GlobalEpoch++; // compiled code baked in the old location
+    Global.Addr = Addr;
+    Global.IsArr = Shape != nullptr;
+    Global.Shape = Shape ? *Shape : ArrShape();
+    Global.Defined = true;
 }
 
 Value NumberExprAST::execute()
@@ -42,77 +111,83 @@ Value NumberExprAST::execute()
 Value DeRefExprAST::execute()
 {
     Value Address = AddrExpr->execute();
-    if (Address.isErr())
-        return Value(val_err);
-    if (Address.isUInt()) // address should be an uint
-        return StackMemory.getValue((unsigned int)Address.getNum());
+    if (!Address.isUInt()) // address should be an uint
+        return LogErrorV("Address must be an unsigned integer");
+    if (Address.getNum() >= CurInterp->StackMemory.getSize())
+        return LogErrorV("Address out of range");
 
-    return LogErrorV("Address must be an unsigned integer");
+    return CurInterp->StackMemory.getValue((unsigned int)Address.getNum());
 }
 
-Value HandleArr(std::string ArrName, const std::vector<std::shared_ptr<ExprAST>>& Indices, arrAction Action, Value Val)
+Value HandleArr(const std::string& ArrName, const VarRef& Ref, const ExprList& Indices, arrAction Action, Value Val)
 {
-    for (int i = SymTbl.size() - 1; i >= 0; i--)
+    unsigned int ArrAddr;
+    const ArrShape* Shape;
+    if (!ArrBase(Ref, FrameBase, ArrAddr, Shape))
+        return LogErrorV((((std::string)("\"") + ArrName + (std::string)("\" is not an array"))).c_str());
+
+    // Every index is evaluated before the shape is checked, as before. An
+    // error from before this access, like a failed left operand, is not
+    // blamed on the indices.
+    fType Entry = Flow.Type;
+    unsigned int N = Indices.size();
+    bool Match = N == Shape->Dims.size();
+    bool InRange = true;
+    int AddVal = 0;
+    for (unsigned int k = 0; k < N; k++)
     {
-        if (SymTbl[i].Name == ArrName && SymTbl[i].IsArr)
-        {
-            std::vector<Value> IdxV;
-            for (int k = 0, e = Indices.size(); k != e; ++k) {
-                IdxV.push_back(Indices[k]->execute());
-                if (IdxV.back().isErr()) return LogErrorV("Error while calculating indices");
-                if (!IdxV.back().isInt()) return LogErrorV("Index must be an integer");
-            }
-
-            if (IdxV.size() != SymTbl[i].DimInfo.size()) return LogErrorV("Dimension mismatch");
-
-            int AddVal = 0;
-            for (int l = 0; l < IdxV.size(); l++)
-            {
-                int MulVal = 1;
-                for (int m = l + 1; m < IdxV.size(); m++) MulVal *= SymTbl[i].DimInfo[m];
-                AddVal += MulVal * IdxV[l].getNum();
-            }
-            switch (Action)
-            {
-            case getVal:
-                return StackMemory.getValue((unsigned int)(SymTbl[i].Addr + AddVal));
-            case getAddr:
-                return Value(SymTbl[i].Addr + AddVal);
-            case setVal:
-                StackMemory.setValue(SymTbl[i].Addr + AddVal, Val);
-                return Val;
-            }
-        }
+        Value Idx = Indices[k]->execute();
+        if (Flow.Type != Entry) break;
+        if (!Idx.isInt()) return LogErrorV("Index must be an integer");
+        if (!Match) continue;
+
+        double I = Idx.getNum();
+        if (CheckBounds && !(I >= 0 && I < Shape->Dims[k])) InRange = false;
+        else AddVal += (int)I * Shape->Strides[k];
     }
-    return LogErrorV((((std::string)("\"") + ArrName + (std::string)("\" is not an array"))).c_str());
+    if (Flow.Type != Entry)
+        return Flow.Type == flow_err ? LogErrorV("Error while calculating indices") : Value();
+
+    if (!Match) return LogErrorV("Dimension mismatch");
+    if (!InRange) return LogErrorV("Index out of range");
+    // Unchecked indices may still not leave the part of Memory in use.
+    if (!CheckBounds && ArrAddr + AddVal >= CurInterp->StackMemory.getSize())
+        return LogErrorV("Address out of range");
+    switch (Action)
+    {
+    case getVal:
+        return CurInterp->StackMemory.getValue((unsigned int)(ArrAddr + AddVal));
+    case getAddr:
+        return Value(ArrAddr + AddVal);
+    case setVal:
+        CurInterp->StackMemory.setValue(ArrAddr + AddVal, Val);
+        return Val;
+    }
+    return Value();
 }
 
-Value HandleArr(std::string ArrName, const std::vector<std::shared_ptr<ExprAST>>& Indices, arrAction Action) { return HandleArr(ArrName, Indices, Action, Value()); }
+Value HandleArr(const std::string& ArrName, const VarRef& Ref, const ExprList& Indices, arrAction Action) { return HandleArr(ArrName, Ref, Indices, Action, Value()); }
 
 Value VariableExprAST::execute()
 {
     if (!Indices.empty()) // array element
-        return HandleArr(Name, Indices, getVal);
+        return HandleArr(Name, Ref, Indices, getVal);
 
     // normal variable
-    for (int i = SymTbl.size() - 1; i >= 0; i--)
-    {
-        if (SymTbl[i].Name == Name && !SymTbl[i].IsArr)
-            return StackMemory.getValue(SymTbl[i].Addr);
-    }
+    unsigned int Addr;
+    if (RefAddr(Ref, FrameBase, false, Addr))
+        return CurInterp->StackMemory.getValue(Addr);
     return LogErrorV(std::string("Identifier \"" + Name + "\" not found").c_str());
 }
 
 Value ArrDeclExprAST::execute()
 {
-    namedValue Arr = { Name, StackMemory.push(Value(0)), true, Indices };
-    SymTbl.push_back(Arr);
+    unsigned int Addr = FrameBase + Ref.Slot;
 
-    int size = 1;
-    for (int i = 0; i < Indices.size(); i++) size *= Indices[i];
-    for (int i = 0; i < size - 1; i++) StackMemory.push(Value(0));
+    for (int i = 0; i < Shape.Size; i++) CurInterp->StackMemory.setValue(Addr + i, Value(0));
 
-    return Value(size);
+    if (Ref.Declares) PublishGlobal(Ref, Addr, &Shape);
+    return Value(Shape.Size);
 }
 
 Value UnaryExprAST::execute()
@@ -122,26 +197,22 @@ Value UnaryExprAST::execute()
         if (Operand->getNodeType() != node_var)
             return LogErrorV("Operand of '&' must be a variable");
 
-        VariableExprAST* Op = static_cast<VariableExprAST*>(Operand.get());
-        const std::vector<std::shared_ptr<ExprAST>>& Indices = Op->getIndices();
+        VariableExprAST* Op = static_cast<VariableExprAST*>(Operand);
+        const ExprList& Indices = Op->getIndices();
         if (!Indices.empty()) // array element
         {
-            return HandleArr(Op->getName(), Indices, getAddr);
+            return HandleArr(Op->getName(), Op->getRef(), Indices, getAddr);
         }
         else // normal variable
         {
-            for (int i = SymTbl.size() - 1; i >= 0; i--)
-            {
-                if (SymTbl[i].Name == Op->getName())
-                    return Value(SymTbl[i].Addr);
-            }
+            unsigned int Addr;
+            if (RefAddr(Op->getRef(), FrameBase, true, Addr))
+                return Value(Addr);
             return LogErrorV(std::string("Variable \"" + Op->getName() + "\" not found").c_str());
         }
     }
 
     Value OperandV = Operand->execute();
-    if (OperandV.isErr())
-        return Value(val_err);
 
     switch (Opcode)
     {
@@ -155,384 +226,544 @@ Value UnaryExprAST::execute()
         return Value(-(OperandV.getNum()));
         break;
     }
+    return LogErrorV("Unknown unary operator");
 }
 
 Value BinaryExprAST::execute() {
     // Special case '=' because we don't want to emit the LHS as an expression.
-    if (Op == "=")
+    if (Op == binop_assign)
     {
         // execute the RHS.
         Value Val = RHS->execute();
-
-        if (Val.isErr())
-            return Value(val_err);
+        if (Flow.Type != flow_normal)
+            return Value();
 
         // Assignment requires the LHS to be an identifier.
         VariableExprAST* LHSE;
 
-        if (LHS->getNodeType() == node_var) LHSE = static_cast<VariableExprAST*>(LHS.get());
+        if (LHS->getNodeType() == node_var) LHSE = static_cast<VariableExprAST*>(LHS);
         else if (LHS->getNodeType() == node_deref)
         {
-            DeRefExprAST* LHSE = static_cast<DeRefExprAST*>(LHS.get());
+            DeRefExprAST* LHSE = static_cast<DeRefExprAST*>(LHS);
 
             // update value at the memory address
             Value Addr = LHSE->getExpr()->execute();
+            if (Flow.Type != flow_normal) return Value();
             if (!Addr.isUInt()) return LogErrorV("Address must be an unsigned integer");
+            if (Addr.getNum() >= CurInterp->StackMemory.getSize()) return LogErrorV("Address out of range");
 
-            StackMemory.setValue(Addr.getNum(), Val);
+            CurInterp->StackMemory.setValue(Addr.getNum(), Val);
             return Val;
         }
         else return LogErrorV("Destination of '=' must be a variable");
 
-        // Look up the name.
-        std::vector<std::shared_ptr<ExprAST>> Indices = LHSE->getIndices();
+        const ExprList& Indices = LHSE->getIndices();
         if (!Indices.empty()) // array element
-        {
-            return HandleArr(LHSE->getName(), Indices, setVal, Val);
-        }
-        else // normal variable
-        {
-            bool found = false;
-            for (int i = SymTbl.size() - 1; i >= 0; i--)
-            {
-                if (SymTbl[i].Name == LHSE->getName())
-                {
-                    StackMemory.setValue(SymTbl[i].Addr, Val);
-                    found = true;
-                    break;
-                }
-            }
-            if (!found)
-            {
-                namedValue Var = { LHSE->getName(), StackMemory.push(Val), false };
-                SymTbl.push_back(Var);
-            }
-        }
+            return HandleArr(LHSE->getName(), LHSE->getRef(), Indices, setVal, Val);
+
+        // normal variable
+        StoreVar(LHSE->getRef(), FrameBase, Val);
         return Val;
     }
 
+    // Both sides run even if the left one fails, but calls on the right
+    // return at once; the result is dropped by whichever node checks Flow
+    // next.
     Value L = LHS->execute();
     Value R = RHS->execute();
 
-    if (L.isErr() || R.isErr())
-        return Value(val_err);
-
-    if (Op == "==")
-        return Value((L.getNum() == R.getNum()));
-
-    if (Op == "!=")
-        return Value((L.getNum() != R.getNum()));
-
-    if (Op == "&&")
-        return Value((L.getNum() && R.getNum()));
-
-    if (Op == "||")
-        return Value((L.getNum() || R.getNum()));
-
-    if (Op == "<")
-        return Value((L.getNum() < R.getNum()));
-
-    if (Op == ">")
-        return Value((L.getNum() > R.getNum()));
-
-    if (Op == "<=")
-        return Value((L.getNum() <= R.getNum()));
-
-    if (Op == ">=")
-        return Value((L.getNum() >= R.getNum()));
-
-    if (Op == "+")
-        return Value((L.getNum() + R.getNum()));
-
-    if (Op == "-")
-        return Value((L.getNum() - R.getNum()));
-
-    if (Op == "*")
-        return Value((L.getNum() * R.getNum()));
+    double LV = L.getNum(), RV = R.getNum();
+    switch (Op)
+    {
+    case binop_eq: return Value(LV == RV);
+    case binop_ne: return Value(LV != RV);
+    case binop_lt: return Value(LV < RV);
+    case binop_gt: return Value(LV > RV);
+    case binop_le: return Value(LV <= RV);
+    case binop_ge: return Value(LV >= RV);
+    case binop_add: return Value(LV + RV);
+    case binop_sub: return Value(LV - RV);
+    case binop_mul: return Value(LV * RV);
+    case binop_div: return Value(LV / RV);
+    case binop_mod: return Value(fmod(LV, RV));
+    case binop_pow: return Value(pow(LV, RV));
+    default: return LogErrorV("Unknown binary operator");
+    }
+}
 
-    if (Op == "/")
-        return Value((L.getNum() / R.getNum()));
+Value LogicalExprAST::execute()
+{
+    Value L = LHS->execute();
+    if (Flow.Type != flow_normal)
+        return Value();
 
-    if (Op == "%")
-        return Value(fmod(L.getNum(), R.getNum()));
+    // '&&' is decided by a false LHS, '||' by a true one.
+    bool LV = L.getNum() != 0;
+    if (LV == (Op == binop_or))
+        return Value(LV);
 
-    if (Op == "**")
-        return Value(pow(L.getNum(), R.getNum()));
+    Value R = RHS->execute();
+    return Value(R.getNum() != 0);
 }
 
 Value CallExprAST::execute()
 {
+    // A return, break or error still pending from earlier in the expression
+    // ends it before the callee runs, as in the VM.
+    if (Flow.Type != flow_normal) return Value();
+
+    LinkCall(Link);
+    if (Link.State == link_script)
+    {
+        // Arguments are evaluated straight into the callee's frame.
+        unsigned int Base;
+        if (!CurInterp->StackMemory.pushFrame(Link.Script->getFrameSize(), Base))
+            return Value();
+        for (unsigned int i = 0; i < Args.size(); i++)
+        {
+            Value Arg = Args[i]->execute();
+            if (Flow.Type != flow_normal)
+            {
+                CurInterp->StackMemory.deleteScope(Base);
+                return Value();
+            }
+            CurInterp->StackMemory.setValue(Base + i, Arg);
+        }
+        return Link.Script->execute(Base);
+    }
+
     std::vector<Value> ArgsV;
     for (int i = 0, e = Args.size(); i != e; ++i) {
         ArgsV.push_back(Args[i]->execute());
-        if (ArgsV.back().isErr())
-            return Value(val_err);
+        if (Flow.Type != flow_normal)
+            return Value();
     }
+    return CallLinked(Link, ArgsV);
+}
 
-    if (std::find(StdFuncList.begin(), StdFuncList.end(), Callee) != StdFuncList.end())
-        return Value(CallStdFunc(Callee, ArgsV));
+/// executeTail - evaluates the arguments of a call in tail position above
+/// the current frame and leaves the call to FunctionAST::execute, which
+/// runs it in place of the caller. Other callees are called normally.
+Value CallExprAST::executeTail()
+{
+    LinkCall(Link);
+    if (Link.State != link_script) return execute();
 
-    // Look up the name in the global module table.
-    std::shared_ptr<FunctionAST> CalleeF = Functions[Callee];
-    if (!CalleeF)
-        return LogErrorV("Unknown function referenced");
+    unsigned int ArgBase = CurInterp->StackMemory.getSize();
+    for (unsigned int i = 0; i < Args.size(); i++)
+    {
+        Value Arg = Args[i]->execute();
+        if (Flow.Type != flow_normal || !CurInterp->StackMemory.push(Arg))
+        {
+            CurInterp->StackMemory.deleteScope(ArgBase);
+            return Value();
+        }
+    }
+    SetTailCall(*Link.Script, ArgBase);
+    Flow.Type = flow_tail;
+    return Value();
+}
 
-    // If argument mismatch error.
-    if (CalleeF->argsSize() != Args.size())
-        return LogErrorV("Incorrect number of arguments passed");
+/// RelinkCall - binds a call site to the current definition of its callee.
+/// Standard functions take precedence over script functions of the same name.
+void RelinkCall(CallLink& Link)
+{
+    const functionEntry& Func = CurInterp->FuncTbl[Link.Func];
+    Link.Version = Func.Version;
+    Link.Std = Func.Std;
+    Link.Script = Func.Fn.get();
+
+    if (Func.Std) Link.State = link_std;
+    else if (!Func.Fn) Link.State = link_unknown;
+    else if ((unsigned int)Func.Fn->argsSize() != Link.Argc) Link.State = link_arity;
+    else Link.State = link_script;
+}
+
+/// CallLinked - calls the function a call site is linked to. Script
+/// functions are usually entered directly through their frame instead.
+Value CallLinked(CallLink& Link, std::vector<Value>& Args)
+{
+    if (Flow.Type != flow_normal) return Value();
 
-    return CalleeF->execute(ArgsV);
+    LinkCall(Link);
+    switch (Link.State)
+    {
+    case link_std:
+        return Link.Std(Args);
+    case link_script:
+    {
+        unsigned int Base;
+        if (!CurInterp->StackMemory.pushFrame(Link.Script->getFrameSize(), Base))
+            return Value();
+        for (unsigned int i = 0; i < Args.size(); i++)
+            CurInterp->StackMemory.setValue(Base + i, Args[i]);
+        return Link.Script->execute(Base);
+    }
+    case link_arity:
+        return LogErrorV("Incorrect number of arguments passed");
+    default:
+        return LogErrorV("Unknown function referenced");
+    }
 }
 
 Value IfExprAST::execute()
 {
     Value CondV = CondExpr->execute();
-    if (CondV.isErr())
-        return Value(val_err);
+    if (Flow.Type != flow_normal)
+        return Value();
 
     if (CondV.getNum())
-    {
-        int StackIdx = StackMemory.getSize(), TblIdx = SymTbl.size();
-        Value ThenV = ThenExpr->execute();
-
-        StackMemory.deleteScope(StackIdx);
-        for (int i = SymTbl.size(); i > TblIdx; i--) SymTbl.pop_back();
-
-        if (ThenV.isErr())
-            return Value(val_err);
-        return ThenV;
-    }
+        return ThenExpr->execute();
     else if (ElseExpr != nullptr)
-    {
-        int StackIdx = StackMemory.getSize(), TblIdx = SymTbl.size();
-        Value ElseV = ElseExpr->execute();
-
-        StackMemory.deleteScope(StackIdx);
-        for (int i = SymTbl.size(); i > TblIdx; i--) SymTbl.pop_back();
-
-        if (ElseV.isErr())
-            return Value(val_err);
-        return ElseV;
-    }
+        return ElseExpr->execute();
     return Value(0);
 }
 
 Value ForExprAST::execute()
 {
-    Value StartVal = Start->execute();
-    if (StartVal.isErr())
-        return Value(val_err);
+    ProfileScope Prof(*this);
+    Value RetVal;
+    if (UseJit && !JitPaused && JitRunLoop(*this, Jit, FrameBase, nullptr, RetVal))
+        return RetVal;
 
-    int StackIdx = StackMemory.getSize(), TblIdx = SymTbl.size();
-    int StartVarAddr;
+    Value StartVal = Start->execute();
+    if (Flow.Type != flow_normal)
+        return Value();
 
-    bool found = false;
-    for (int i = SymTbl.size() - 1; i >= 0; i--)
-    {
-        if (SymTbl[i].Name == VarName)
-        {
-            StackMemory.setValue(i, StartVal);
-            StartVarAddr = i;
-            found = true;
-            break;
-        }
-    }
-    if (!found)
-    {
-        namedValue Var = { VarName, StackMemory.push(StartVal), false };
-        SymTbl.push_back(Var);
-        StartVarAddr = SymTbl.size() - 1;
-    }
+    unsigned int StartVarAddr;
+    RefAddr(Ref, FrameBase, true, StartVarAddr);
+    CurInterp->StackMemory.setValue(StartVarAddr, StartVal);
 
     // Emit the step value.
     Value StepVal(1);
     if (Step)
     {
         StepVal = Step->execute();
-        if (StepVal.isErr())
-            return Value(val_err);
+        if (Flow.Type != flow_normal)
+            return Value();
     }
 
-    Value BodyExpr, EndCond;
+    Value BodyExpr(0), EndCond;
     while (true)
     {
         EndCond = End->execute();
-        if (EndCond.isErr() || !EndCond.getNum()) break;
+        if (Flow.Type != flow_normal || !EndCond.getNum()) break;
 
+        Prof.Iterations++;
         BodyExpr = Body->execute();
-        if (BodyExpr.isErr()) break;
-        if (BodyExpr.getType() == val_break)
+        if (Flow.Type != flow_normal)
         {
-            BodyExpr.setType(val_data);
+            if (Flow.Type == flow_break) BodyExpr = TakeFlowValue();
             break;
         }
-        StackMemory.setValue(StartVarAddr,
-            Value(StackMemory.getValue(StartVarAddr).getNum() + StepVal.getNum()));
-    }
-
-    StackMemory.deleteScope(StackIdx);
-    for (int i = SymTbl.size(); i > TblIdx; i--) SymTbl.pop_back();
-
-    if (BodyExpr.isErr() || EndCond.isErr())
-        return Value(val_err);
+        CurInterp->StackMemory.setValue(StartVarAddr,
+            Value(CurInterp->StackMemory.getValue(StartVarAddr).getNum() + StepVal.getNum()));
 
+        // A hot loop continues in native code from the next condition check.
+        if (UseJit && !JitPaused && !Jit.Failed && ++Jit.Counter >= JitLoopThreshold)
+        {
+            double Resume[2] = { StepVal.getNum(), BodyExpr.getNum() };
+            if (JitRunLoop(*this, Jit, FrameBase, Resume, BodyExpr)) return BodyExpr;
+        }
+    }
     return BodyExpr;
 }
 
 Value WhileExprAST::execute()
 {
-    int StackIdx = StackMemory.getSize(), TblIdx = SymTbl.size();
+    ProfileScope Prof(*this);
+    Value BodyExpr(0), EndCond;
+    if (UseJit && !JitPaused && JitRunLoop(*this, Jit, FrameBase, nullptr, BodyExpr))
+        return BodyExpr;
 
-    Value BodyExpr, EndCond;
     while (true)
     {
         EndCond = Cond->execute();
-        if (EndCond.isErr() || !EndCond.getNum()) break;
+        if (Flow.Type != flow_normal || !EndCond.getNum()) break;
 
+        Prof.Iterations++;
         BodyExpr = Body->execute();
-        if (BodyExpr.isErr()) break;
-        if (BodyExpr.getType() == val_break)
+        if (Flow.Type != flow_normal)
         {
-            BodyExpr.setType(val_data);
+            if (Flow.Type == flow_break) BodyExpr = TakeFlowValue();
             break;
         }
-    }
-    StackMemory.deleteScope(StackIdx);
-    for (int i = SymTbl.size(); i > TblIdx; i--) SymTbl.pop_back();
-
-    if (EndCond.isErr() || BodyExpr.isErr())
-        return Value(val_err);
 
+        if (UseJit && !JitPaused && !Jit.Failed && ++Jit.Counter >= JitLoopThreshold)
+        {
+            double Resume[2] = { 0, BodyExpr.getNum() };
+            if (JitRunLoop(*this, Jit, FrameBase, Resume, BodyExpr)) return BodyExpr;
+        }
+    }
     return BodyExpr;
 }
 
 Value BreakExprAST::execute()
 {
     Value RetVal = Expr->execute();
-    if (RetVal.isErr())
+    if (Flow.Type == flow_err)
         return LogErrorV("Failed to return a value");
 
-    RetVal.setType(val_break);
-    return RetVal;
+    if (Flow.Type == flow_normal)
+    {
+        Flow.Type = flow_break;
+        Flow.Val = RetVal.getNum();
+    }
+    return Value();
 }
 
 Value ReturnExprAST::execute()
 {
-    Value RetVal = Expr->execute();
-    if (RetVal.isErr())
+    Value RetVal = TailCall ? static_cast<CallExprAST*>(Expr)->executeTail() : Expr->execute();
+    if (Flow.Type == flow_err)
         return LogErrorV("Failed to return a value");
 
-    RetVal.setType(val_return);
-    return RetVal;
+    if (Flow.Type == flow_normal) // a tail call is already pending otherwise
+    {
+        Flow.Type = flow_return;
+        Flow.Val = RetVal.getNum();
+    }
+    return Value();
 }
 
 Value BlockExprAST::execute()
 {
     Value RetVal(0);
-    int StackIdx = StackMemory.getSize(), TblIdx = SymTbl.size();
-
     for (auto& Expr : Expressions)
     {
         RetVal = Expr->execute();
-        if (RetVal.getType() == val_break || 
-            RetVal.getType() == val_return) break;
+        if (Flow.Type != flow_normal) break;
     }
-    StackMemory.deleteScope(StackIdx);
-    for (int i = SymTbl.size(); i > TblIdx; i--) SymTbl.pop_back();
+    return RetVal;
+}
 
+/// LeaveFunction - the result of a function body that has finished: the
+/// value of a 'return' if one ran, or of a 'break' outside of any loop,
+/// which leaves the function as it does in the VM. Errors stay pending.
+static Value LeaveFunction(Value RetVal)
+{
+    if (Flow.Type == flow_return || Flow.Type == flow_break) return TakeFlowValue();
     return RetVal;
 }
 
-Value FunctionAST::execute(std::vector<Value> Ops)
+/// execute - runs the function in the frame at Base, which the caller has
+/// pushed with getFrameSize() slots and filled with the arguments. Every
+/// scope of the function lives in that one frame; it is popped on return.
+/// With --memo, a pure function returns a cached result for arguments it
+/// has already seen.
+Value FunctionAST::execute(unsigned int Base)
 {
-    int StackIdx = StackMemory.getSize(), TblIdx = SymTbl.size();
+    // Calls are the hottest path the profiler hooks into, so without one
+    // they only pay for this test.
+    if (CurProfile != nullptr) return runProfiled(Base);
+    return run(Base);
+}
 
-    auto& Arg = Proto->getArgs();
-    for (int i = 0; i < Proto->getArgsSize(); i++)
+Value FunctionAST::runProfiled(unsigned int Base)
+{
+    ProfileScope Prof(*this);
+    return run(Base);
+}
+
+Value FunctionAST::run(unsigned int Base)
+{
+    Interpreter& Interp = *CurInterp;
+    // Only a completion the body produces is taken below; one pending in
+    // the caller is left to the caller.
+    if (Flow.Type != flow_normal)
     {
-        namedValue ArgVar = { Arg[i], StackMemory.push(Ops[i]), false };
-        SymTbl.push_back(ArgVar);
+        Interp.StackMemory.deleteScope(Base);
+        return Value();
+    }
+    if (NativeStackExhausted())
+    {
+        Interp.StackMemory.deleteScope(Base);
+        return LogErrorV("Stack overflow");
     }
 
-    Value RetVal = Body->execute();
-
-    if (Proto->getName() != "__anon_expr")
+    Value RetVal;
+    double Key[MaxMemoArgs];
+    memoState Memo = UseMemo ? MemoBegin(*this, Base, Key, RetVal) : memo_off;
+    if (Memo == memo_hit)
     {
-        StackMemory.deleteScope(StackIdx);
-        for (int i = SymTbl.size(); i > TblIdx; i--) SymTbl.pop_back();
+        Interp.StackMemory.deleteScope(Base + KeepSlots);
+        return RetVal;
     }
 
-    if (RetVal.isErr()) return Value(val_err);
-    if (RetVal.getType() == val_return) RetVal.setType(val_data);
+    unsigned int CallerBase = FrameBase;
+    FrameBase = Base;
+    if (!runJit(Base, RetVal)) RetVal = Body->execute();
+    if (Flow.Type == flow_tail) RetVal = RunTailCalls(Base);
+    else if (Flow.Type != flow_normal) RetVal = LeaveFunction(RetVal);
+    FrameBase = CallerBase;
+
+    Interp.StackMemory.deleteScope(Base + KeepSlots);
+
+    if (Flow.Type == flow_err) return Value();
+    if (Memo == memo_miss) MemoEnd(*this, Key, RetVal);
 
     return RetVal;
 }
 
-void HandleDefinition(std::string& Code, int& Idx)
+/// SetTailCall - records a tail call to Callee whose arguments have been
+/// pushed to Memory starting at Args.
+void SetTailCall(FunctionAST& Callee, unsigned int Args)
 {
-    if (auto FnAST = ParseDefinition(Code, Idx))
+    CurInterp->PendingTail.Callee = &Callee;
+    CurInterp->PendingTail.Args = Args;
+}
+
+/// RunTailCalls - runs pending tail calls one after another in the frame
+/// at Base, so that tail recursion needs neither C++ stack nor Memory.
+Value RunTailCalls(unsigned int Base)
+{
+    Interpreter& Interp = *CurInterp;
+    unsigned int CallerBase = FrameBase;
+    FrameBase = Base;
+
+    Value RetVal;
+    do
+    {
+        Flow.Type = flow_normal;
+        FunctionAST& Fn = *Interp.PendingTail.Callee;
+        unsigned int Argc = Fn.argsSize();
+        for (unsigned int i = 0; i < Argc; i++)
+            Interp.StackMemory.setValue(Base + i, Interp.StackMemory.getValue(Interp.PendingTail.Args + i));
+        Interp.StackMemory.deleteScope(Base + Argc);
+        unsigned int Locals;
+        if (!Interp.StackMemory.pushFrame(Fn.getFrameSize() - Argc, Locals)) break;
+
+        ProfileScope Prof(Fn);
+        if (!Fn.runJit(Base, RetVal)) RetVal = Fn.getBody()->execute();
+    } while (Flow.Type == flow_tail);
+
+    FrameBase = CallerBase;
+    return LeaveFunction(RetVal);
+}
+
+void HandleDefinition(TokenStream& Toks)
+{
+    if (auto FnAST = ParseDefinition(Toks))
     {
-        if (IsInteractive) fprintf(stderr, "Read function definition\n");
-        Functions[FnAST->getFuncName()] = FnAST;
+        if (CurInterp->IsInteractive) fprintf(CurInterp->Err, "Read function definition\n");
+        FnAST->optimize();
+        FnAST->resolve();
+        if (DumpBytecode) FnAST->getBytecode();
+        functionEntry& Func = CurInterp->FuncTbl[InternFunction(FnAST->getFuncName())];
+        Func.Fn = FnAST;
+        Func.Version++; // relink every call site of the old definition
+        InvalidateMemo();
     }
-    else GetNextToken(Code, Idx); // Skip token for error recovery.
+    else GetNextToken(Toks); // Skip token for error recovery.
 }
 
-void HandleTopLevelExpression(std::string& Code, int& Idx)
+void HandleTopLevelExpression(TokenStream& Toks)
 {
     // Evaluate a top-level expression into an anonymous function.
-    if (auto FnAST = ParseTopLevelExpr(Code, Idx))
+    if (auto FnAST = ParseTopLevelExpr(Toks))
     {
-        Value RetVal = FnAST->execute(std::vector<Value>());
-        if (!RetVal.isErr() && IsInteractive)
+        FnAST->optimize();
+        FnAST->resolve();
+        MarkNativeStack();
+
+        Flow.Type = flow_normal;
+        Value RetVal;
+        unsigned int Base;
+        if (UseBytecode) RetVal = ExecuteBytecode(*FnAST);
+        else if (CurInterp->StackMemory.pushFrame(FnAST->getFrameSize(), Base)) RetVal = FnAST->execute(Base);
+        if (Flow.Type != flow_err && CurInterp->IsInteractive)
         {
-            fprintf(stderr, "Evaluated to %f\n", RetVal.getNum());
+            fprintf(CurInterp->Err, "Evaluated to %f\n", RetVal.getNum());
         }
     }
-    else GetNextToken(Code, Idx); // Skip token for error recovery.
+    else GetNextToken(Toks); // Skip token for error recovery.
 }
 
 /// top ::= definition | import | external | expression | ';'
-void MainLoop(std::string& Code, int& Idx)
+void MainLoop(TokenStream& Toks)
 {
     bool tmpFlag = false;
     while (true)
     {
-        if (IsInteractive) fprintf(stderr, ">>> ");
+        Flow.Type = flow_normal; // each unit reports its own first error
+        if (CurInterp->IsInteractive) fprintf(CurInterp->Err, ">>> ");
         switch (CurTok)
         {
         case tok_eof:
             return;
         case ';': // ignore top-level semicolons.
-            GetNextToken(Code, Idx);
+            GetNextToken(Toks);
             break;
         case tok_func:
-            HandleDefinition(Code, Idx);
+            HandleDefinition(Toks);
             break;
         default:
-            HandleTopLevelExpression(Code, Idx);
+            HandleTopLevelExpression(Toks);
             break;
         }
     }
 }
 
-void ExecuteScript(const char* FileName)
+/// ExecuteScript - runs a script file; false if it cannot be opened.
+bool ExecuteScript(const char* FileName)
 {
-    IsInteractive = false;
+    CurInterp->IsInteractive = false;
+
+    ScriptFile File;
+    if (!File.open(FileName))
+    {
+        fprintf(CurInterp->Err, "Error: Unknown file name\n");
+        return false;
+    }
 
-    FILE* fp = fopen(FileName, "r");
-    if (fp == NULL)
+    // Lex the whole script into a token array before parsing it.
+    TokenStream Toks(File.getSource());
+    auto LexStart = std::chrono::steady_clock::now();
+    Toks.tokenize();
+    std::chrono::duration<double> LexTime = std::chrono::steady_clock::now() - LexStart;
+    if (LexStats)
+    {
+        size_t Bytes = File.getSource().End - File.getSource().Cur;
+        fprintf(CurInterp->Err, "Lexed %zu bytes into %zu tokens in %.3f ms (%.1f MB/s)\n", Bytes, Toks.size(),
+            LexTime.count() * 1000, LexTime.count() > 0 ? Bytes / LexTime.count() / 1e6 : 0.0);
+    }
+
+    GetNextToken(Toks);
+    MainLoop(Toks);
+
+    fprintf(CurInterp->Err, "\nExecution finished.\n");
+    return true;
+}
+
+/// BenchmarkLexer - lexes a script over and over without running it and
+/// reports the throughput, so lexer changes can be compared on their own.
+void BenchmarkLexer(const char* FileName)
+{
+    ScriptFile File;
+    if (!File.open(FileName))
     {
         fprintf(stderr, "Error: Unknown file name\n");
         return;
     }
-    while (!feof(fp)) MainCode += (char)fgetc(fp);
-    MainCode += EOF;
-    fclose(fp);
 
-    InitBinopPrec();
-    GetNextToken(MainCode, MainIdx);
-    MainLoop(MainCode, MainIdx);
+    size_t Bytes = File.getSource().End - File.getSource().Cur;
+    size_t Tokens = 0;
+    unsigned int Rounds = 0;
+    double Best = 0, Total = 0;
+    while (Rounds < 5 || (Total < 1.0 && Rounds < 1000))
+    {
+        TokenStream Toks(File.getSource());
+        auto Start = std::chrono::steady_clock::now();
+        Toks.tokenize();
+        std::chrono::duration<double> Time = std::chrono::steady_clock::now() - Start;
+
+        Tokens = Toks.size();
+        if (Rounds == 0 || Time.count() < Best) Best = Time.count();
+        Total += Time.count();
+        Rounds++;
+    }
 
-    fprintf(stderr, "\nExecution finished.\n");
-}
\ No newline at end of file
+    fprintf(stderr, "Lexed %zu bytes into %zu tokens, %u rounds\n", Bytes, Tokens, Rounds);
+    fprintf(stderr, "  best  %9.3f ms  %8.1f MB/s\n", Best * 1000, Best > 0 ? Bytes / Best / 1e6 : 0.0);
+    fprintf(stderr, "  mean  %9.3f ms  %8.1f MB/s\n", Total / Rounds * 1000, Total > 0 ? Bytes * Rounds / Total / 1e6 : 0.0);
+}
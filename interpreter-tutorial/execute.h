@@ -5,38 +5,56 @@
 #pragma once
 
 #include "value.h"
+#include "ast.h"
+#include "interpreter.h"
+#include "lexer.h"
 #include <vector>
 #include <string>
+#include <map>
+#include <memory>
 
-extern int MainIdx;
-extern bool IsInteractive;
+extern bool UseBytecode;
+extern bool DumpBytecode;
+extern bool CheckBounds;
+extern bool LexStats;
 
-typedef struct NamedValue
+bool RefAddr(const VarRef& Ref, unsigned int Base, bool AnyKind, unsigned int& Addr);
+
+bool ArrBase(const VarRef& Ref, unsigned int Base, unsigned int& Addr, const ArrShape*& Shape);
+
+void StoreVar(const VarRef& Ref, unsigned int Base, Value Val);
+
+void PublishGlobal(const VarRef& Ref, unsigned int Addr, const ArrShape* Shape);
+
+void RelinkCall(CallLink& Link);
+
+/// LinkCall - brings a call site up to date with its callee's definition.
+inline void LinkCall(CallLink& Link)
 {
-    std::string Name;
-    unsigned int Addr;
+    if (Link.Version != CurInterp->FuncTbl[Link.Func].Version) RelinkCall(Link);
+}
+
+Value CallLinked(CallLink& Link, std::vector<Value>& Args);
 
-    bool IsArr = false;
-    std::vector<int> DimInfo;
-} namedValue;
+void SetTailCall(FunctionAST& Callee, unsigned int Args);
 
-class Memory
+Value RunTailCalls(unsigned int Base);
+
+/// TakeFlowValue - consumes the pending return or break and gives its value.
+inline Value TakeFlowValue()
 {
-    std::vector<Value> Stack;
-public:
-    Value getValue(unsigned int Addr) { return Stack[Addr]; }
-    void setValue(unsigned int Addr, Value Val) { Stack[Addr] = Val; }
-    void deleteScope(unsigned int Addr) { unsigned int size = Stack.size(); for (unsigned int i = Addr; i < size; i++) Stack.pop_back(); }
-    unsigned int push(Value Val) { Stack.push_back(Val); return Stack.size() - 1; }
-    unsigned int getSize() { return Stack.size(); }
-};
+    Flow.Type = flow_normal;
+    return Value(Flow.Val);
+}
 
 Value LogErrorV(const char* Str);
 
-void HandleDefinition(std::string& Code, int& Idx);
+void HandleDefinition(TokenStream& Toks);
+
+void HandleTopLevelExpression(TokenStream& Toks);
 
-void HandleTopLevelExpression(std::string& Code, int& Idx);
+void MainLoop(TokenStream& Toks);
 
-void MainLoop(std::string& Code, int& Idx);
+bool ExecuteScript(const char* FileName);
 
-void ExecuteScript(const char* FileName);
\ No newline at end of file
+void BenchmarkLexer(const char* FileName);
\ No newline at end of file
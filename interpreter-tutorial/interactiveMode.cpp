@@ -8,14 +8,14 @@ void RunInteractiveShell()
 {
     std::string VerStr = "v0.1.0";
 
-    // Install standard binary operators.
-    InitBinopPrec();
+    // Read tokens from the keyboard as the parser asks for them.
+    TokenStream Toks;
 
     // Prime the first token.
     fprintf(stderr, ("MicroSEL " + VerStr + " Interactive Shell\n\n").c_str());
     fprintf(stderr, ">>> ");
-    GetNextToken(MainCode, MainIdx);
+    GetNextToken(Toks);
 
     // Run the main "interpreter loop" now.
-    MainLoop(MainCode, MainIdx);
+    MainLoop(Toks);
 }
\ No newline at end of file
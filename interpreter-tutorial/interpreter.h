@@ -0,0 +1,120 @@
+
+// MicroSEL
+// interpreter.h
+
+#pragma once
+
+#include "value.h"
+#include "ast.h"
+#include "memory.h"
+#include "jit.h"
+#include "vm.h"
+#include "pfor.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef struct NamedValue
+{
+    std::string Name;
+    unsigned int Addr;
+
+    bool IsArr = false;
+    ArrShape Shape;
+    bool Defined = false;
+} namedValue;
+
+/// FunctionEntry - everything callable under one name. Version changes
+/// whenever Fn is replaced so that linked call sites notice.
+typedef struct FunctionEntry
+{
+    std::string Name;
+    StdFunc Std = nullptr;
+    std::shared_ptr<FunctionAST> Fn;
+    unsigned int Version = 1;
+} functionEntry;
+
+/// TailCall - a tail call whose arguments wait in Memory at Args until
+/// the caller's frame is handed over.
+struct TailCall
+{
+    FunctionAST* Callee = nullptr;
+    unsigned int Args = 0;
+};
+
+/// Interpreter - everything one running script owns: its functions,
+/// globals and value stack, and the bookkeeping of the VM, the JIT and the
+/// memo caches built on top of them. Instances share nothing mutable, so
+/// each can run a script on its own thread; a parallel pfor borrows more
+/// threads for its iterations. The command-line options stay process-wide
+/// and are only read while scripts run.
+class Interpreter
+{
+public:
+    std::vector<functionEntry> FuncTbl; // indexed by CallLink::Func
+    std::vector<namedValue> SymTbl; // globals, indexed by VarRef::Global
+    std::map<std::string, unsigned int> FunctionIds; // name -> FuncTbl index
+    std::map<std::string, unsigned int> GlobalIds; // name -> SymTbl index
+    Memory StackMemory;
+    unsigned int GlobalEpoch = 0; // bumped whenever a global moves or changes kind
+    TailCall PendingTail;
+    bool IsInteractive = true;
+    std::atomic<unsigned int> Errors{ 0 }; // errors reported so far, by any pfor worker too
+
+    // Where the script reads input, prints, and reports errors. Script
+    // output shares stderr with the diagnostics unless a batch job
+    // captures them separately.
+    FILE* In = stdin;
+    FILE* Out = stderr;
+    FILE* Err = stderr;
+
+    VMStacks VM;
+    JitCounters Jit;
+    std::vector<std::unique_ptr<JitCode, JitCodeDeleter>> RetiredCode; // see Prepare in jit.cpp
+
+    bool PurityValid = false;
+    unsigned int PurityEpoch = 0; // GlobalEpoch the analysis was made against
+
+    uintptr_t NativeBase = 0; // see MarkNativeStack
+    size_t NativeBudget = 0;
+
+    std::unique_ptr<PforPool> Pool; // started by the first parallel pfor
+
+    Interpreter() = default;
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
+};
+
+/// CurInterp - the interpreter running on this thread. Defined here with a
+/// constant initializer so that reading it is a plain thread-local load.
+inline thread_local Interpreter* CurInterp = nullptr;
+
+/// FrameBase - memory address of slot 0 of the function running on this
+/// thread. It is per thread rather than per interpreter because the
+/// workers of a parallel pfor each run the loop body in a private frame.
+inline thread_local unsigned int FrameBase = 0;
+
+/// OuterBase - the frame the running pfor was entered from. Variables the
+/// loop body shares with the code around it (VarRef::Outer) live there.
+inline thread_local unsigned int OuterBase = 0;
+
+/// Flow - the completion record of this thread. Nodes only look at it where
+/// they decide what runs next: between statements and loop iterations,
+/// before a call, store or branch, and where a function returns. Anything
+/// else just computes on and lets the nearest such node stop.
+inline thread_local Completion Flow;
+
+/// InterpreterScope - makes Interp the current interpreter of this thread
+/// until the scope ends.
+class InterpreterScope
+{
+    Interpreter* Saved;
+
+public:
+    InterpreterScope(Interpreter& Interp) : Saved(CurInterp) { CurInterp = &Interp; }
+    ~InterpreterScope() { CurInterp = Saved; }
+};
@@ -0,0 +1,1389 @@
+
+// MicroSEL
+// jit.cpp
+
+#include "jit.h"
+#include "execute.h"
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+bool UseJit = true;
+#else
+bool UseJit = false; // the code generator only targets x86-64
+#endif
+bool JitStats = false;
+
+enum Reg
+{
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R12 = 12, R13 = 13,
+};
+
+enum XmmReg
+{
+    XMM0 = 0, XMM1 = 1,
+};
+
+enum CondCode
+{
+    cc_b = 0x2, cc_ae = 0x3, cc_e = 0x4, cc_ne = 0x5,
+    cc_a = 0x7, cc_s = 0x8, cc_p = 0xA, cc_np = 0xB,
+};
+
+#ifdef _WIN32
+static const int ArgReg0 = RCX, ArgReg1 = RDX, ArgReg2 = R8;
+#else
+static const int ArgReg0 = RDI, ArgReg1 = RSI, ArgReg2 = RDX;
+#endif
+
+// Memory holds one 8-byte Cell per value.
+static const int CellShift = 3;
+static_assert(sizeof(Cell) == 1 << CellShift, "native code assumes 8-byte cells");
+
+static const int CtxMem = offsetof(JitContext, Mem);
+static const int CtxMemSize = offsetof(JitContext, MemSize);
+static const int CtxFp = offsetof(JitContext, Fp);
+static const int CtxStatus = offsetof(JitContext, Status);
+static const int CtxResume = offsetof(JitContext, Resume);
+static const int CtxArg = offsetof(JitContext, Arg);
+
+//===----------------------------------------------------------------------===//
+// Assembler
+//===----------------------------------------------------------------------===//
+
+void Assembler::dword(unsigned int D)
+{
+    for (int i = 0; i < 4; i++) byte((D >> (8 * i)) & 0xFF);
+}
+
+void Assembler::patchDword(size_t At, unsigned int D)
+{
+    for (int i = 0; i < 4; i++) Code[At + i] = (D >> (8 * i)) & 0xFF;
+}
+
+void Assembler::rex(bool W, int Reg, int Index, int Base)
+{
+    unsigned char B = 0x40 | (W << 3) | (((Reg >> 3) & 1) << 2) | (((Index >> 3) & 1) << 1) | ((Base >> 3) & 1);
+    if (B != 0x40) byte(B);
+}
+
+/// modrmMem - [Base + disp32]; rsp and r12 as a base need a SIB byte.
+void Assembler::modrmMem(int Reg, int Base, int Disp)
+{
+    byte(0x80 | ((Reg & 7) << 3) | (Base & 7));
+    if ((Base & 7) == 4) byte(0x24);
+    dword((unsigned int)Disp);
+}
+
+int Assembler::newLabel()
+{
+    Labels.push_back(-1);
+    return Labels.size() - 1;
+}
+
+void Assembler::bind(int Label)
+{
+    Labels[Label] = (int)Code.size();
+}
+
+void Assembler::jmp(int Label)
+{
+    byte(0xE9);
+    Fixups.push_back({ Code.size(), Label });
+    dword(0);
+}
+
+void Assembler::jcc(int Cond, int Label)
+{
+    byte(0x0F);
+    byte(0x80 + Cond);
+    Fixups.push_back({ Code.size(), Label });
+    dword(0);
+}
+
+bool Assembler::finish()
+{
+    for (auto& F : Fixups)
+    {
+        if (Labels[F.second] < 0) return false;
+        patchDword(F.first, (unsigned int)(Labels[F.second] - (int)(F.first + 4)));
+    }
+    return true;
+}
+
+void Assembler::push(int Reg)
+{
+    rex(false, 0, 0, Reg);
+    byte(0x50 + (Reg & 7));
+}
+
+void Assembler::pop(int Reg)
+{
+    rex(false, 0, 0, Reg);
+    byte(0x58 + (Reg & 7));
+}
+
+void Assembler::callReg(int Reg)
+{
+    rex(false, 0, 0, Reg);
+    byte(0xFF);
+    byte(0xD0 | (Reg & 7));
+}
+
+void Assembler::movImm64(int Reg, unsigned long long Imm)
+{
+    rex(true, 0, 0, Reg);
+    byte(0xB8 + (Reg & 7));
+    dword((unsigned int)Imm);
+    dword((unsigned int)(Imm >> 32));
+}
+
+void Assembler::movRegReg(int Dst, int Src)
+{
+    rex(true, Src, 0, Dst);
+    byte(0x89);
+    byte(0xC0 | ((Src & 7) << 3) | (Dst & 7));
+}
+
+void Assembler::movLoad(int Reg, int Base, int Disp, bool Wide)
+{
+    rex(Wide, Reg, 0, Base);
+    byte(0x8B);
+    modrmMem(Reg, Base, Disp);
+}
+
+void Assembler::movStoreImm32(int Base, int Disp, int Imm)
+{
+    rex(false, 0, 0, Base);
+    byte(0xC7);
+    modrmMem(0, Base, Disp);
+    dword((unsigned int)Imm);
+}
+
+void Assembler::lea(int Reg, int Base, int Disp)
+{
+    rex(true, Reg, 0, Base);
+    byte(0x8D);
+    modrmMem(Reg, Base, Disp);
+}
+
+void Assembler::addRegReg(int Dst, int Src)
+{
+    rex(true, Src, 0, Dst);
+    byte(0x01);
+    byte(0xC0 | ((Src & 7) << 3) | (Dst & 7));
+}
+
+void Assembler::addImm(int Reg, int Imm)
+{
+    rex(true, 0, 0, Reg);
+    byte(0x81);
+    byte(0xC0 | (Reg & 7));
+    dword((unsigned int)Imm);
+}
+
+void Assembler::subImm32(int Reg, size_t& PatchAt)
+{
+    rex(true, 0, 0, Reg);
+    byte(0x81);
+    byte(0xC0 | (5 << 3) | (Reg & 7));
+    PatchAt = Code.size();
+    dword(0);
+}
+
+void Assembler::imulImm(int Reg, int Imm)
+{
+    rex(true, Reg, 0, Reg);
+    byte(0x69);
+    byte(0xC0 | ((Reg & 7) << 3) | (Reg & 7));
+    dword((unsigned int)Imm);
+}
+
+void Assembler::shlImm(int Reg, int Count)
+{
+    rex(true, 0, 0, Reg);
+    byte(0xC1);
+    byte(0xC0 | (4 << 3) | (Reg & 7));
+    byte(Count);
+}
+
+void Assembler::testRegReg(int A, int B)
+{
+    rex(true, B, 0, A);
+    byte(0x85);
+    byte(0xC0 | ((B & 7) << 3) | (A & 7));
+}
+
+void Assembler::cmpRegMem(int Reg, int Base, int Disp)
+{
+    rex(true, Reg, 0, Base);
+    byte(0x3B);
+    modrmMem(Reg, Base, Disp);
+}
+
+void Assembler::cmpImm(int Reg, int Imm)
+{
+    rex(true, 0, 0, Reg);
+    byte(0x81);
+    byte(0xF8 | (Reg & 7));
+    dword((unsigned int)Imm);
+}
+
+void Assembler::cmpMemImm8(int Base, int Disp, int Imm)
+{
+    rex(false, 0, 0, Base);
+    byte(0x83);
+    modrmMem(7, Base, Disp);
+    byte(Imm);
+}
+
+void Assembler::decReg32(int Reg)
+{
+    rex(false, 0, 0, Reg);
+    byte(0xFF);
+    byte(0xC0 | (1 << 3) | (Reg & 7));
+}
+
+void Assembler::setcc(int Cond, int Reg8)
+{
+    byte(0x0F);
+    byte(0x90 + Cond);
+    byte(0xC0 | (Reg8 & 7));
+}
+
+void Assembler::andReg8(int Dst, int Src)
+{
+    byte(0x20);
+    byte(0xC0 | ((Src & 7) << 3) | (Dst & 7));
+}
+
+void Assembler::orReg8(int Dst, int Src)
+{
+    byte(0x08);
+    byte(0xC0 | ((Src & 7) << 3) | (Dst & 7));
+}
+
+void Assembler::movzxReg8(int Dst, int Src)
+{
+    byte(0x0F);
+    byte(0xB6);
+    byte(0xC0 | ((Dst & 7) << 3) | (Src & 7));
+}
+
+void Assembler::sseMem(unsigned char Prefix, unsigned char Op, int Xmm, int Base, int Disp)
+{
+    byte(Prefix);
+    rex(false, Xmm, 0, Base);
+    byte(0x0F);
+    byte(Op);
+    modrmMem(Xmm, Base, Disp);
+}
+
+void Assembler::sseReg(unsigned char Prefix, unsigned char Op, int Dst, int Src)
+{
+    byte(Prefix);
+    rex(false, Dst, 0, Src);
+    byte(0x0F);
+    byte(Op);
+    byte(0xC0 | ((Dst & 7) << 3) | (Src & 7));
+}
+
+void Assembler::cvttsd2si(int Reg, int Xmm)
+{
+    byte(0xF2);
+    rex(true, Reg, 0, Xmm);
+    byte(0x0F);
+    byte(0x2C);
+    byte(0xC0 | ((Reg & 7) << 3) | (Xmm & 7));
+}
+
+void Assembler::cvtsi2sd(int Xmm, int Reg)
+{
+    byte(0xF2);
+    rex(true, Xmm, 0, Reg);
+    byte(0x0F);
+    byte(0x2A);
+    byte(0xC0 | ((Xmm & 7) << 3) | (Reg & 7));
+}
+
+void Assembler::movqToXmm(int Xmm, int Reg)
+{
+    byte(0x66);
+    rex(true, Xmm, 0, Reg);
+    byte(0x0F);
+    byte(0x6E);
+    byte(0xC0 | ((Xmm & 7) << 3) | (Reg & 7));
+}
+
+// SSE2 opcodes used below
+enum SseOp : unsigned char
+{
+    sse_movsd_load = 0x10, sse_movsd_store = 0x11, sse_movapd = 0x28,
+    sse_ucomisd = 0x2E, sse_xorpd = 0x57, sse_addsd = 0x58, sse_mulsd = 0x59,
+    sse_subsd = 0x5C, sse_divsd = 0x5E,
+};
+
+static const unsigned char PrefixSD = 0xF2, PrefixPD = 0x66;
+
+//===----------------------------------------------------------------------===//
+// Runtime helpers called from native code
+//===----------------------------------------------------------------------===//
+
+typedef double (*JitHelper)(JitContext* Ctx, const void* Arg, double* Temp);
+
+static void JitSync(JitContext* Ctx)
+{
+    Ctx->Mem = CurInterp->StackMemory.data();
+    Ctx->MemSize = CurInterp->StackMemory.getSize();
+}
+
+static double JitError(JitContext* Ctx, const void* Msg, double*)
+{
+    LogError((const char*)Msg);
+    Ctx->Status = jit_err;
+    return 0;
+}
+
+static double JitCall(JitContext* Ctx, const void* Node, double* Args)
+{
+    CallLink& Link = ((CallExprAST*)Node)->getLink();
+    Value RetVal;
+
+    // Native code leaves no completion pending, but skip the call as the
+    // interpreter does if one is.
+    if (Flow.Type != flow_normal)
+    {
+        if (Flow.Type == flow_err) Ctx->Status = jit_err;
+        return 0;
+    }
+
+    LinkCall(Link);
+    if (Link.State == link_script)
+    {
+        unsigned int Base;
+        if (CurInterp->StackMemory.pushFrame(Link.Script->getFrameSize(), Base))
+        {
+            for (unsigned int i = 0; i < Link.Argc; i++)
+                CurInterp->StackMemory.setValue(Base + i, Value(Args[i]));
+            RetVal = Link.Script->execute(Base);
+        }
+    }
+    else
+    {
+        std::vector<Value> ArgsV(Args, Args + Link.Argc);
+        RetVal = CallLinked(Link, ArgsV);
+    }
+    JitSync(Ctx);
+    if (Flow.Type == flow_err) Ctx->Status = jit_err;
+    return RetVal.getNum();
+}
+
+/// JitTailCall - pushes the arguments of a tail call above the frame for
+/// RunTailCalls; callees that cannot take over the frame are just called.
+static double JitTailCall(JitContext* Ctx, const void* Node, double* Args)
+{
+    CallLink& Link = ((CallExprAST*)Node)->getLink();
+    LinkCall(Link);
+    if (Link.State != link_script) return JitCall(Ctx, Node, Args);
+
+    unsigned int ArgBase = CurInterp->StackMemory.getSize();
+    for (unsigned int i = 0; i < Link.Argc; i++)
+    {
+        if (CurInterp->StackMemory.push(Value(Args[i]))) continue;
+        CurInterp->StackMemory.deleteScope(ArgBase);
+        Ctx->Status = jit_err;
+        return 0;
+    }
+    SetTailCall(*Link.Script, ArgBase);
+    JitSync(Ctx);
+    Ctx->Status = jit_tail;
+    return 0;
+}
+
+static double JitStoreVar(JitContext* Ctx, const void* Node, double* Val)
+{
+    StoreVar(static_cast<const VariableExprAST*>(Node)->getRef(), Ctx->Fp, Value(*Val));
+    JitSync(Ctx);
+    return *Val;
+}
+
+static double JitMod(double L, double R) { return fmod(L, R); }
+
+static double JitPow(double L, double R) { return pow(L, R); }
+
+//===----------------------------------------------------------------------===//
+// JitCompiler
+//===----------------------------------------------------------------------===//
+
+/// reload - r13 = Memory base, r12 = frame slot 0. Called on entry and after
+/// every helper, since a call can grow and move Memory.
+void JitCompiler::reload()
+{
+    A.movLoad(R13, RBX, CtxMem, true);
+    A.movLoad(RAX, RBX, CtxFp, false);
+    A.shlImm(RAX, CellShift);
+    A.movRegReg(R12, R13);
+    A.addRegReg(R12, RAX);
+}
+
+int JitCompiler::allocTemp()
+{
+    if (++Temps > MaxTemps) MaxTemps = Temps;
+    return Temps - 1;
+}
+
+void JitCompiler::storeTemp(int Temp)
+{
+    A.sseMem(PrefixSD, sse_movsd_store, XMM0, RSP, tempDisp(Temp));
+}
+
+void JitCompiler::loadTemp(int Xmm, int Temp)
+{
+    A.sseMem(PrefixSD, sse_movsd_load, Xmm, RSP, tempDisp(Temp));
+}
+
+void JitCompiler::loadConst(double Val)
+{
+    unsigned long long Bits;
+    memcpy(&Bits, &Val, 8);
+    if (Bits == 0)
+    {
+        A.sseReg(PrefixPD, sse_xorpd, XMM0, XMM0);
+        return;
+    }
+    A.movImm64(RAX, Bits);
+    A.movqToXmm(XMM0, RAX);
+}
+
+void JitCompiler::loadSlot(unsigned int Slot)
+{
+    A.sseMem(PrefixSD, sse_movsd_load, XMM0, R12, Slot << CellShift);
+}
+
+void JitCompiler::storeSlot(unsigned int Slot)
+{
+    A.sseMem(PrefixSD, sse_movsd_store, XMM0, R12, Slot << CellShift);
+}
+
+void JitCompiler::loadAbs(unsigned int Addr)
+{
+    A.sseMem(PrefixSD, sse_movsd_load, XMM0, R13, Addr << CellShift);
+}
+
+void JitCompiler::storeAbs(unsigned int Addr)
+{
+    A.sseMem(PrefixSD, sse_movsd_store, XMM0, R13, Addr << CellShift);
+}
+
+void JitCompiler::loadFp()
+{
+    A.movLoad(RAX, RBX, CtxFp, false);
+}
+
+const char* JitCompiler::intern(const std::string& Str)
+{
+    Strings.push_back(Str);
+    return Strings.back().c_str();
+}
+
+/// locate - the compile-time counterpart of RefAddr. Globals are looked up
+/// now; the code is thrown away when GlobalEpoch says they changed.
+JitCompiler::Loc JitCompiler::locate(const VarRef& Ref, bool AnyKind)
+{
+    if (Ref.Depth == ref_local) return { Loc::frame, Ref.Slot, Ref.Shape };
+
+    const namedValue& Global = CurInterp->SymTbl[Ref.Global];
+    if (Global.Defined && (AnyKind || !Global.IsArr))
+        return { Loc::absolute, Global.Addr, Global.IsArr ? &Global.Shape : nullptr };
+    if (Ref.Depth == ref_either) return { Loc::frame, Ref.Slot, nullptr };
+    return { Loc::none, 0, nullptr };
+}
+
+/// locateArr - the compile-time counterpart of ArrBase.
+JitCompiler::Loc JitCompiler::locateArr(const VarRef& Ref)
+{
+    if (Ref.Depth == ref_local)
+    {
+        if (Ref.Shape == nullptr) return { Loc::none, 0, nullptr };
+        return { Loc::frame, Ref.Slot, Ref.Shape };
+    }
+
+    const namedValue& Global = CurInterp->SymTbl[Ref.Global];
+    if (!Global.Defined || !Global.IsArr) return { Loc::none, 0, nullptr };
+    return { Loc::absolute, Global.Addr, &Global.Shape };
+}
+
+void JitCompiler::loadVar(const Loc& L)
+{
+    if (L.Kind == Loc::frame) loadSlot(L.Where);
+    else loadAbs(L.Where);
+}
+
+void JitCompiler::storeVar(const Loc& L)
+{
+    if (L.Kind == Loc::frame) storeSlot(L.Where);
+    else storeAbs(L.Where);
+}
+
+/// elemIndex - leaves the memory address of an array element in rax.
+/// Returns false when the access is known to fail; the error call has been
+/// emitted in that case.
+bool JitCompiler::elemIndex(const std::string& Name, const VarRef& Ref, const ExprList& Indices)
+{
+    Loc L = locateArr(Ref);
+    if (L.Kind == Loc::none)
+    {
+        callError(intern("\"" + Name + "\" is not an array"));
+        return false;
+    }
+
+    unsigned int N = Indices.size();
+    int Base = Temps;
+    for (unsigned int k = 0; k < N; k++) allocTemp();
+    for (unsigned int k = 0; k < N; k++)
+    {
+        pushErrorNote("Error while calculating indices");
+        Indices[k]->jit(*this);
+        popErrorNote();
+        toIndex("Index must be an integer");
+        storeTemp(Base + k);
+    }
+
+    if (N != L.Shape->Dims.size())
+    {
+        callError("Dimension mismatch");
+        freeTemp(N);
+        return false;
+    }
+
+    // Horner's rule over the dimensions. An unsigned compare per index
+    // catches negative indices too.
+    const std::vector<int>& Dims = L.Shape->Dims;
+    int Range = A.newLabel();
+    loadTemp(XMM1, Base);
+    A.cvttsd2si(RAX, XMM1);
+    if (CheckBounds)
+    {
+        A.cmpImm(RAX, Dims[0]);
+        A.jcc(cc_ae, Range);
+    }
+    for (unsigned int k = 1; k < N; k++)
+    {
+        A.imulImm(RAX, Dims[k]);
+        loadTemp(XMM1, Base + k);
+        A.cvttsd2si(RCX, XMM1);
+        if (CheckBounds)
+        {
+            A.cmpImm(RCX, Dims[k]);
+            A.jcc(cc_ae, Range);
+        }
+        A.addRegReg(RAX, RCX);
+    }
+    freeTemp(N);
+
+    A.addImm(RAX, L.Where);
+    if (L.Kind == Loc::frame)
+    {
+        A.movLoad(RCX, RBX, CtxFp, false);
+        A.addRegReg(RAX, RCX);
+    }
+
+    int Ok = A.newLabel();
+    if (CheckBounds) A.jmp(Ok);
+    else
+    {
+        A.cmpRegMem(RAX, RBX, CtxMemSize);
+        A.jcc(cc_b, Ok);
+        callError("Address out of range");
+    }
+    A.bind(Range);
+    if (CheckBounds) callError("Index out of range");
+    A.bind(Ok);
+    return true;
+}
+
+/// checkAddr - converts the address in xmm0 to a checked memory index in rax.
+void JitCompiler::checkAddr()
+{
+    int Bad = A.newLabel(), Range = A.newLabel(), Ok = A.newLabel();
+    A.cvttsd2si(RAX, XMM0);
+    A.cvtsi2sd(XMM1, RAX);
+    A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1);
+    A.jcc(cc_p, Bad);
+    A.jcc(cc_ne, Bad);
+    A.testRegReg(RAX, RAX);
+    A.jcc(cc_s, Bad);
+    A.cmpRegMem(RAX, RBX, CtxMemSize);
+    A.jcc(cc_ae, Range);
+    A.jmp(Ok);
+    A.bind(Bad);
+    callError("Address must be an unsigned integer");
+    A.bind(Range);
+    callError("Address out of range");
+    A.bind(Ok);
+}
+
+void JitCompiler::loadElem()
+{
+    A.shlImm(RAX, CellShift);
+    A.addRegReg(RAX, R13);
+    A.sseMem(PrefixSD, sse_movsd_load, XMM0, RAX, 0);
+}
+
+void JitCompiler::storeElem()
+{
+    A.shlImm(RAX, CellShift);
+    A.addRegReg(RAX, R13);
+    A.sseMem(PrefixSD, sse_movsd_store, XMM0, RAX, 0);
+}
+
+void JitCompiler::callHelper(const void* Fn, const void* Arg1, int Temp, bool CanFail)
+{
+    A.movRegReg(ArgReg0, RBX);
+    A.movImm64(ArgReg1, (unsigned long long)(uintptr_t)Arg1);
+    if (Temp >= 0) A.lea(ArgReg2, RSP, tempDisp(Temp));
+    A.movImm64(RAX, (unsigned long long)(uintptr_t)Fn);
+    A.callReg(RAX);
+    reload();
+    if (CanFail) checkStatus();
+}
+
+void JitCompiler::callError(const char* Msg)
+{
+    callHelper((const void*)&JitError, Msg, -1, false);
+    A.jmp(ErrLabels.back());
+}
+
+void JitCompiler::checkStatus()
+{
+    A.cmpMemImm8(RBX, CtxStatus, jit_ok);
+    A.jcc(cc_ne, ErrLabels.back());
+}
+
+/// jumpIfFalse - a number is false only when it compares equal to zero;
+/// NaN counts as true, as in C++.
+void JitCompiler::jumpIfFalse(int Label)
+{
+    int Skip = A.newLabel();
+    A.sseReg(PrefixPD, sse_xorpd, XMM1, XMM1);
+    A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1);
+    A.jcc(cc_p, Skip);
+    A.jcc(cc_e, Label);
+    A.bind(Skip);
+}
+
+void JitCompiler::toBool()
+{
+    A.sseReg(PrefixPD, sse_xorpd, XMM1, XMM1);
+    A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1);
+    A.setcc(cc_ne, RAX);
+    A.setcc(cc_p, RCX);
+    A.orReg8(RAX, RCX);
+    A.movzxReg8(RAX, RAX);
+    A.cvtsi2sd(XMM0, RAX);
+}
+
+/// toIndex - truncates xmm0 into rax, reporting Msg if it was not an integer.
+void JitCompiler::toIndex(const char* Msg)
+{
+    int Bad = A.newLabel(), Ok = A.newLabel();
+    A.cvttsd2si(RAX, XMM0);
+    A.cvtsi2sd(XMM1, RAX);
+    A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1);
+    A.jcc(cc_p, Bad);
+    A.jcc(cc_e, Ok);
+    A.bind(Bad);
+    callError(Msg);
+    A.bind(Ok);
+}
+
+/// pushErrorNote - errors raised until popErrorNote also print Note, the
+/// way the interpreter adds context while unwinding.
+void JitCompiler::pushErrorNote(const std::string& Note)
+{
+    int Label = A.newLabel();
+    ErrNotes.push_back({ Label, ErrLabels.back(), intern(Note) });
+    ErrLabels.push_back(Label);
+}
+
+void JitCompiler::popErrorNote()
+{
+    ErrLabels.pop_back();
+}
+
+/// compileUnit - rbx holds the JitContext, r12 the frame and r13 Memory.
+/// Temporaries live above the 32-byte area reserved for helper calls.
+bool JitCompiler::compileUnit(ExprAST* Body)
+{
+    ExitLabel = A.newLabel();
+    ErrLabels.push_back(ExitLabel);
+
+    size_t FramePatch;
+    A.push(RBP);
+    A.movRegReg(RBP, RSP);
+    A.push(RBX);
+    A.push(R12);
+    A.push(R13);
+    A.subImm32(RSP, FramePatch);
+    A.movRegReg(RBX, ArgReg0);
+    reload();
+
+    Body->jit(*this);
+
+    A.bind(ExitLabel);
+    A.lea(RSP, RBP, -24);
+    A.pop(R13);
+    A.pop(R12);
+    A.pop(RBX);
+    A.pop(RBP);
+    A.ret();
+
+    for (size_t i = 0; i < ErrNotes.size(); i++)
+    {
+        A.bind(ErrNotes[i].Label);
+        callHelper((const void*)&JitError, ErrNotes[i].Note, -1, false);
+        A.jmp(ErrNotes[i].Outer);
+    }
+
+    // Four pushes leave rsp 8 bytes off; the frame restores 16-byte alignment.
+    int FrameBytes = ((32 + 8 * MaxTemps + 15) & ~15) + 8;
+    A.patchDword(FramePatch, FrameBytes);
+
+    if (failed()) return false;
+    return A.finish();
+}
+
+//===----------------------------------------------------------------------===//
+// Per-node code generation
+//===----------------------------------------------------------------------===//
+
+void NumberExprAST::jit(JitCompiler& J)
+{
+    J.loadConst(Val.getNum());
+}
+
+void VariableExprAST::jit(JitCompiler& J)
+{
+    if (!Indices.empty()) // array element
+    {
+        if (J.elemIndex(Name, Ref, Indices)) J.loadElem();
+        return;
+    }
+
+    JitCompiler::Loc L = J.locate(Ref, false);
+    if (L.Kind == JitCompiler::Loc::none)
+    {
+        J.callError(J.intern("Identifier \"" + Name + "\" not found"));
+        return;
+    }
+    J.loadVar(L);
+}
+
+void DeRefExprAST::jit(JitCompiler& J)
+{
+    AddrExpr->jit(J);
+    J.checkAddr();
+    J.loadElem();
+}
+
+void ArrDeclExprAST::jit(JitCompiler& J)
+{
+    if (Ref.Declares)
+    {
+        J.fail("top-level array declaration");
+        return;
+    }
+
+    int Size = Shape.Size;
+
+    Assembler& A = J.as();
+    int Loop = A.newLabel();
+    A.lea(RAX, R12, Ref.Slot << CellShift);
+    A.movImm64(RCX, Size);
+    A.sseReg(PrefixPD, sse_xorpd, XMM0, XMM0);
+    A.bind(Loop);
+    A.sseMem(PrefixSD, sse_movsd_store, XMM0, RAX, 0);
+    A.addImm(RAX, 1 << CellShift);
+    A.decReg32(RCX);
+    A.jcc(cc_ne, Loop);
+    J.loadConst(Size);
+}
+
+void UnaryExprAST::jit(JitCompiler& J)
+{
+    Assembler& A = J.as();
+    if (Opcode == '&') // reference operator
+    {
+        if (Operand->getNodeType() != node_var)
+        {
+            J.callError("Operand of '&' must be a variable");
+            return;
+        }
+
+        VariableExprAST* Op = static_cast<VariableExprAST*>(Operand);
+        if (!Op->getIndices().empty())
+        {
+            if (J.elemIndex(Op->getName(), Op->getRef(), Op->getIndices()))
+                A.cvtsi2sd(XMM0, RAX);
+            return;
+        }
+
+        JitCompiler::Loc L = J.locate(Op->getRef(), true);
+        if (L.Kind == JitCompiler::Loc::none)
+            J.callError(J.intern("Variable \"" + Op->getName() + "\" not found"));
+        else if (L.Kind == JitCompiler::Loc::absolute)
+            J.loadConst(L.Where);
+        else
+        {
+            J.loadFp();
+            A.addImm(RAX, L.Where);
+            A.cvtsi2sd(XMM0, RAX);
+        }
+        return;
+    }
+
+    Operand->jit(J);
+    switch (Opcode)
+    {
+    case '!':
+        A.sseReg(PrefixPD, sse_xorpd, XMM1, XMM1);
+        A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1);
+        A.setcc(cc_e, RAX);
+        A.setcc(cc_np, RCX);
+        A.andReg8(RAX, RCX);
+        A.movzxReg8(RAX, RAX);
+        A.cvtsi2sd(XMM0, RAX);
+        break;
+    case '+':
+        break;
+    case '-':
+        A.movImm64(RAX, 0x8000000000000000ULL);
+        A.movqToXmm(XMM1, RAX);
+        A.sseReg(PrefixPD, sse_xorpd, XMM0, XMM1);
+        break;
+    default:
+        J.callError("Unknown unary operator");
+    }
+}
+
+/// Stores to a top-level declaration go through StoreVar unless the global
+/// already points at this frame slot.
+static void JitAssign(JitCompiler& J, VariableExprAST* LHSE)
+{
+    const VarRef& Ref = LHSE->getRef();
+    JitCompiler::Loc L = J.locate(Ref, true);
+    if (L.Kind == JitCompiler::Loc::none)
+    {
+        J.fail("assignment to an unresolved name");
+        return;
+    }
+
+    if (Ref.Declares)
+    {
+        const namedValue& Global = CurInterp->SymTbl[Ref.Global];
+        if (!Global.Defined || Global.IsArr || Global.Addr != J.getUnitFp() + Ref.Slot)
+        {
+            int Val = J.allocTemp();
+            J.storeTemp(Val);
+            J.callHelper((const void*)&JitStoreVar, LHSE, Val, false);
+            J.freeTemp();
+            return;
+        }
+    }
+    J.storeVar(L);
+}
+
+void BinaryExprAST::jit(JitCompiler& J)
+{
+    Assembler& A = J.as();
+    if (Op == binop_assign)
+    {
+        RHS->jit(J);
+
+        if (LHS->getNodeType() == node_deref)
+        {
+            int Val = J.allocTemp();
+            J.storeTemp(Val);
+            static_cast<DeRefExprAST*>(LHS)->getExpr()->jit(J);
+            J.checkAddr();
+            J.loadTemp(XMM0, Val);
+            J.storeElem();
+            J.freeTemp();
+            return;
+        }
+        if (LHS->getNodeType() != node_var)
+        {
+            J.callError("Destination of '=' must be a variable");
+            return;
+        }
+
+        VariableExprAST* LHSE = static_cast<VariableExprAST*>(LHS);
+        if (LHSE->getIndices().empty())
+        {
+            JitAssign(J, LHSE);
+            return;
+        }
+
+        int Val = J.allocTemp();
+        J.storeTemp(Val);
+        if (J.elemIndex(LHSE->getName(), LHSE->getRef(), LHSE->getIndices()))
+        {
+            J.loadTemp(XMM0, Val);
+            J.storeElem();
+        }
+        J.freeTemp();
+        return;
+    }
+
+    LHS->jit(J);
+    int L = J.allocTemp();
+    J.storeTemp(L);
+    RHS->jit(J);
+    A.sseReg(PrefixPD, sse_movapd, XMM1, XMM0);
+    J.loadTemp(XMM0, L);
+    J.freeTemp();
+
+    int Cond = -1;
+    switch (Op)
+    {
+    case binop_add: A.sseReg(PrefixSD, sse_addsd, XMM0, XMM1); return;
+    case binop_sub: A.sseReg(PrefixSD, sse_subsd, XMM0, XMM1); return;
+    case binop_mul: A.sseReg(PrefixSD, sse_mulsd, XMM0, XMM1); return;
+    case binop_div: A.sseReg(PrefixSD, sse_divsd, XMM0, XMM1); return;
+    case binop_mod: J.callHelper((const void*)&JitMod, nullptr, -1, false); return;
+    case binop_pow: J.callHelper((const void*)&JitPow, nullptr, -1, false); return;
+    case binop_eq:
+        A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1);
+        A.setcc(cc_e, RAX);
+        A.setcc(cc_np, RCX);
+        A.andReg8(RAX, RCX);
+        break;
+    case binop_ne:
+        A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1);
+        A.setcc(cc_ne, RAX);
+        A.setcc(cc_p, RCX);
+        A.orReg8(RAX, RCX);
+        break;
+    // 'above' is false for unordered operands, so L < R is tested as R > L.
+    case binop_lt: A.sseReg(PrefixPD, sse_ucomisd, XMM1, XMM0); Cond = cc_a; break;
+    case binop_le: A.sseReg(PrefixPD, sse_ucomisd, XMM1, XMM0); Cond = cc_ae; break;
+    case binop_gt: A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1); Cond = cc_a; break;
+    case binop_ge: A.sseReg(PrefixPD, sse_ucomisd, XMM0, XMM1); Cond = cc_ae; break;
+    default:
+        J.callError("Unknown binary operator");
+        return;
+    }
+    if (Cond >= 0) A.setcc(Cond, RAX);
+    A.movzxReg8(RAX, RAX);
+    A.cvtsi2sd(XMM0, RAX);
+}
+
+void LogicalExprAST::jit(JitCompiler& J)
+{
+    Assembler& A = J.as();
+    int Short = A.newLabel(), End = A.newLabel();
+
+    LHS->jit(J);
+    J.jumpIfFalse(Short);
+    if (Op == binop_and)
+    {
+        RHS->jit(J);
+        J.toBool();
+        A.jmp(End);
+        A.bind(Short);
+        J.loadConst(0);
+    }
+    else
+    {
+        J.loadConst(1);
+        A.jmp(End);
+        A.bind(Short);
+        RHS->jit(J);
+        J.toBool();
+    }
+    A.bind(End);
+}
+
+/// JitArgs - evaluates call arguments into consecutive temporaries and
+/// returns the first one, or -1 when there are none.
+static int JitArgs(JitCompiler& J, const ExprList& Args)
+{
+    int Base = -1;
+    for (unsigned int i = 0; i < Args.size(); i++)
+    {
+        int Temp = J.allocTemp();
+        if (i == 0) Base = Temp;
+    }
+    for (unsigned int i = 0; i < Args.size(); i++)
+    {
+        Args[i]->jit(J);
+        J.storeTemp(Base + i);
+    }
+    return Base;
+}
+
+void CallExprAST::jit(JitCompiler& J)
+{
+    int Base = JitArgs(J, Args);
+    J.callHelper((const void*)&JitCall, this, Base, true);
+    J.freeTemp(Args.size());
+}
+
+/// jitTail - a tail call to a script function leaves the unit with
+/// jit_tail; any other callee returns here like an ordinary call.
+void CallExprAST::jitTail(JitCompiler& J)
+{
+    int Base = JitArgs(J, Args);
+    J.callHelper((const void*)&JitTailCall, this, Base, false);
+    J.as().cmpMemImm8(RBX, CtxStatus, jit_tail);
+    J.as().jcc(cc_e, J.getExitLabel());
+    J.checkStatus();
+    J.freeTemp(Args.size());
+}
+
+void IfExprAST::jit(JitCompiler& J)
+{
+    Assembler& A = J.as();
+    int Else = A.newLabel(), End = A.newLabel();
+
+    CondExpr->jit(J);
+    J.jumpIfFalse(Else);
+    ThenExpr->jit(J);
+    A.jmp(End);
+    A.bind(Else);
+    if (ElseExpr != nullptr) ElseExpr->jit(J);
+    else J.loadConst(0);
+    A.bind(End);
+}
+
+/// A compiled loop can also be entered half way: the interpreter passes the
+/// step and the last body value in Arg[] and the code resumes at the
+/// condition.
+void ForExprAST::jit(JitCompiler& J)
+{
+    Assembler& A = J.as();
+    JitCompiler::Loc L = J.locate(Ref, true);
+    if (L.Kind == JitCompiler::Loc::none)
+    {
+        J.fail("unresolved loop variable");
+        return;
+    }
+
+    int StepT = J.allocTemp(), ResultT = J.allocTemp();
+    int Head = A.newLabel(), Done = A.newLabel(), Resume = A.newLabel();
+    bool Root = J.isRootLoop(this);
+
+    if (Root)
+    {
+        A.cmpMemImm8(RBX, CtxResume, 0);
+        A.jcc(cc_ne, Resume);
+    }
+
+    Start->jit(J);
+    J.storeVar(L);
+    if (Step) Step->jit(J);
+    else J.loadConst(1);
+    J.storeTemp(StepT);
+    J.loadConst(0);
+    J.storeTemp(ResultT);
+
+    A.bind(Head);
+    End->jit(J);
+    J.jumpIfFalse(Done);
+
+    J.pushLoop(ResultT, Done);
+    Body->jit(J);
+    J.storeTemp(ResultT);
+    J.popLoop();
+
+    J.loadVar(L);
+    J.loadTemp(XMM1, StepT);
+    A.sseReg(PrefixSD, sse_addsd, XMM0, XMM1);
+    J.storeVar(L);
+    A.jmp(Head);
+
+    if (Root)
+    {
+        A.bind(Resume);
+        A.sseMem(PrefixSD, sse_movsd_load, XMM0, RBX, CtxArg);
+        J.storeTemp(StepT);
+        A.sseMem(PrefixSD, sse_movsd_load, XMM0, RBX, CtxArg + 8);
+        J.storeTemp(ResultT);
+        A.jmp(Head);
+    }
+
+    A.bind(Done);
+    J.loadTemp(XMM0, ResultT);
+    J.freeTemp(2);
+}
+
+void PforExprAST::jit(JitCompiler& J)
+{
+    J.fail("pfor");
+}
+
+void WhileExprAST::jit(JitCompiler& J)
+{
+    Assembler& A = J.as();
+    int ResultT = J.allocTemp();
+    int Head = A.newLabel(), Done = A.newLabel(), Resume = A.newLabel();
+    bool Root = J.isRootLoop(this);
+
+    if (Root)
+    {
+        A.cmpMemImm8(RBX, CtxResume, 0);
+        A.jcc(cc_ne, Resume);
+    }
+
+    J.loadConst(0);
+    J.storeTemp(ResultT);
+
+    A.bind(Head);
+    Cond->jit(J);
+    J.jumpIfFalse(Done);
+
+    J.pushLoop(ResultT, Done);
+    Body->jit(J);
+    J.storeTemp(ResultT);
+    J.popLoop();
+    A.jmp(Head);
+
+    if (Root)
+    {
+        A.bind(Resume);
+        A.sseMem(PrefixSD, sse_movsd_load, XMM0, RBX, CtxArg + 8);
+        J.storeTemp(ResultT);
+        A.jmp(Head);
+    }
+
+    A.bind(Done);
+    J.loadTemp(XMM0, ResultT);
+    J.freeTemp();
+}
+
+void BlockExprAST::jit(JitCompiler& J)
+{
+    for (auto& Expr : Expressions) Expr->jit(J);
+}
+
+void BreakExprAST::jit(JitCompiler& J)
+{
+    if (!J.inLoop())
+    {
+        J.fail("break outside of a loop");
+        return;
+    }
+
+    J.pushErrorNote("Failed to return a value");
+    Expr->jit(J);
+    J.popErrorNote();
+    J.storeTemp(J.innermostLoop().ResultTemp);
+    J.as().jmp(J.innermostLoop().ExitLabel);
+}
+
+void ReturnExprAST::jit(JitCompiler& J)
+{
+    J.pushErrorNote("Failed to return a value");
+    if (TailCall) static_cast<CallExprAST*>(Expr)->jitTail(J);
+    else Expr->jit(J);
+    J.popErrorNote();
+    if (J.isLoopUnit()) J.as().movStoreImm32(RBX, CtxStatus, jit_return);
+    J.as().jmp(J.getExitLabel());
+}
+
+//===----------------------------------------------------------------------===//
+// Code buffers and tiering
+//===----------------------------------------------------------------------===//
+
+typedef double (*JitEntry)(JitContext* Ctx);
+
+struct JitCode
+{
+    void* Mem = nullptr;
+    size_t MapSize = 0;
+    size_t CodeSize = 0;
+    JitEntry Entry = nullptr;
+    unsigned int Epoch = 0;
+    bool FpDependent = false;
+    unsigned int Fp = 0;
+    std::list<std::string> Strings; // messages the code points at
+};
+
+void JitCodeDeleter::operator()(JitCode* Code) const
+{
+    if (Code->Mem != nullptr)
+    {
+#ifdef _WIN32
+        VirtualFree(Code->Mem, 0, MEM_RELEASE);
+#else
+        munmap(Code->Mem, Code->MapSize);
+#endif
+    }
+    delete Code;
+}
+
+
+/// MapCode - copies machine code into a fresh executable mapping. Pages are
+/// never writable and executable at the same time.
+static bool MapCode(JitCode& Code, const std::vector<unsigned char>& Bytes)
+{
+    Code.CodeSize = Bytes.size();
+#ifdef _WIN32
+    Code.MapSize = Bytes.size();
+    Code.Mem = VirtualAlloc(nullptr, Code.MapSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (Code.Mem == nullptr) return false;
+    memcpy(Code.Mem, Bytes.data(), Bytes.size());
+    DWORD Old;
+    if (!VirtualProtect(Code.Mem, Code.MapSize, PAGE_EXECUTE_READ, &Old)) return false;
+    FlushInstructionCache(GetCurrentProcess(), Code.Mem, Code.MapSize);
+#else
+    Code.MapSize = Bytes.size();
+    void* Mem = mmap(nullptr, Code.MapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Mem == MAP_FAILED) return false;
+    Code.Mem = Mem;
+    memcpy(Mem, Bytes.data(), Bytes.size());
+    if (mprotect(Mem, Code.MapSize, PROT_READ | PROT_EXEC) != 0) return false;
+#endif
+    Code.Entry = (JitEntry)Code.Mem;
+    return true;
+}
+
+/// Compile - builds native code for a function body (RootLoop null) or for
+/// a single loop running in the frame at Fp.
+static bool Compile(JitSlot& Slot, ExprAST* Unit, ExprAST* RootLoop, unsigned int Fp, const FunctionAST* Fn)
+{
+    std::string Name = Fn ? "func \"" + Fn->getFuncName() + "\"" : "loop";
+    auto Start = std::chrono::steady_clock::now();
+
+    JitCompiler J(RootLoop, Fp);
+    if (!J.compileUnit(Unit))
+    {
+        Slot.Failed = true;
+        CurInterp->Jit.Fallbacks.push_back(Name + ": " + (J.failed() ? J.getFailReason() : "unresolved label"));
+        return false;
+    }
+
+    std::unique_ptr<JitCode, JitCodeDeleter> Code(new JitCode());
+    Code->Strings.swap(J.getStrings());
+    if (!MapCode(*Code, J.getCode()))
+    {
+        Slot.Failed = true;
+        CurInterp->Jit.Fallbacks.push_back(Name + ": cannot map executable memory");
+        return false;
+    }
+    Code->Epoch = CurInterp->GlobalEpoch;
+    Code->FpDependent = J.isFpDependent();
+    Code->Fp = Fp;
+
+    if (RootLoop) CurInterp->Jit.Loops++;
+    else CurInterp->Jit.Functions++;
+    CurInterp->Jit.CodeBytes += Code->CodeSize;
+    CurInterp->Jit.CompileMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+
+    Slot.Code = std::move(Code);
+    return true;
+}
+
+/// Prepare - makes Slot hold code that is valid for the current globals,
+/// compiling it once the counter reaches Threshold.
+static bool Prepare(JitSlot& Slot, ExprAST* Unit, ExprAST* RootLoop, unsigned int Fp, unsigned int Threshold, const FunctionAST* Fn)
+{
+    if (!UseJit || JitPaused || Slot.Failed) return false;
+
+    if (Slot.Code)
+    {
+        if (Slot.Code->Epoch == CurInterp->GlobalEpoch && (!Slot.Code->FpDependent || Slot.Code->Fp == Fp))
+            return true;
+        // Code replaced while it may still be on the native stack is kept
+        // until the interpreter goes away.
+        CurInterp->RetiredCode.push_back(std::move(Slot.Code));
+        CurInterp->Jit.Recompiles++;
+    }
+    else if (++Slot.Counter < Threshold) return false;
+
+    return Compile(Slot, Unit, RootLoop, Fp, Fn);
+}
+
+bool JitRunFunction(FunctionAST& Fn, JitSlot& Slot, unsigned int Fp, Value& Result)
+{
+    if (!Prepare(Slot, Fn.getBody(), nullptr, Fp, JitCallThreshold, &Fn))
+        return false;
+
+    JitContext Ctx;
+    JitSync(&Ctx);
+    Ctx.Fp = Fp;
+    Ctx.Status = jit_ok;
+    Ctx.Resume = 0;
+
+    CurInterp->Jit.NativeCalls++;
+    Result = Value(Slot.Code->Entry(&Ctx));
+    if (Ctx.Status == jit_err) Flow.Type = flow_err;
+    else if (Ctx.Status == jit_tail) Flow.Type = flow_tail;
+    return true;
+}
+
+/// JitRunLoop - runs a loop natively. With Resume set, the interpreter has
+/// already executed some iterations and hands over the step and the last
+/// body value; otherwise the loop only runs natively if it was compiled
+/// before.
+bool JitRunLoop(ExprAST& Loop, JitSlot& Slot, unsigned int Fp, const double* Resume, Value& Result)
+{
+    if (!Resume && !Slot.Code) return false;
+    if (!Prepare(Slot, &Loop, &Loop, Fp, JitLoopThreshold, nullptr))
+        return false;
+
+    JitContext Ctx;
+    JitSync(&Ctx);
+    Ctx.Fp = Fp;
+    Ctx.Status = jit_ok;
+    Ctx.Resume = Resume != nullptr;
+    if (Resume)
+    {
+        Ctx.Arg[0] = Resume[0];
+        Ctx.Arg[1] = Resume[1];
+    }
+
+    CurInterp->Jit.LoopEntries++;
+    double RetVal = Slot.Code->Entry(&Ctx);
+    Result = Value(RetVal);
+    if (Ctx.Status == jit_err) Flow.Type = flow_err;
+    else if (Ctx.Status == jit_return)
+    {
+        Flow.Type = flow_return;
+        Flow.Val = RetVal;
+    }
+    else if (Ctx.Status == jit_tail) Flow.Type = flow_tail;
+    return true;
+}
+
+bool FunctionAST::runJit(unsigned int Base, Value& Result)
+{
+    return JitRunFunction(*this, Jit, Base, Result);
+}
+
+void PrintJitStats()
+{
+    fprintf(CurInterp->Err, "\nJIT statistics%s\n", UseJit ? "" : " (disabled)");
+    fprintf(CurInterp->Err, "  thresholds          %u calls, %u back-edges\n", JitCallThreshold, JitLoopThreshold);
+    fprintf(CurInterp->Err, "  functions compiled  %u\n", CurInterp->Jit.Functions);
+    fprintf(CurInterp->Err, "  loops compiled      %u\n", CurInterp->Jit.Loops);
+    fprintf(CurInterp->Err, "  recompilations      %u\n", CurInterp->Jit.Recompiles);
+    fprintf(CurInterp->Err, "  native code         %zu bytes\n", CurInterp->Jit.CodeBytes);
+    fprintf(CurInterp->Err, "  compile time        %.3f ms\n", CurInterp->Jit.CompileMs);
+    fprintf(CurInterp->Err, "  native calls        %llu\n", CurInterp->Jit.NativeCalls);
+    fprintf(CurInterp->Err, "  native loop entries %llu\n", CurInterp->Jit.LoopEntries);
+    fprintf(CurInterp->Err, "  fallbacks           %zu\n", CurInterp->Jit.Fallbacks.size());
+    for (auto& Reason : CurInterp->Jit.Fallbacks)
+        fprintf(CurInterp->Err, "    %s\n", Reason.c_str());
+}
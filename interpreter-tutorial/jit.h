@@ -0,0 +1,214 @@
+
+// MicroSEL
+// jit.h
+
+#pragma once
+
+#include "value.h"
+#include "ast.h"
+#include <string>
+#include <vector>
+#include <list>
+
+extern bool UseJit;
+extern bool JitStats;
+
+/// JitPaused - set on the threads running a parallel pfor. They share the
+/// JIT slots of the loops in its body, so they neither count back-edges
+/// nor compile; they run the body in the tree walker.
+inline thread_local bool JitPaused = false;
+
+const unsigned int JitCallThreshold = 50; // calls before a function is compiled
+const unsigned int JitLoopThreshold = 1000; // back-edges before a loop is compiled
+
+/// JitContext - state shared between native code and its helpers. Helpers
+/// that can grow Memory refresh Mem before they return.
+struct JitContext
+{
+    Cell* Mem;
+    size_t MemSize;
+    unsigned int Fp; // memory address of frame slot 0
+    int Status; // a JitStatus
+    int Resume; // nonzero to continue a loop the interpreter started
+    double Arg[2];
+};
+
+/// JitCounters - what --jit-stats reports for one interpreter.
+struct JitCounters
+{
+    unsigned int Functions = 0;
+    unsigned int Loops = 0;
+    unsigned int Recompiles = 0;
+    size_t CodeBytes = 0;
+    double CompileMs = 0;
+    unsigned long long NativeCalls = 0;
+    unsigned long long LoopEntries = 0;
+    std::vector<std::string> Fallbacks;
+};
+
+enum JitStatus
+{
+    jit_ok = 0,
+    jit_err = 1,
+    jit_return = 2, // 'return' inside a compiled loop
+    jit_tail = 3, // tail call left for FunctionAST::execute
+};
+
+/// Assembler - emits x86-64 machine code with forward labels.
+class Assembler
+{
+    std::vector<unsigned char> Code;
+    std::vector<int> Labels;
+    std::vector<std::pair<size_t, int>> Fixups;
+
+    void rex(bool W, int Reg, int Index, int Base);
+    void modrmMem(int Reg, int Base, int Disp);
+
+public:
+    void byte(unsigned char B) { Code.push_back(B); }
+    void dword(unsigned int D);
+    size_t here() const { return Code.size(); }
+    const std::vector<unsigned char>& getCode() const { return Code; }
+    void patchDword(size_t At, unsigned int D);
+
+    int newLabel();
+    void bind(int Label);
+    void jmp(int Label);
+    void jcc(int Cond, int Label);
+    bool finish();
+
+    void push(int Reg);
+    void pop(int Reg);
+    void ret() { byte(0xC3); }
+    void callReg(int Reg);
+    void movImm64(int Reg, unsigned long long Imm);
+    void movRegReg(int Dst, int Src);
+    void movLoad(int Reg, int Base, int Disp, bool Wide);
+    void movStoreImm32(int Base, int Disp, int Imm);
+    void lea(int Reg, int Base, int Disp);
+    void addRegReg(int Dst, int Src);
+    void addImm(int Reg, int Imm);
+    void subImm32(int Reg, size_t& PatchAt);
+    void imulImm(int Reg, int Imm);
+    void shlImm(int Reg, int Count);
+    void testRegReg(int A, int B);
+    void cmpRegMem(int Reg, int Base, int Disp);
+    void cmpImm(int Reg, int Imm);
+    void cmpMemImm8(int Base, int Disp, int Imm);
+    void decReg32(int Reg);
+    void setcc(int Cond, int Reg8);
+    void andReg8(int Dst, int Src);
+    void orReg8(int Dst, int Src);
+    void movzxReg8(int Dst, int Src);
+
+    void sseMem(unsigned char Prefix, unsigned char Op, int Xmm, int Base, int Disp);
+    void sseReg(unsigned char Prefix, unsigned char Op, int Dst, int Src);
+    void cvttsd2si(int Reg, int Xmm);
+    void cvtsi2sd(int Xmm, int Reg);
+    void movqToXmm(int Xmm, int Reg);
+};
+
+/// JitCompiler - translates one function body or loop into native code.
+/// Every expression leaves its result in xmm0; intermediate values are
+/// spilled to temporaries in the native stack frame.
+class JitCompiler
+{
+    struct LoopInfo
+    {
+        int ResultTemp;
+        int ExitLabel;
+    };
+
+    Assembler A;
+    ExprAST* RootLoop; // null when compiling a function body
+    unsigned int UnitFp;
+    bool FpDependent = false;
+    std::string FailReason;
+
+    int Temps = 0, MaxTemps = 0;
+
+    struct ErrorNote
+    {
+        int Label;
+        int Outer;
+        const char* Note;
+    };
+
+    std::vector<LoopInfo> Loops;
+    std::vector<int> ErrLabels; // innermost last
+    std::vector<ErrorNote> ErrNotes;
+    std::list<std::string> Strings;
+    int ExitLabel = -1;
+
+    void reload();
+
+public:
+    /// Loc - where a resolved variable lives, as far as compile time knows.
+    struct Loc
+    {
+        enum { frame, absolute, none } Kind;
+        unsigned int Where; // frame slot or memory address
+        const ArrShape* Shape;
+    };
+
+    JitCompiler(ExprAST* RootLoop, unsigned int UnitFp)
+        : RootLoop(RootLoop), UnitFp(UnitFp) {}
+
+    Assembler& as() { return A; }
+    bool isRootLoop(const ExprAST* E) const { return E == RootLoop; }
+    bool isLoopUnit() const { return RootLoop != nullptr; }
+    bool inLoop() const { return !Loops.empty(); }
+    unsigned int getUnitFp() { FpDependent = true; return UnitFp; }
+    bool isFpDependent() const { return FpDependent; }
+
+    void fail(const std::string& Reason) { if (FailReason.empty()) FailReason = Reason; }
+    bool failed() const { return !FailReason.empty(); }
+    const std::string& getFailReason() const { return FailReason; }
+
+    int allocTemp();
+    void freeTemp(int N = 1) { Temps -= N; }
+    int tempDisp(int Temp) const { return 32 + 8 * Temp; }
+    void storeTemp(int Temp);
+    void loadTemp(int Xmm, int Temp);
+
+    void loadConst(double Val);
+    void loadSlot(unsigned int Slot);
+    void storeSlot(unsigned int Slot);
+    void loadAbs(unsigned int Addr);
+    void storeAbs(unsigned int Addr);
+    void loadFp();
+
+    const char* intern(const std::string& Str);
+    std::list<std::string>& getStrings() { return Strings; }
+    Loc locate(const VarRef& Ref, bool AnyKind);
+    Loc locateArr(const VarRef& Ref);
+    void loadVar(const Loc& L);
+    void storeVar(const Loc& L);
+    bool elemIndex(const std::string& Name, const VarRef& Ref, const ExprList& Indices);
+    void checkAddr();
+    void loadElem();
+    void storeElem();
+
+    void callHelper(const void* Fn, const void* Arg1, int Temp, bool CanFail);
+    void callError(const char* Msg);
+    void checkStatus();
+    void jumpIfFalse(int Label);
+    void toBool();
+    void toIndex(const char* Msg);
+
+    void pushLoop(int ResultTemp, int ExitLabel) { Loops.push_back({ ResultTemp, ExitLabel }); }
+    void popLoop() { Loops.pop_back(); }
+    const LoopInfo& innermostLoop() const { return Loops.back(); }
+    void pushErrorNote(const std::string& Note);
+    void popErrorNote();
+    int getExitLabel() const { return ExitLabel; }
+
+    bool compileUnit(ExprAST* Body);
+    const std::vector<unsigned char>& getCode() const { return A.getCode(); }
+};
+
+bool JitRunFunction(FunctionAST& Fn, JitSlot& Slot, unsigned int Fp, Value& Result);
+
+bool JitRunLoop(ExprAST& Loop, JitSlot& Slot, unsigned int Fp, const double* Resume, Value& Result);
+
+void PrintJitStats();
@@ -0,0 +1,284 @@
+// MicroSEL
+// kernels.cpp
+
+#include "kernels.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define KERNELS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+bool UseSimd = true;
+
+// Sum and Dot keep several partial sums that are added up at the end. A
+// left-to-right loop rounds differently; the two results differ by at most
+// about N * 2^-53 * sum(|a[i]|) (sum(|a[i] * b[i]|) for Dot), and not at all
+// while every partial sum is an integer below 2^53. Min, Max, Fill, Scale
+// and Axpy round each element exactly as the loop does; none uses FMA.
+// Min and Max also return the same zero as the loop, the first one.
+
+//===----------------------------------------------------------------------===//
+// Scalar kernels
+//===----------------------------------------------------------------------===//
+
+static double SumScalar(const Cell* A, size_t N)
+{
+    double S = 0;
+    for (size_t i = 0; i < N; i++) S += A[i];
+    return S;
+}
+
+static double DotScalar(const Cell* A, const Cell* B, size_t N)
+{
+    double S = 0;
+    for (size_t i = 0; i < N; i++) S += A[i] * B[i];
+    return S;
+}
+
+// NaNs are skipped, like 'Val < Acc ? Val : Acc' and the min/max instructions.
+static double MinScalar(const Cell* A, size_t N)
+{
+    double M = HUGE_VAL;
+    for (size_t i = 0; i < N; i++) M = A[i] < M ? A[i] : M;
+    return M;
+}
+
+static double MaxScalar(const Cell* A, size_t N)
+{
+    double M = -HUGE_VAL;
+    for (size_t i = 0; i < N; i++) M = A[i] > M ? A[i] : M;
+    return M;
+}
+
+static void FillScalar(Cell* A, size_t N, double X)
+{
+    for (size_t i = 0; i < N; i++) A[i] = X;
+}
+
+static void ScaleScalar(Cell* A, size_t N, double K)
+{
+    for (size_t i = 0; i < N; i++) A[i] *= K;
+}
+
+static void AxpyScalar(Cell* Y, const Cell* X, size_t N, double K)
+{
+    for (size_t i = 0; i < N; i++) Y[i] += K * X[i];
+}
+
+#ifdef KERNELS_X86
+
+//===----------------------------------------------------------------------===//
+// SSE2 kernels, two cells per vector
+//===----------------------------------------------------------------------===//
+
+static double HSum(__m128d V)
+{
+    return _mm_cvtsd_f64(V) + _mm_cvtsd_f64(_mm_unpackhi_pd(V, V));
+}
+
+static double SumSse2(const Cell* A, size_t N)
+{
+    __m128d S0 = _mm_setzero_pd(), S1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= N; i += 4)
+    {
+        S0 = _mm_add_pd(S0, _mm_loadu_pd(A + i));
+        S1 = _mm_add_pd(S1, _mm_loadu_pd(A + i + 2));
+    }
+    return HSum(_mm_add_pd(S0, S1)) + SumScalar(A + i, N - i);
+}
+
+static double DotSse2(const Cell* A, const Cell* B, size_t N)
+{
+    __m128d S0 = _mm_setzero_pd(), S1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= N; i += 4)
+    {
+        S0 = _mm_add_pd(S0, _mm_mul_pd(_mm_loadu_pd(A + i), _mm_loadu_pd(B + i)));
+        S1 = _mm_add_pd(S1, _mm_mul_pd(_mm_loadu_pd(A + i + 2), _mm_loadu_pd(B + i + 2)));
+    }
+    return HSum(_mm_add_pd(S0, S1)) + DotScalar(A + i, B + i, N - i);
+}
+
+/// FirstZero - the first zero in A, with its sign. The loops keep the first
+/// of equal values, so when the result is a zero it is this one; lanes
+/// compared across each other may give the other zero instead.
+static double FirstZero(const Cell* A, size_t N)
+{
+    for (size_t i = 0; i < N; i++)
+        if (A[i] == 0) return A[i];
+    return 0;
+}
+
+static double MinSse2(const Cell* A, size_t N)
+{
+    __m128d M = _mm_set1_pd(HUGE_VAL);
+    size_t i = 0;
+    for (; i + 2 <= N; i += 2) M = _mm_min_pd(_mm_loadu_pd(A + i), M);
+    double Lo = _mm_cvtsd_f64(M), Hi = _mm_cvtsd_f64(_mm_unpackhi_pd(M, M));
+    double Rest = MinScalar(A + i, N - i);
+    Lo = Hi < Lo ? Hi : Lo;
+    Lo = Rest < Lo ? Rest : Lo;
+    return Lo == 0 ? FirstZero(A, N) : Lo;
+}
+
+static double MaxSse2(const Cell* A, size_t N)
+{
+    __m128d M = _mm_set1_pd(-HUGE_VAL);
+    size_t i = 0;
+    for (; i + 2 <= N; i += 2) M = _mm_max_pd(_mm_loadu_pd(A + i), M);
+    double Lo = _mm_cvtsd_f64(M), Hi = _mm_cvtsd_f64(_mm_unpackhi_pd(M, M));
+    double Rest = MaxScalar(A + i, N - i);
+    Lo = Hi > Lo ? Hi : Lo;
+    Lo = Rest > Lo ? Rest : Lo;
+    return Lo == 0 ? FirstZero(A, N) : Lo;
+}
+
+static void FillSse2(Cell* A, size_t N, double X)
+{
+    __m128d V = _mm_set1_pd(X);
+    size_t i = 0;
+    for (; i + 2 <= N; i += 2) _mm_storeu_pd(A + i, V);
+    FillScalar(A + i, N - i, X);
+}
+
+static void ScaleSse2(Cell* A, size_t N, double K)
+{
+    __m128d KV = _mm_set1_pd(K);
+    size_t i = 0;
+    for (; i + 2 <= N; i += 2) _mm_storeu_pd(A + i, _mm_mul_pd(_mm_loadu_pd(A + i), KV));
+    ScaleScalar(A + i, N - i, K);
+}
+
+static void AxpySse2(Cell* Y, const Cell* X, size_t N, double K)
+{
+    __m128d KV = _mm_set1_pd(K);
+    size_t i = 0;
+    for (; i + 2 <= N; i += 2)
+        _mm_storeu_pd(Y + i, _mm_add_pd(_mm_loadu_pd(Y + i), _mm_mul_pd(KV, _mm_loadu_pd(X + i))));
+    AxpyScalar(Y + i, X + i, N - i, K);
+}
+
+//===----------------------------------------------------------------------===//
+// AVX2 kernels, four cells per vector
+//===----------------------------------------------------------------------===//
+
+TARGET_AVX2 static double HSum4(__m256d V)
+{
+    return HSum(_mm_add_pd(_mm256_castpd256_pd128(V), _mm256_extractf128_pd(V, 1)));
+}
+
+TARGET_AVX2 static double SumAvx2(const Cell* A, size_t N)
+{
+    __m256d S0 = _mm256_setzero_pd(), S1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= N; i += 8)
+    {
+        S0 = _mm256_add_pd(S0, _mm256_loadu_pd(A + i));
+        S1 = _mm256_add_pd(S1, _mm256_loadu_pd(A + i + 4));
+    }
+    return HSum4(_mm256_add_pd(S0, S1)) + SumSse2(A + i, N - i);
+}
+
+TARGET_AVX2 static double DotAvx2(const Cell* A, const Cell* B, size_t N)
+{
+    __m256d S0 = _mm256_setzero_pd(), S1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= N; i += 8)
+    {
+        S0 = _mm256_add_pd(S0, _mm256_mul_pd(_mm256_loadu_pd(A + i), _mm256_loadu_pd(B + i)));
+        S1 = _mm256_add_pd(S1, _mm256_mul_pd(_mm256_loadu_pd(A + i + 4), _mm256_loadu_pd(B + i + 4)));
+    }
+    return HSum4(_mm256_add_pd(S0, S1)) + DotSse2(A + i, B + i, N - i);
+}
+
+TARGET_AVX2 static double MinAvx2(const Cell* A, size_t N)
+{
+    __m256d M = _mm256_set1_pd(HUGE_VAL);
+    size_t i = 0;
+    for (; i + 4 <= N; i += 4) M = _mm256_min_pd(_mm256_loadu_pd(A + i), M);
+    double Lanes[4];
+    _mm256_storeu_pd(Lanes, M);
+    double R = MinSse2(A + i, N - i);
+    for (double L : Lanes) R = L < R ? L : R;
+    return R == 0 ? FirstZero(A, N) : R;
+}
+
+TARGET_AVX2 static double MaxAvx2(const Cell* A, size_t N)
+{
+    __m256d M = _mm256_set1_pd(-HUGE_VAL);
+    size_t i = 0;
+    for (; i + 4 <= N; i += 4) M = _mm256_max_pd(_mm256_loadu_pd(A + i), M);
+    double Lanes[4];
+    _mm256_storeu_pd(Lanes, M);
+    double R = MaxSse2(A + i, N - i);
+    for (double L : Lanes) R = L > R ? L : R;
+    return R == 0 ? FirstZero(A, N) : R;
+}
+
+TARGET_AVX2 static void FillAvx2(Cell* A, size_t N, double X)
+{
+    __m256d V = _mm256_set1_pd(X);
+    size_t i = 0;
+    for (; i + 4 <= N; i += 4) _mm256_storeu_pd(A + i, V);
+    FillSse2(A + i, N - i, X);
+}
+
+TARGET_AVX2 static void ScaleAvx2(Cell* A, size_t N, double K)
+{
+    __m256d KV = _mm256_set1_pd(K);
+    size_t i = 0;
+    for (; i + 4 <= N; i += 4) _mm256_storeu_pd(A + i, _mm256_mul_pd(_mm256_loadu_pd(A + i), KV));
+    ScaleSse2(A + i, N - i, K);
+}
+
+TARGET_AVX2 static void AxpyAvx2(Cell* Y, const Cell* X, size_t N, double K)
+{
+    __m256d KV = _mm256_set1_pd(K);
+    size_t i = 0;
+    for (; i + 4 <= N; i += 4)
+        _mm256_storeu_pd(Y + i, _mm256_add_pd(_mm256_loadu_pd(Y + i), _mm256_mul_pd(KV, _mm256_loadu_pd(X + i))));
+    AxpySse2(Y + i, X + i, N - i, K);
+}
+
+/// HasAvx2 - true if both the CPU and the operating system support AVX2.
+static bool HasAvx2()
+{
+#ifdef _MSC_VER
+    int Info[4];
+    __cpuid(Info, 1);
+    bool OsSavesYmm = (Info[2] & (1 << 27)) && (Info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(Info, 7, 0);
+    return OsSavesYmm && (Info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+/// GetArrayKernels - the kernels for this CPU, picked on first use: AVX2
+/// where available, SSE2 on any other x86-64 CPU, and plain loops elsewhere
+/// or with --no-simd.
+const ArrayKernels& GetArrayKernels()
+{
+    static const ArrayKernels Scalar = { "scalar", SumScalar, DotScalar, MinScalar, MaxScalar,
+        FillScalar, ScaleScalar, AxpyScalar };
+#ifdef KERNELS_X86
+    static const ArrayKernels Sse2 = { "sse2", SumSse2, DotSse2, MinSse2, MaxSse2,
+        FillSse2, ScaleSse2, AxpySse2 };
+    static const ArrayKernels Avx2 = { "avx2", SumAvx2, DotAvx2, MinAvx2, MaxAvx2,
+        FillAvx2, ScaleAvx2, AxpyAvx2 };
+    static const ArrayKernels& Best = !UseSimd ? Scalar : HasAvx2() ? Avx2 : Sse2;
+    return Best;
+#else
+    return Scalar;
+#endif
+}
@@ -0,0 +1,27 @@
+// MicroSEL
+// kernels.h
+
+#pragma once
+
+#include "value.h"
+#include <cstddef>
+
+extern bool UseSimd;
+
+/// ArrayKernels - loops over runs of contiguous cells in Memory, behind
+/// the array builtins of stdfunc.cpp. Sum and Dot add in a different order
+/// than a left-to-right loop; see kernels.cpp for how far their results
+/// may differ. The other kernels give exactly the scalar results.
+struct ArrayKernels
+{
+    const char* Name;
+    double (*Sum)(const Cell* A, size_t N);
+    double (*Dot)(const Cell* A, const Cell* B, size_t N);
+    double (*Min)(const Cell* A, size_t N); // +inf for no values
+    double (*Max)(const Cell* A, size_t N); // -inf for no values
+    void (*Fill)(Cell* A, size_t N, double X);
+    void (*Scale)(Cell* A, size_t N, double K);
+    void (*Axpy)(Cell* Y, const Cell* X, size_t N, double K); // Y += K * X
+};
+
+const ArrayKernels& GetArrayKernels();
@@ -1,99 +1,268 @@
-
 // MicroSEL
 // lexer.cpp
 
 #include "lexer.h"
-#include "execute.h"
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
 
-std::string IdStr; // ĺ ̸   ڿ
-double NumVal; // ڸ Է¹ ,    
-int LastChar = ' '; //  Է¹ 
+/// CharClass - 문자 분류 테이블의 비트. <cctype>의 함수들과 달리 로케일에
+/// 영향을 받지 않으며, 테이블 한 번의 조회로 끝난다.
+enum CharClass : unsigned char
+{
+    cc_space = 1, // ' ', '\t', '\n', '\v', '\f', '\r'
+    cc_alpha = 2, // [a-zA-Z]: 식별자의 첫 글자
+    cc_ident = 4, // [a-zA-Z0-9_]: 식별자의 나머지 글자
+    cc_digit = 8, // [0-9]
+    cc_number = 16, // [0-9.]: 숫자의 글자
+};
 
-int NextCh(const std::string& Code, int& Idx)
+static constexpr struct CharTable
 {
-    if (IsInteractive) return getchar(); // ȭ ̸ Ű带  Է¹
-    return Code[Idx++]; // ũƮ  ̸ ڵ ڿκ о 
+    unsigned char Class[256] = {};
+
+    constexpr CharTable()
+    {
+        for (int Ch : { ' ', '\t', '\n', '\v', '\f', '\r' }) Class[Ch] |= cc_space;
+        for (int Ch = 'a'; Ch <= 'z'; Ch++) Class[Ch] |= cc_alpha | cc_ident;
+        for (int Ch = 'A'; Ch <= 'Z'; Ch++) Class[Ch] |= cc_alpha | cc_ident;
+        for (int Ch = '0'; Ch <= '9'; Ch++) Class[Ch] |= cc_ident | cc_digit | cc_number;
+        Class['_'] |= cc_ident;
+        Class['.'] |= cc_number;
+    }
+} Chars;
+
+/// Is - Ch가 Mask의 분류에 속하는지 확인한다. EOF는 255번 칸을 보게 되며, 이 칸은 비어 있다.
+static inline bool Is(int Ch, unsigned char Mask)
+{
+    return Chars.Class[(unsigned char)Ch] & Mask;
 }
 
-int GetTok(const std::string& Code, int& Idx)
+/// Keyword - 예약된 키워드이면 그 토큰을, 아니면 tok_identifier를 돌려준다.
+/// 길이로 후보를 먼저 고른 뒤 한 번만 비교한다.
+static int Keyword(std::string_view Id)
 {
-    //   ǳʶٱ
-    while (isspace(LastChar)) LastChar = NextCh(Code, Idx);
+    auto Match = [&](const char* Word, int Tok) { return memcmp(Id.data(), Word, Id.size()) ? (int)tok_identifier : Tok; };
 
-    if (isalpha(LastChar)) // ĺ: [a-zA-Z][a-zA-Z0-9_]*
+    switch (Id.size())
     {
-        IdStr = LastChar;
-
-        while (true)
+    case 2: return Match("if", tok_if);
+    case 3:
+        switch (Id[0])
         {
-            LastChar = NextCh(Code, Idx);
-            if (isalnum(LastChar) || LastChar == '_') IdStr += LastChar;
-            else break;
+        case 'a': return Match("arr", tok_arr);
+        case 'f': return Match("for", tok_for);
         }
+        break;
+    case 4:
+        switch (Id[0])
+        {
+        case 'f': return Match("func", tok_func);
+        case 't': return Match("then", tok_then);
+        case 'e': return Match("else", tok_else);
+        case 'p': return Match("pfor", tok_pfor);
+        }
+        break;
+    case 5:
+        switch (Id[0])
+        {
+        case 'w': return Match("while", tok_while);
+        case 'b': return Match("break", tok_break);
+        }
+        break;
+    case 6: return Match("return", tok_return);
+    }
+    return tok_identifier;
+}
 
-        //  Ű
-        if (IdStr == "func")
-            return tok_func;
-        if (IdStr == "arr")
-            return tok_arr;
-        if (IdStr == "if")
-            return tok_if;
-        if (IdStr == "then")
-            return tok_then;
-        if (IdStr == "else")
-            return tok_else;
-        if (IdStr == "for")
-            return tok_for;
-        if (IdStr == "while")
-            return tok_while;
-        if (IdStr == "break")
-            return tok_break;
-        if (IdStr == "return")
-            return tok_return;
-
-        return tok_identifier; //  Ű尡 ƴ 
+int TokenStream::nextCh()
+{
+    if (Interactive) // 대화형 모드이면 키보드를 통해 입력받음
+    {
+        Consumed++;
+        return getchar();
     }
+    if (Src.Cur == Src.End) return EOF; // 스크립트의 끝
+    return (unsigned char)*Src.Cur++; // 스크립트 실행 모드이면 매핑된 코드로부터 읽어 옴
+}
 
-    if (isdigit(LastChar) || LastChar == '.') // : [0-9.]+
+/// offset - 소스에서 LastChar의 위치
+unsigned int TokenStream::offset() const
+{
+    if (Interactive) return Consumed - 1;
+    return (unsigned int)(Src.Cur - Begin) - (LastChar != EOF);
+}
+
+/// text - LastChar와 그 뒤로 Accept를 만족하는 문자들로 이루어진 토큰을 읽는다.
+/// 스크립트 실행 모드에서는 복사 없이 매핑된 코드를 가리키는 view를 돌려준다.
+template <typename Pred>
+std::string_view TokenStream::text(Pred Accept)
+{
+    if (!Interactive)
     {
-        std::string NumStr;
-        do
+        const char* Start = Src.Cur - 1;
+        while (Src.Cur != Src.End && Accept((unsigned char)*Src.Cur)) Src.Cur++;
+        std::string_view Text(Start, Src.Cur - Start);
+        LastChar = nextCh();
+        return Text;
+    }
+
+    TokBuf = (char)LastChar;
+    while (Accept(LastChar = nextCh())) TokBuf += (char)LastChar;
+    return TokBuf;
+}
+
+/// intern - 이름 테이블에서 Name의 번호를 찾고, 없으면 새로 등록한다.
+unsigned int TokenStream::intern(std::string_view Name)
+{
+    auto It = NameIds.find(Name);
+    if (It != NameIds.end()) return It->second;
+
+    Names.emplace_back(Name);
+    unsigned int Id = Names.size() - 1;
+    NameIds.emplace(Names.back(), Id); // deque의 원소는 옮겨지지 않으므로 view가 유효함
+    return Id;
+}
+
+unsigned int TokenStream::number(std::string_view Text)
+{
+    // [0-9.]+ 중 앞부분의 올바른 실수만 읽으며, "."처럼 숫자가 없으면 0이 된다.
+    double Num = 0;
+    auto Res = std::from_chars(Text.data(), Text.data() + Text.size(), Num);
+    if (Res.ec == std::errc::result_out_of_range)
+        Num = strtod(std::string(Text).c_str(), nullptr); // 범위를 넘는 값은 strtod처럼 inf로
+    Nums.push_back(Num);
+    return Nums.size() - 1;
+}
+
+static bool IsIdChar(int Ch) { return Is(Ch, cc_ident); }
+static bool IsNumChar(int Ch) { return Is(Ch, cc_number); }
+
+/// lex - 토큰 하나를 읽는다.
+Lexeme TokenStream::lex()
+{
+    // 공백 문자와 주석 건너뛰기
+    while (true)
+    {
+        if (!Interactive && Is(LastChar, cc_space))
         {
-            NumStr += LastChar;
-            LastChar = NextCh(Code, Idx);
-        } while (isdigit(LastChar) || LastChar == '.');
+            // 스크립트 실행 모드에서는 이어지는 공백을 포인터로 바로 건너뜀
+            while (Src.Cur != Src.End && Is(*Src.Cur, cc_space)) Src.Cur++;
+            LastChar = nextCh();
+        }
+        while (Is(LastChar, cc_space)) LastChar = nextCh();
+        if (LastChar != '#') break;
 
-        NumVal = strtod(NumStr.c_str(), nullptr);
-        return tok_number;
+        // 라인 끝까지 주석 처리
+        if (!Interactive)
+            while (Src.Cur != Src.End && *Src.Cur != '\n' && *Src.Cur != '\r') Src.Cur++;
+        do LastChar = nextCh();
+        while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
     }
 
-    if (LastChar == '#') //   ּ ó
+    Lexeme Tok = { tok_eof, offset(), 0 };
+
+    if (Is(LastChar, cc_alpha)) // 식별자: [a-zA-Z][a-zA-Z0-9_]*
     {
-        do LastChar = NextCh(Code, Idx);
-        while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+        std::string_view IdStr = text(IsIdChar);
 
-        if (LastChar != EOF)
-            return GetTok(Code, Idx);
+        Tok.Kind = Keyword(IdStr);
+        if (Tok.Kind == tok_identifier) // 예약된 키워드가 아닐 경우
+            Tok.Payload = intern(IdStr);
+        return Tok;
     }
 
-    if (LastChar == '{') //  
+    if (Is(LastChar, cc_number)) // 숫자: [0-9.]+
     {
-        LastChar = NextCh(Code, Idx);
-        return tok_openblock;
+        Tok.Kind = tok_number;
+        Tok.Payload = number(text(IsNumChar));
+        return Tok;
     }
-    if (LastChar == '}') //  ݱ
+
+    // 파일의 끝이면 EOF 토큰 반환
+    if (LastChar == EOF) return Tok;
+
+    // 블록 열기와 닫기
+    if (LastChar == '{') Tok.Kind = tok_openblock;
+    else if (LastChar == '}') Tok.Kind = tok_closeblock;
+    else Tok.Kind = LastChar; // 아무 곳에도 속하지 않을 경우 아스키 코드 값 그대로 반환
+    LastChar = nextCh();
+
+    // 바로 뒤에 이어지는 문자와 함께 두 글자 연산자를 이루는지 확인
+    int Double = tok_eof;
+    switch (Tok.Kind)
     {
-        LastChar = NextCh(Code, Idx);
-        return tok_closeblock;
+    case '*': if (LastChar == '*') Double = tok_pow; break;
+    case '<': if (LastChar == '=') Double = tok_le; break;
+    case '>': if (LastChar == '=') Double = tok_ge; break;
+    case '=': if (LastChar == '=') Double = tok_eq; break;
+    case '!': if (LastChar == '=') Double = tok_ne; break;
+    case '&': if (LastChar == '&') Double = tok_and; break;
+    case '|': if (LastChar == '|') Double = tok_or; break;
     }
+    if (Double != tok_eof)
+    {
+        Tok.Kind = Double;
+        LastChar = nextCh();
+    }
+    return Tok;
+}
 
-    //  ̸ EOF ū ȯ
-    if (LastChar == EOF)
-        return tok_eof;
+/// fill - Toks[Idx]까지 토큰을 읽어 둔다. EOF 뒤로는 EOF 토큰이 반복된다.
+void TokenStream::fill(size_t Idx)
+{
+    while (Toks.size() <= Idx)
+    {
+        if (!Toks.empty() && Toks.back().Kind == tok_eof)
+        {
+            Toks.push_back(Toks.back());
+            continue;
+        }
+        Toks.push_back(lex());
+    }
+}
 
-    // ƹ     ƽŰ ڵ  ״ ȯ
-    int ThisChar = LastChar;
-    LastChar = NextCh(Code, Idx);
-    return ThisChar;
-}
\ No newline at end of file
+/// tokenize - 스크립트 전체를 한 번에 토큰 배열로 만든다.
+void TokenStream::tokenize()
+{
+    Toks.reserve((Src.End - Src.Cur) / 4 + 1);
+    do Toks.push_back(lex());
+    while (Toks.back().Kind != tok_eof);
+}
+
+/// locate - 현재 토큰의 줄과 열 (1부터 셈). 대화형 모드에서는 0.
+/// 토큰은 앞에서부터 차례로 찾으므로 지난번에 멈춘 곳부터 이어서 센다.
+void TokenStream::locate(unsigned int& Line, unsigned int& Col)
+{
+    if (Interactive)
+    {
+        Line = Col = 0;
+        return;
+    }
+
+    unsigned int Offset = peek().Offset;
+    if (Offset < LineScan) LineScan = LineStart = 0, LineNo = 1; // rewind() 이후
+    for (; LineScan < Offset; LineScan++)
+        if (Begin[LineScan] == '\n') LineNo++, LineStart = LineScan + 1;
+    Line = LineNo;
+    Col = Offset - LineStart + 1;
+}
+
+const Lexeme& TokenStream::next()
+{
+    if (Started) Pos++;
+    Started = true;
+    return peek();
+}
+
+const Lexeme& TokenStream::peek(size_t Ahead)
+{
+    if (Pos + Ahead >= Toks.size())
+    {
+        if (!Interactive && !Toks.empty() && Toks.back().Kind == tok_eof)
+            return Toks.back(); // 스크립트의 끝 너머는 모두 EOF
+        fill(Pos + Ahead);
+    }
+    return Toks[Pos + Ahead];
+}
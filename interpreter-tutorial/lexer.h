@@ -5,7 +5,12 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
 #include "value.h"
+#include "source.h"
 
 typedef enum Token
 {
@@ -24,6 +29,7 @@ typedef enum Token
     tok_else = -18,
     tok_for = -19,
     tok_while = -20,
+    tok_pfor = -21,
     tok_break = -30,
     tok_return = -31,
 
@@ -34,12 +40,69 @@ typedef enum Token
     // block and bracket
     tok_openblock = -90,
     tok_closeblock = -91,
+
+    // two-character operators, combined by the lexer
+    tok_pow = -100, // **
+    tok_le = -101, // <=
+    tok_ge = -102, // >=
+    tok_eq = -103, // ==
+    tok_ne = -104, // !=
+    tok_and = -105, // &&
+    tok_or = -106, // ||
+};
+
+/// Lexeme - one token of the token array. Payload indexes the name table
+/// for identifiers and the number table for numbers.
+struct Lexeme
+{
+    int Kind; // a Token, or the character itself
+    unsigned int Offset; // byte offset of the first character in the source
+    unsigned int Payload;
 };
 
-extern std::string IdStr;
-extern std::string MainCode;
+/// TokenStream - the tokens of a script in one dense array, with interned
+/// names and numbers. A script is lexed completely before it is parsed, so
+/// the parser can look ahead as far as it likes and parse the same tokens
+/// again after rewind(). Interactive input is lexed on demand instead, as
+/// the parser reaches the end of the array.
+class TokenStream
+{
+    Source Src;
+    const char* Begin = nullptr;
+    bool Interactive;
+    unsigned int Consumed = 0; // characters read in interactive mode
+    int LastChar = ' '; // the character after the last token
+    std::string TokBuf; // text of the last token in interactive mode
+
+    std::vector<Lexeme> Toks;
+    size_t Pos = 0;
+    bool Started = false;
 
-extern double NumVal;
-extern int LastChar;
+    unsigned int LineScan = 0, LineNo = 1, LineStart = 0; // see locate()
 
-int GetTok(const std::string& Code, int& Idx);
\ No newline at end of file
+    std::vector<double> Nums;
+    std::deque<std::string> Names;
+    std::unordered_map<std::string_view, unsigned int> NameIds;
+
+    int nextCh();
+    unsigned int offset() const;
+    template <typename Pred> std::string_view text(Pred Accept);
+    unsigned int intern(std::string_view Name);
+    unsigned int number(std::string_view Text);
+    Lexeme lex();
+    void fill(size_t Idx);
+
+public:
+    TokenStream() : Interactive(true) {}
+    TokenStream(Source Src) : Src(Src), Begin(Src.Cur), Interactive(false) {}
+
+    void tokenize();
+    void rewind() { Pos = 0; Started = false; }
+
+    const Lexeme& next();
+    const Lexeme& peek(size_t Ahead = 0);
+    void locate(unsigned int& Line, unsigned int& Col);
+    const std::string& getName() { return Names[peek().Payload]; }
+    double getNum() { return Nums[peek().Payload]; }
+    size_t size() const { return Toks.size(); }
+};
@@ -1,15 +1,146 @@
 
 // MicroSEL
 // main.cpp
-    
+
+#include "batch.h"
 #include "execute.h"
 #include "interactiveMode.h"
+#include "jit.h"
+#include "kernels.h"
+#include "memo.h"
+#include "optimizer.h"
+#include "profile.h"
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/// Run - runs one script or the shell in a fresh interpreter on the
+/// calling thread.
+static bool Run(const char* FileName, unsigned int StackMB)
+{
+    Interpreter Interp;
+    InterpreterScope Scope(Interp);
+
+    if (!Interp.StackMemory.reserve((size_t)StackMB << 20))
+    {
+        fprintf(stderr, "Error: Could not reserve %u MB for the stack\n", StackMB);
+        return false;
+    }
+
+    std::unique_ptr<Profiler> Prof;
+    if (UseProfile)
+    {
+        Prof.reset(new Profiler);
+        CurProfile = Prof.get();
+    }
+
+    if (FileName == nullptr) RunInteractiveShell();
+    else ExecuteScript(FileName);
+
+    if (JitStats) PrintJitStats();
+    if (MemoStats) PrintMemoStats();
+    if (Prof)
+    {
+        CurProfile = nullptr;
+        PrintProfile(*Prof);
+    }
+    return true;
+}
 
 int main(int argc, char* argv[])
 {
-    if (argc == 1) RunInteractiveShell();
-    else if (argc == 2) ExecuteScript(argv[1]);
-    else fprintf(stderr, "You can run only one file at once.\nusage: %s \"filename.nvs\"\n", argv[0]);
+    const char* FileName = nullptr;
+    unsigned int StackMB = DefaultStackMB;
+    bool LexBench = false;
+    unsigned int Threads = 0;
+    bool Batch = false;
+    unsigned int Workers = 0; // 0 for one per core
+    std::vector<std::string> BatchFiles;
+    std::vector<std::string> Scripts;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--vm")) UseBytecode = true;
+        else if (!strcmp(argv[i], "--disasm")) UseBytecode = DumpBytecode = true;
+        else if (!strcmp(argv[i], "--no-fold")) UseFolding = false;
+        else if (!strcmp(argv[i], "--dump-ast")) DumpAst = true;
+        else if (!strcmp(argv[i], "--no-jit")) UseJit = false;
+        else if (!strcmp(argv[i], "--jit-stats")) JitStats = true;
+        else if (!strcmp(argv[i], "--no-bounds-check")) CheckBounds = false;
+        else if (!strcmp(argv[i], "--no-simd")) UseSimd = false;
+        else if (!strcmp(argv[i], "--lex-stats")) LexStats = true;
+        else if (!strcmp(argv[i], "--lex-bench")) LexBench = true;
+        else if (!strcmp(argv[i], "--memo")) UseMemo = true;
+        else if (!strcmp(argv[i], "--memo-stats")) MemoStats = true;
+        else if (!strcmp(argv[i], "--profile")) UseProfile = true;
+        else if (!strcmp(argv[i], "--profile-out") && i + 1 < argc)
+        {
+            UseProfile = true;
+            ProfileFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--stack-size") && i + 1 < argc && atoi(argv[i + 1]) > 0) StackMB = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--parallel") && i + 1 < argc && atoi(argv[i + 1]) > 0) Threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pfor-threads") && i + 1 < argc && atoi(argv[i + 1]) > 0) PforThreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--batch")) Batch = true;
+        else if (!strcmp(argv[i], "--jobs") && i + 1 < argc && atoi(argv[i + 1]) > 0) Workers = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--manifest") && i + 1 < argc)
+        {
+            Batch = true;
+            if (!ReadManifest(argv[++i], BatchFiles))
+            {
+                fprintf(stderr, "Error: Cannot read manifest \"%s\"\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Unknown option \"%s\".\nusage: %s [--vm] [--disasm] [--no-fold] [--dump-ast] [--no-jit] [--jit-stats] [--no-bounds-check] [--no-simd] [--lex-stats] [--lex-bench] [--memo] [--memo-stats] [--profile [--profile-out FILE]] [--stack-size MB] [--parallel N] [--pfor-threads N] [--batch [--jobs N] [--manifest FILE]] \"filename.nvs\"\n", argv[i], argv[0]);
+            return 1;
+        }
+        else Scripts.push_back(argv[i]);
+    }
+
+    if (UseProfile && (Batch || Threads > 0))
+    {
+        fprintf(stderr, "--profile runs one script at a time; it cannot be combined with --batch or --parallel.\n");
+        return 1;
+    }
+    // The profiler hooks into the tree walker, so that is what a profiled
+    // script runs on: the JIT and the VM stay off.
+    if (UseProfile) UseJit = UseBytecode = false;
+
+    if (Batch)
+    {
+        BatchFiles.insert(BatchFiles.end(), Scripts.begin(), Scripts.end());
+        return RunBatch(BatchFiles, Workers, StackMB);
+    }
+    if (Scripts.size() > 1)
+    {
+        fprintf(stderr, "You can run only one file at once; use --batch to run several.\nusage: %s [--vm] [--disasm] [--no-fold] [--dump-ast] [--no-jit] [--jit-stats] [--no-bounds-check] [--no-simd] [--lex-stats] [--lex-bench] [--memo] [--memo-stats] [--profile [--profile-out FILE]] [--stack-size MB] [--parallel N] [--pfor-threads N] [--batch [--jobs N] [--manifest FILE]] \"filename.nvs\"\n", argv[0]);
+        return 1;
+    }
+    if (!Scripts.empty()) FileName = Scripts[0].c_str();
+
+    if (LexBench)
+    {
+        if (FileName == nullptr) fprintf(stderr, "--lex-bench needs a script file.\n");
+        else BenchmarkLexer(FileName);
+        return FileName == nullptr;
+    }
+
+    // --parallel N runs the script in N independent interpreters at once.
+    if (Threads > 0 && FileName != nullptr)
+    {
+        std::vector<std::thread> Pool;
+        std::vector<char> Ok(Threads);
+        for (unsigned int i = 0; i < Threads; i++)
+            Pool.emplace_back([&, i] { Ok[i] = Run(FileName, StackMB); });
+        for (auto& Worker : Pool) Worker.join();
+        for (char Started : Ok)
+            if (!Started) return 1;
+        return 0;
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return Run(FileName, StackMB) ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+
+// MicroSEL
+// memo.cpp
+
+#include "memo.h"
+#include "execute.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+bool UseMemo = false;
+bool MemoStats = false;
+
+/// MemoCache - direct-mapped result cache of one function. A row holds the
+/// argument bits and the result; a new key evicts whatever shares its row,
+/// so the cache never grows past MemoEntries rows.
+struct MemoCache
+{
+    unsigned int Argc;
+    unsigned int Entries = 0;
+    std::vector<double> Keys; // Argc doubles per row
+    std::vector<Value> Results;
+    std::vector<bool> Used;
+
+    MemoCache(unsigned int Argc)
+        : Argc(Argc), Keys((size_t)MemoEntries * Argc), Results(MemoEntries), Used(MemoEntries) {}
+};
+
+void MemoCacheDeleter::operator()(MemoCache* Cache) const
+{
+    delete Cache;
+}
+
+/// isLocal - true if Ref always names a slot of the function's own frame.
+/// A ref_either name stays local only while no global of that name exists.
+bool Purity::isLocal(const VarRef& Ref)
+{
+    if (Ref.Depth == ref_local) return true;
+    return Ref.Depth == ref_either && !CurInterp->SymTbl[Ref.Global].Defined;
+}
+
+//===----------------------------------------------------------------------===//
+// Purity analysis
+//===----------------------------------------------------------------------===//
+
+bool NumberExprAST::isPure(Purity&)
+{
+    return true;
+}
+
+bool VariableExprAST::isPure(Purity& P)
+{
+    for (auto& Idx : Indices)
+        if (!Idx->isPure(P)) return false;
+    return P.isLocal(Ref);
+}
+
+bool DeRefExprAST::isPure(Purity&)
+{
+    return false; // may read any address
+}
+
+bool ArrDeclExprAST::isPure(Purity& P)
+{
+    return P.isLocal(Ref);
+}
+
+bool UnaryExprAST::isPure(Purity& P)
+{
+    // An address depends on where the frame happens to be.
+    if (Opcode == '&') return false;
+    return Operand->isPure(P);
+}
+
+bool BinaryExprAST::isPure(Purity& P)
+{
+    if (Op == binop_assign && LHS->getNodeType() != node_var) return false;
+    return LHS->isPure(P) && RHS->isPure(P);
+}
+
+bool LogicalExprAST::isPure(Purity& P)
+{
+    return LHS->isPure(P) && RHS->isPure(P);
+}
+
+bool CallExprAST::isPure(Purity& P)
+{
+    // Every standard function does I/O; unknown callees only report errors.
+    LinkCall(Link);
+    if (Link.State != link_script) return false;
+    P.Callees.push_back(Link.Func);
+
+    for (auto& Arg : Args)
+        if (!Arg->isPure(P)) return false;
+    return true;
+}
+
+bool IfExprAST::isPure(Purity& P)
+{
+    return CondExpr->isPure(P) && ThenExpr->isPure(P)
+        && (ElseExpr == nullptr || ElseExpr->isPure(P));
+}
+
+bool ForExprAST::isPure(Purity& P)
+{
+    return P.isLocal(Ref) && Start->isPure(P) && End->isPure(P)
+        && (!Step || Step->isPure(P)) && Body->isPure(P);
+}
+
+bool PforExprAST::isPure(Purity&)
+{
+    return false; // runs on other threads and assigns its accumulator
+}
+
+bool WhileExprAST::isPure(Purity& P)
+{
+    return Cond->isPure(P) && Body->isPure(P);
+}
+
+bool BlockExprAST::isPure(Purity& P)
+{
+    for (auto& Expr : Expressions)
+        if (!Expr->isPure(P)) return false;
+    return true;
+}
+
+bool BreakExprAST::isPure(Purity& P)
+{
+    return Expr->isPure(P);
+}
+
+bool ReturnExprAST::isPure(Purity& P)
+{
+    return Expr->isPure(P);
+}
+
+/// UpdatePurity - reanalyzes every defined function after a definition or
+/// a global has changed. Each body is checked on its own first; then
+/// functions calling an impure one are dropped until nothing changes, so
+/// recursive and mutually recursive functions can still be pure.
+static void UpdatePurity()
+{
+    if (CurInterp->PurityValid && CurInterp->PurityEpoch == CurInterp->GlobalEpoch) return;
+    CurInterp->PurityValid = true;
+    CurInterp->PurityEpoch = CurInterp->GlobalEpoch;
+
+    std::vector<std::vector<unsigned int>> Callees(CurInterp->FuncTbl.size());
+    for (size_t i = 0; i < CurInterp->FuncTbl.size(); i++)
+    {
+        FunctionAST* Fn = CurInterp->FuncTbl[i].Fn.get();
+        if (!Fn) continue;
+
+        MemoSlot& M = Fn->getMemo();
+        Purity P;
+        M.Pure = Fn->argsSize() <= (int)MaxMemoArgs && Fn->getBody()->isPure(P);
+        M.Cache.reset(); // results may depend on a callee that changed
+        Callees[i] = std::move(P.Callees);
+    }
+
+    bool Changed = true;
+    while (Changed)
+    {
+        Changed = false;
+        for (size_t i = 0; i < CurInterp->FuncTbl.size(); i++)
+        {
+            FunctionAST* Fn = CurInterp->FuncTbl[i].Fn.get();
+            if (!Fn || !Fn->getMemo().Pure) continue;
+
+            for (unsigned int Callee : Callees[i])
+            {
+                FunctionAST* CalleeF = CurInterp->FuncTbl[Callee].Fn.get();
+                if (CalleeF && CalleeF->getMemo().Pure) continue;
+                Fn->getMemo().Pure = false;
+                Changed = true;
+                break;
+            }
+        }
+    }
+}
+
+/// InvalidateMemo - called when a function is defined or redefined.
+void InvalidateMemo()
+{
+    CurInterp->PurityValid = false;
+}
+
+bool MemoPure(FunctionAST& Fn)
+{
+    UpdatePurity();
+    return Fn.getMemo().Pure;
+}
+
+static size_t HashKey(const double* Key, unsigned int Argc)
+{
+    uint64_t Hash = 0x9E3779B97F4A7C15ull;
+    for (unsigned int i = 0; i < Argc; i++)
+    {
+        uint64_t Bits;
+        memcpy(&Bits, &Key[i], sizeof(Bits));
+        // Integral doubles differ only in their high bits; fold them down.
+        Hash ^= Bits;
+        Hash ^= Hash >> 33;
+        Hash *= 0xFF51AFD7ED558CCDull;
+        Hash ^= Hash >> 33;
+    }
+    Hash *= 0xC4CEB9FE1A85EC53ull;
+    Hash ^= Hash >> 33;
+    return (size_t)Hash;
+}
+
+/// MemoBegin - looks up the arguments in the frame at Base. They are copied
+/// to Key, which needs MaxMemoArgs doubles, because the body may assign to
+/// its parameters before MemoEnd stores the result.
+memoState MemoBegin(FunctionAST& Fn, unsigned int Base, double* Key, Value& Result)
+{
+    if (!MemoPure(Fn)) return memo_off;
+
+    MemoSlot& M = Fn.getMemo();
+    unsigned int Argc = Fn.argsSize();
+    const Cell* Args = CurInterp->StackMemory.data() + Base;
+    for (unsigned int i = 0; i < Argc; i++) Key[i] = Args[i];
+
+    if (!M.Cache) M.Cache.reset(new MemoCache(Argc));
+    MemoCache& Cache = *M.Cache;
+    size_t Row = HashKey(Key, Argc) & (MemoEntries - 1);
+    if (Cache.Used[Row] && !memcmp(&Cache.Keys[Row * Argc], Key, Argc * sizeof(double)))
+    {
+        M.Hits++;
+        Result = Cache.Results[Row];
+        return memo_hit;
+    }
+    M.Misses++;
+    return memo_miss;
+}
+
+/// MemoEnd - stores the result of a call that missed. Calls that fail
+/// never get here, so the call reports its errors again next time.
+void MemoEnd(FunctionAST& Fn, const double* Key, Value Result)
+{
+    MemoSlot& M = Fn.getMemo();
+    if (!M.Cache) return;
+
+    MemoCache& Cache = *M.Cache;
+    unsigned int Argc = Cache.Argc;
+    size_t Row = HashKey(Key, Argc) & (MemoEntries - 1);
+    if (!Cache.Used[Row]) Cache.Entries++;
+    Cache.Used[Row] = true;
+    if (Argc) memcpy(&Cache.Keys[Row * Argc], Key, Argc * sizeof(double));
+    Cache.Results[Row] = Result;
+}
+
+void PrintMemoStats()
+{
+    unsigned long long Hits = 0, Misses = 0;
+    unsigned int Pure = 0;
+    for (auto& Func : CurInterp->FuncTbl)
+    {
+        if (!Func.Fn) continue;
+        const MemoSlot& M = Func.Fn->getMemo();
+        Pure += M.Pure;
+        Hits += M.Hits;
+        Misses += M.Misses;
+    }
+
+    fprintf(CurInterp->Err, "\nMemoization statistics%s\n", UseMemo ? "" : " (disabled)");
+    fprintf(CurInterp->Err, "  cache size      %u entries per function\n", MemoEntries);
+    fprintf(CurInterp->Err, "  pure functions  %u\n", Pure);
+    fprintf(CurInterp->Err, "  hits            %llu\n", Hits);
+    fprintf(CurInterp->Err, "  misses          %llu\n", Misses);
+    for (auto& Func : CurInterp->FuncTbl)
+    {
+        if (!Func.Fn) continue;
+        const MemoSlot& M = Func.Fn->getMemo();
+        if (!M.Hits && !M.Misses) continue;
+        fprintf(CurInterp->Err, "    %-16s %llu hits, %llu misses, %u cached\n", Func.Name.c_str(),
+            M.Hits, M.Misses, M.Cache ? M.Cache->Entries : 0);
+    }
+}
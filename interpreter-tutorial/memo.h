@@ -0,0 +1,43 @@
+
+// MicroSEL
+// memo.h
+
+#pragma once
+
+#include "value.h"
+#include "ast.h"
+#include <vector>
+
+extern bool UseMemo;
+extern bool MemoStats;
+
+const unsigned int MemoEntries = 4096; // cache rows per function, a power of two
+const unsigned int MaxMemoArgs = 8; // functions with more arguments are not memoized
+
+typedef enum MemoState
+{
+    memo_off = 0, // not memoized; run the body as usual
+    memo_hit = 1, // Result holds the cached value
+    memo_miss = 2, // run the body, then hand the result to MemoEnd
+} memoState;
+
+/// Purity - what one function body needs besides itself to be pure: the
+/// script functions it calls. Anything that reaches outside the frame makes
+/// isPure fail on its own.
+class Purity
+{
+public:
+    std::vector<unsigned int> Callees; // indices into FuncTbl
+
+    bool isLocal(const VarRef& Ref);
+};
+
+void InvalidateMemo();
+
+bool MemoPure(FunctionAST& Fn);
+
+memoState MemoBegin(FunctionAST& Fn, unsigned int Base, double* Key, Value& Result);
+
+void MemoEnd(FunctionAST& Fn, const double* Key, Value Result);
+
+void PrintMemoStats();
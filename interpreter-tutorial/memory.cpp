@@ -0,0 +1,154 @@
+
+// MicroSEL
+// memory.cpp
+
+#include "memory.h"
+#include "ast.h"
+#include "interpreter.h"
+#include <climits>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+static size_t PageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO Info;
+    GetSystemInfo(&Info);
+    return Info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void Memory::release()
+{
+    if (Stack != nullptr)
+    {
+#ifdef _WIN32
+        VirtualFree(Stack, 0, MEM_RELEASE);
+#else
+        munmap(Stack, MapSize);
+#endif
+    }
+    Stack = nullptr;
+    Top = Committed = Capacity = 0;
+}
+
+/// reserve - maps a stack of Bytes bytes plus a guard page behind it. Only
+/// the pages the stack actually reaches are backed by physical memory. On
+/// Windows the region is only reserved here; grow commits it as the stack
+/// reaches it, so a --batch job is not charged for 256 MB it never uses.
+bool Memory::reserve(size_t Bytes)
+{
+    release();
+
+    size_t Values = Bytes / sizeof(Cell);
+    if (Values > UINT_MAX - 1) Values = UINT_MAX - 1;
+    size_t Page = PageSize();
+    size_t DataSize = (Values * sizeof(Cell) + Page - 1) / Page * Page;
+    MapSize = DataSize + Page;
+
+#ifdef _WIN32
+    void* Mem = VirtualAlloc(nullptr, MapSize, MEM_RESERVE, PAGE_NOACCESS);
+    if (Mem == nullptr) return false;
+#else
+    void* Mem = mmap(nullptr, MapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (Mem == MAP_FAILED) return false;
+    if (mprotect((char*)Mem + DataSize, Page, PROT_NONE) != 0)
+    {
+        munmap(Mem, MapSize);
+        return false;
+    }
+#endif
+
+    Stack = (Cell*)Mem;
+    Capacity = (unsigned int)Values;
+#ifndef _WIN32
+    Committed = Capacity; // the kernel backs pages as they are touched
+#endif
+    return true;
+}
+
+#ifdef _WIN32
+static const size_t CommitStep = (size_t)1 << 20; // bytes committed at a time
+#endif
+
+/// grow - makes room for Size more values above Top, or reports a stack
+/// overflow. Only Windows ever commits less than the whole region.
+bool Memory::grow(unsigned int Size)
+{
+    if (Size > Capacity - Top) return overflow();
+#ifdef _WIN32
+    size_t Step = CommitStep / sizeof(Cell);
+    size_t Need = ((size_t)Top + Size + Step - 1) / Step * Step;
+    if (Need > Capacity) Need = Capacity;
+    // Committed stays a multiple of Step, so the range starts on a page.
+    if (VirtualAlloc(Stack + Committed, (Need - Committed) * sizeof(Cell), MEM_COMMIT, PAGE_READWRITE) == nullptr)
+        return overflow(); // out of commit charge
+    Committed = (unsigned int)Need;
+#endif
+    return true;
+}
+
+bool Memory::overflow()
+{
+    LogError("Stack overflow");
+    return false;
+}
+
+//===----------------------------------------------------------------------===//
+// Native stack
+//===----------------------------------------------------------------------===//
+
+/// NativeStackSize - the size of the calling thread's stack.
+static size_t NativeStackSize()
+{
+#ifdef _WIN32
+    ULONG_PTR Low, High;
+    GetCurrentThreadStackLimits(&Low, &High);
+    return High - Low;
+#else
+#ifdef __linux__
+    // Threads other than the main one get their own, often smaller, stack.
+    pthread_attr_t Attr;
+    if (pthread_getattr_np(pthread_self(), &Attr) == 0)
+    {
+        size_t Size = 0;
+        pthread_attr_getstacksize(&Attr, &Size);
+        pthread_attr_destroy(&Attr);
+        if (Size != 0) return Size;
+    }
+#endif
+    struct rlimit Limit;
+    if (getrlimit(RLIMIT_STACK, &Limit) != 0 || Limit.rlim_cur == RLIM_INFINITY)
+        return (size_t)64 << 20;
+    return Limit.rlim_cur;
+#endif
+}
+
+/// MarkNativeStack - records the C++ stack depth script code starts from.
+/// Script calls may use three quarters of the C++ stack; the rest is left
+/// for the expressions and library calls between two checks.
+void MarkNativeStack()
+{
+    char Probe;
+    Interpreter& Interp = *CurInterp;
+    Interp.NativeBase = (uintptr_t)&Probe;
+    if (Interp.NativeBudget == 0) Interp.NativeBudget = NativeStackSize() / 4 * 3;
+}
+
+/// NativeStackExhausted - true once nested calls have used up the budget,
+/// so deep recursion in the tree walker or the JIT fails cleanly.
+bool NativeStackExhausted()
+{
+    char Probe;
+    return (intptr_t)(CurInterp->NativeBase - (uintptr_t)&Probe) > (intptr_t)CurInterp->NativeBudget;
+}
@@ -0,0 +1,66 @@
+
+// MicroSEL
+// memory.h
+
+#pragma once
+
+#include "value.h"
+#include <cstddef>
+
+const unsigned int DefaultStackMB = 256; // default size of the value stack
+
+/// Memory - the value stack every frame, array and global lives in, one
+/// Cell per value. The whole region is reserved once and followed by a
+/// guard page, so values never move, pages are only touched as the stack
+/// reaches them, and a scope is released by lowering Top.
+class Memory
+{
+    Cell* Stack = nullptr;
+    unsigned int Top = 0;
+    unsigned int Committed = 0; // values that may be used without grow()
+    unsigned int Capacity = 0;
+    size_t MapSize = 0;
+
+    bool grow(unsigned int Size);
+    bool overflow();
+    void release();
+
+public:
+    Memory() = default;
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+    ~Memory() { release(); }
+
+    bool reserve(size_t Bytes);
+
+    Value getValue(unsigned int Addr) { return Value(Stack[Addr]); }
+    void setValue(unsigned int Addr, Value Val) { Stack[Addr] = Val.getNum(); }
+    void deleteScope(unsigned int Addr) { if (Addr < Top) Top = Addr; }
+
+    /// push - appends Val; false after reporting a stack overflow.
+    bool push(Value Val)
+    {
+        if (Top == Committed && !grow(1)) return false;
+        Stack[Top++] = Val.getNum();
+        return true;
+    }
+
+    /// pushFrame - appends Size zeroed slots starting at Base; false after
+    /// reporting a stack overflow, with Base where the frame would have gone.
+    bool pushFrame(unsigned int Size, unsigned int& Base)
+    {
+        Base = Top;
+        if (Size > Committed - Top && !grow(Size)) return false;
+        for (unsigned int i = 0; i < Size; i++) Stack[Top + i] = 0;
+        Top += Size;
+        return true;
+    }
+
+    unsigned int getSize() { return Top; }
+    unsigned int getCapacity() { return Capacity; }
+    Cell* data() { return Stack; }
+};
+
+void MarkNativeStack();
+
+bool NativeStackExhausted();
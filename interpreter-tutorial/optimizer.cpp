@@ -0,0 +1,380 @@
+
+// MicroSEL
+// optimizer.cpp
+
+#include "optimizer.h"
+#include "interpreter.h"
+#include <cmath>
+#include <cstdio>
+
+bool UseFolding = true;
+bool DumpAst = false;
+
+static const char* BinOpNames[binop_count] = {
+    "", "=", "||", "&&", "==", "!=", "<", ">", "<=", ">=",
+    "+", "-", "*", "/", "%", "**",
+};
+
+bool Folder::isConst(ExprAST* E, double& Val)
+{
+    if (E->getNodeType() != node_number) return false;
+    Val = static_cast<NumberExprAST*>(E)->getNum();
+    return true;
+}
+
+/// isData - true for nodes whose value never carries a break or return,
+/// so they can replace an arithmetic node without changing control flow.
+bool Folder::isData(ExprAST* E)
+{
+    int Type = E->getNodeType();
+    return Type == node_number || Type == node_var || Type == node_deref;
+}
+
+ExprAST* Folder::number(double Val)
+{
+    return Nodes.make<NumberExprAST>(Value(Val));
+}
+
+/// scoped - a branch that replaces its IfExprAST keeps its own scope, so
+/// names it declares stay local to it.
+ExprAST* Folder::scoped(ExprAST* E)
+{
+    if (E->getNodeType() == node_number || E->getNodeType() == node_block) return E;
+    return Nodes.make<BlockExprAST>(Nodes.copyList(std::vector<ExprAST*>{ E }));
+}
+
+//===----------------------------------------------------------------------===//
+// Folding
+//===----------------------------------------------------------------------===//
+
+ExprAST* NumberExprAST::fold(Folder&)
+{
+    return this;
+}
+
+ExprAST* VariableExprAST::fold(Folder& F)
+{
+    for (auto& Idx : Indices) Idx = Idx->fold(F);
+    return this;
+}
+
+ExprAST* DeRefExprAST::fold(Folder& F)
+{
+    AddrExpr = AddrExpr->fold(F);
+    return this;
+}
+
+ExprAST* ArrDeclExprAST::fold(Folder&)
+{
+    return this;
+}
+
+ExprAST* UnaryExprAST::fold(Folder& F)
+{
+    // '&' needs the variable node itself; only its indices are folded.
+    if (Opcode == '&')
+    {
+        if (Operand->getNodeType() == node_var) Operand->fold(F);
+        return this;
+    }
+    Operand = Operand->fold(F);
+
+    double V;
+    if (F.isConst(Operand, V))
+    {
+        switch (Opcode)
+        {
+        case '!': return F.number(!V);
+        case '+': return F.number(+V);
+        case '-': return F.number(-V);
+        }
+    }
+    if (Opcode == '+' && F.isData(Operand)) return Operand;
+    return this;
+}
+
+ExprAST* BinaryExprAST::fold(Folder& F)
+{
+    RHS = RHS->fold(F);
+    if (Op == binop_assign)
+    {
+        if (LHS->getNodeType() == node_var || LHS->getNodeType() == node_deref) LHS->fold(F);
+        return this;
+    }
+    LHS = LHS->fold(F);
+
+    double L, R;
+    bool LC = F.isConst(LHS, L), RC = F.isConst(RHS, R);
+    if (LC && RC)
+    {
+        switch (Op)
+        {
+        case binop_eq: return F.number(L == R);
+        case binop_ne: return F.number(L != R);
+        case binop_lt: return F.number(L < R);
+        case binop_gt: return F.number(L > R);
+        case binop_le: return F.number(L <= R);
+        case binop_ge: return F.number(L >= R);
+        case binop_add: return F.number(L + R);
+        case binop_sub: return F.number(L - R);
+        case binop_mul: return F.number(L * R);
+        case binop_div: return F.number(L / R);
+        case binop_mod: return F.number(fmod(L, R));
+        case binop_pow: return F.number(pow(L, R));
+        default: return this;
+        }
+    }
+
+    // Only identities exact for every double, including -0, NaN and inf:
+    // x + 0 is +0 for x = -0, so only x + (-0) and x - 0 are dropped.
+    switch (Op)
+    {
+    case binop_add:
+        if (RC && R == 0 && std::signbit(R) && F.isData(LHS)) return LHS;
+        if (LC && L == 0 && std::signbit(L) && F.isData(RHS)) return RHS;
+        break;
+    case binop_sub:
+        if (RC && R == 0 && !std::signbit(R) && F.isData(LHS)) return LHS;
+        break;
+    case binop_mul:
+        if (RC && R == 1 && F.isData(LHS)) return LHS;
+        if (LC && L == 1 && F.isData(RHS)) return RHS;
+        break;
+    case binop_div:
+    case binop_pow:
+        if (RC && R == 1 && F.isData(LHS)) return LHS;
+        break;
+    default:
+        break;
+    }
+    return this;
+}
+
+ExprAST* LogicalExprAST::fold(Folder& F)
+{
+    LHS = LHS->fold(F);
+    RHS = RHS->fold(F);
+
+    double L, R;
+    if (!F.isConst(LHS, L)) return this;
+
+    // A constant LHS that decides the result means RHS never runs.
+    bool LV = L != 0;
+    if (LV == (Op == binop_or)) return F.number(LV);
+    if (F.isConst(RHS, R)) return F.number(R != 0);
+    return this;
+}
+
+ExprAST* CallExprAST::fold(Folder& F)
+{
+    for (auto& Arg : Args) Arg = Arg->fold(F);
+    return this;
+}
+
+ExprAST* IfExprAST::fold(Folder& F)
+{
+    CondExpr = CondExpr->fold(F);
+    ThenExpr = ThenExpr->fold(F);
+    if (ElseExpr != nullptr) ElseExpr = ElseExpr->fold(F);
+
+    double C;
+    if (!F.isConst(CondExpr, C)) return this;
+    if (C) return F.scoped(ThenExpr);
+    if (ElseExpr != nullptr) return F.scoped(ElseExpr);
+    return F.number(0);
+}
+
+ExprAST* ForExprAST::fold(Folder& F)
+{
+    Start = Start->fold(F);
+    End = End->fold(F);
+    if (Step) Step = Step->fold(F);
+    Body = Body->fold(F);
+    return this;
+}
+
+ExprAST* PforExprAST::fold(Folder& F)
+{
+    Start = Start->fold(F);
+    End = End->fold(F);
+    Body = Body->fold(F);
+    return this;
+}
+
+ExprAST* WhileExprAST::fold(Folder& F)
+{
+    Cond = Cond->fold(F);
+    Body = Body->fold(F);
+
+    double C;
+    if (F.isConst(Cond, C) && !C) return F.number(0);
+    return this;
+}
+
+ExprAST* BlockExprAST::fold(Folder& F)
+{
+    for (auto& Expr : Expressions) Expr = Expr->fold(F);
+    return this;
+}
+
+ExprAST* BreakExprAST::fold(Folder& F)
+{
+    Expr = Expr->fold(F);
+    return this;
+}
+
+ExprAST* ReturnExprAST::fold(Folder& F)
+{
+    Expr = Expr->fold(F);
+    return this;
+}
+
+//===----------------------------------------------------------------------===//
+// Dumping
+//===----------------------------------------------------------------------===//
+
+static void Indent(int Depth)
+{
+    fprintf(CurInterp->Err, "%*s", Depth * 2, "");
+}
+
+void NumberExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Number %g\n", Val.getNum());
+}
+
+void VariableExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Var %s%s\n", Name.c_str(), Indices.empty() ? "" : " []");
+    for (auto& Idx : Indices) Idx->dump(Depth + 1);
+}
+
+void DeRefExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "DeRef\n");
+    AddrExpr->dump(Depth + 1);
+}
+
+void ArrDeclExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "ArrDecl %s", Name.c_str());
+    for (int Dim : Shape.Dims) fprintf(CurInterp->Err, "[%d]", Dim);
+    fprintf(CurInterp->Err, "\n");
+}
+
+void UnaryExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Unary '%c'\n", Opcode);
+    Operand->dump(Depth + 1);
+}
+
+void BinaryExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Binary '%s'\n", BinOpNames[Op]);
+    LHS->dump(Depth + 1);
+    RHS->dump(Depth + 1);
+}
+
+void LogicalExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Logical '%s'\n", BinOpNames[Op]);
+    LHS->dump(Depth + 1);
+    RHS->dump(Depth + 1);
+}
+
+void CallExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Call %s\n", Callee.c_str());
+    for (auto& Arg : Args) Arg->dump(Depth + 1);
+}
+
+void IfExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "If\n");
+    CondExpr->dump(Depth + 1);
+    ThenExpr->dump(Depth + 1);
+    if (ElseExpr != nullptr) ElseExpr->dump(Depth + 1);
+}
+
+void ForExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "For %s\n", VarName.c_str());
+    Start->dump(Depth + 1);
+    End->dump(Depth + 1);
+    if (Step) Step->dump(Depth + 1);
+    Body->dump(Depth + 1);
+}
+
+void PforExprAST::dump(int Depth)
+{
+    static const char* Reductions[] = { "", "sum", "min", "max" };
+    Indent(Depth);
+    if (Reduce == reduce_none) fprintf(CurInterp->Err, "Pfor %s\n", VarName.c_str());
+    else fprintf(CurInterp->Err, "Pfor %s (%s %s)\n", VarName.c_str(), Reductions[Reduce], AccName.c_str());
+    Start->dump(Depth + 1);
+    End->dump(Depth + 1);
+    Body->dump(Depth + 1);
+}
+
+void WhileExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "While\n");
+    Cond->dump(Depth + 1);
+    Body->dump(Depth + 1);
+}
+
+void BlockExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Block\n");
+    for (auto& Expr : Expressions) Expr->dump(Depth + 1);
+}
+
+void BreakExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Break\n");
+    Expr->dump(Depth + 1);
+}
+
+void ReturnExprAST::dump(int Depth)
+{
+    Indent(Depth);
+    fprintf(CurInterp->Err, "Return\n");
+    Expr->dump(Depth + 1);
+}
+
+/// optimize - runs the folding pass; --dump-ast shows the tree before and
+/// after it.
+void FunctionAST::optimize()
+{
+    if (DumpAst)
+    {
+        fprintf(CurInterp->Err, "== %s (parsed) ==\n", Proto->getName().c_str());
+        Body->dump(0);
+    }
+
+    if (UseFolding)
+    {
+        Folder F(*Nodes);
+        Body = Body->fold(F);
+
+        if (DumpAst)
+        {
+            fprintf(CurInterp->Err, "== %s (folded) ==\n", Proto->getName().c_str());
+            Body->dump(0);
+        }
+    }
+    if (DumpAst) fprintf(CurInterp->Err, "\n");
+}
@@ -0,0 +1,27 @@
+
+// MicroSEL
+// optimizer.h
+
+#pragma once
+
+#include "ast.h"
+#include "arena.h"
+
+extern bool UseFolding;
+extern bool DumpAst;
+
+/// Folder - rewrites the AST of one unit before it is resolved. Constant
+/// subtrees become NumberExprAST nodes and identities that hold for every
+/// double are removed; replacement nodes come from the unit's own arena.
+class Folder
+{
+    Arena& Nodes;
+
+public:
+    Folder(Arena& Nodes) : Nodes(Nodes) {}
+
+    bool isConst(ExprAST* E, double& Val);
+    bool isData(ExprAST* E);
+    ExprAST* number(double Val);
+    ExprAST* scoped(ExprAST* E);
+};
@@ -4,80 +4,159 @@
 
 #include "lexer.h"
 #include "ast.h"
+#include "interpreter.h"
 #include <cstdio>
 #include <map>
 
-int CurTok;
-std::map<std::string, int> BinopPrecedence;
+// The parser state belongs to the thread parsing, so interpreters on
+// different threads can parse at the same time.
+thread_local int CurTok;
+thread_local Arena* CurArena; // owner of the nodes being parsed
 std::string OpChrList = "<>+-*/%!&|=";
 
-void InitBinopPrec()
+/// PrecTable - 이항 연산자의 우선순위 표. 컴파일 시간에 만들어지므로
+/// 실행 중에 초기화하거나 조회할 때 메모리를 할당하지 않는다.
+static constexpr struct PrecTable
 {
-    BinopPrecedence["**"] = 18 - 4; //   켱
-    BinopPrecedence["*"] = 18 - 5;
-    BinopPrecedence["/"] = 18 - 5;
-    BinopPrecedence["%"] = 18 - 5;
-    BinopPrecedence["+"] = 18 - 6;
-    BinopPrecedence["-"] = 18 - 6;
-    BinopPrecedence["<"] = 18 - 8;
-    BinopPrecedence[">"] = 18 - 8;
-    BinopPrecedence["<="] = 18 - 8;
-    BinopPrecedence[">="] = 18 - 8;
-    BinopPrecedence["=="] = 18 - 9;
-    BinopPrecedence["!="] = 18 - 9;
-    BinopPrecedence["&&"] = 18 - 13;
-    BinopPrecedence["||"] = 18 - 14;
-    BinopPrecedence["="] = 18 - 15; //   켱
+    int Prec[binop_count] = {}; // 0이면 이항 연산자가 아님
+
+    constexpr PrecTable()
+    {
+        Prec[binop_pow] = 18 - 4; // 가장 높은 우선순위
+        Prec[binop_mul] = 18 - 5;
+        Prec[binop_div] = 18 - 5;
+        Prec[binop_mod] = 18 - 5;
+        Prec[binop_add] = 18 - 6;
+        Prec[binop_sub] = 18 - 6;
+        Prec[binop_lt] = 18 - 8;
+        Prec[binop_gt] = 18 - 8;
+        Prec[binop_le] = 18 - 8;
+        Prec[binop_ge] = 18 - 8;
+        Prec[binop_eq] = 18 - 9;
+        Prec[binop_ne] = 18 - 9;
+        Prec[binop_and] = 18 - 13;
+        Prec[binop_or] = 18 - 14;
+        Prec[binop_assign] = 18 - 15; // 가장 낮은 우선순위
+    }
+} BinopPrecedence;
+
+static_assert(BinopPrecedence.Prec[binop_none] == 0, "binop_none must not bind");
+
+int GetNextToken(TokenStream& Toks)
+{
+    return CurTok = Toks.next().Kind;
 }
 
-int GetNextToken(const std::string& Code, int& Idx)
+/// GetBinOp - 토큰으로 이항 연산자를 판별한다.
+/// 문자 두 개로 이루어진 연산자는 렉서가 이미 하나의 토큰으로 합쳐 둔다.
+binOp GetBinOp(int Tok)
 {
-    return CurTok = GetTok(Code, Idx);
+    switch (Tok)
+    {
+    case '*': return binop_mul;
+    case '/': return binop_div;
+    case '%': return binop_mod;
+    case '+': return binop_add;
+    case '-': return binop_sub;
+    case '<': return binop_lt;
+    case '>': return binop_gt;
+    case '=': return binop_assign;
+    case tok_pow: return binop_pow;
+    case tok_le: return binop_le;
+    case tok_ge: return binop_ge;
+    case tok_eq: return binop_eq;
+    case tok_ne: return binop_ne;
+    case tok_and: return binop_and;
+    case tok_or: return binop_or;
+    default: return binop_none;
+    }
 }
 
-/// GetPrecedence -   켱 ´.
-int GetPrecedence(std::string Op)
+/// GetPrecedence - 이항 연산자의 우선순위를 얻는다.
+int GetPrecedence(binOp Op)
 {
-    int TokPrec = BinopPrecedence[Op];
+    int TokPrec = BinopPrecedence.Prec[Op];
 
     if (TokPrec <= 0) return -1;
     return TokPrec;
 }
 
-/// LogError* -  ڵ鸵 Լ.
-std::shared_ptr<ExprAST> LogError(const char* Str)
+/// New - allocates a node in the arena of the unit being parsed.
+template <typename T, typename... Args>
+static T* New(Args&&... A)
+{
+    return CurArena->make<T>(std::forward<Args>(A)...);
+}
+
+/// Located - 루프가 시작하는 위치를 기록한다. --profile이 루프를 이 위치로 부른다.
+template <typename Loop>
+static Loop* Located(Loop* L, unsigned int Line, unsigned int Col)
 {
-    fprintf(stderr, "Error: %s\n", Str);
+    L->Prof.Line = Line;
+    L->Prof.Col = Col;
+    return L;
+}
+
+/// ExprScratch - 파싱 중인 인덱스, 인자, 블록의 식들을 모아두는 공용 버퍼.
+/// 중첩된 목록은 버퍼 끝에 차례로 쌓였다가 아레나로 복사된 뒤 비워지므로,
+/// 버퍼가 한 번 커진 뒤로는 식을 파싱하면서 힙 메모리를 할당하지 않는다.
+static thread_local std::vector<ExprAST*> ExprScratch;
+
+/// ScratchList - ExprScratch 끝에 쌓이는 목록 하나.
+class ScratchList
+{
+    size_t Mark;
+
+public:
+    ScratchList() : Mark(ExprScratch.size()) {}
+    ~ScratchList() { ExprScratch.resize(Mark); }
+
+    void push_back(ExprAST* Expr) { ExprScratch.push_back(Expr); }
+    ExprList take() { return CurArena->copyList(ExprScratch.data() + Mark, ExprScratch.size() - Mark); }
+};
+
+/// LogError* - 에러 핸들링 함수들.
+ExprAST* LogError(const char* Str)
+{
+    // Only the first error of a unit is reported. The VM stops right there,
+    // while the tree walker and the JIT finish the expression they are in
+    // and may hit more errors; their output would differ otherwise.
+    if (Flow.Type == flow_err) return nullptr;
+
+    CurInterp->Errors++;
+    Flow.Type = flow_err; // stops whatever expression is running
+    fprintf(CurInterp->Err, "Error: %s\n", Str);
     return nullptr;
 }
 
-std::shared_ptr<PrototypeAST> LogErrorP(const char* Str)
+PrototypeAST* LogErrorP(const char* Str)
 {
     LogError(Str);
     return nullptr;
 }
 
 /// numberexpr ::= number
-std::shared_ptr<ExprAST> ParseNumberExpr(const std::string& Code, int& Idx)
+ExprAST* ParseNumberExpr(TokenStream& Toks)
 {
-    // Լ ȣ   ū .
-    GetNextToken(Code, Idx); //  ū Һϰ  ū ̸ ޾Ƶд.
+    // 함수 호출 시점에서 현재 토큰은 숫자.
+    double NumVal = Toks.getNum();
+    GetNextToken(Toks); // 현재 토큰을 소비하고 다음 토큰을 미리 받아둔다.
 
-    return std::make_shared<NumberExprAST>(Value(NumVal));
+    return New<NumberExprAST>(Value(NumVal));
 }
 
 /// parenexpr ::= '(' expression ')'
-std::shared_ptr<ExprAST> ParseParenExpr(const std::string& Code, int& Idx)
+ExprAST* ParseParenExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat '('.
+    GetNextToken(Toks); // eat '('.
 
-    auto Expr = ParseExpression(Code, Idx);
+    auto Expr = ParseExpression(Toks);
     if (!Expr) return nullptr;
 
     if (CurTok != ')')
         return LogError("Expected ')'");
 
-    GetNextToken(Code, Idx); // eat ')'.
+    GetNextToken(Toks); // eat ')'.
 
     return Expr;
 }
@@ -86,56 +165,56 @@ std::shared_ptr<ExprAST> ParseParenExpr(const std::string& Code, int& Idx)
 ///   ::= identifier
 ///   ::= identifier ('[' expression ']')+
 ///   ::= identifier '(' expression* ')'
-std::shared_ptr<ExprAST> ParseIdentifierExpr(const std::string& Code, int& Idx)
+ExprAST* ParseIdentifierExpr(TokenStream& Toks)
 {
-    std::string IdName = IdStr;
+    const std::string& IdName = Toks.getName(); // 이름 테이블의 문자열은 옮겨지지 않음
 
-    GetNextToken(Code, Idx); // eat identifier.
+    GetNextToken(Toks); // eat identifier.
 
-    // ĺ ڿ '('  Լ ȣ .
-    // ׷   迭   .
+    // 식별자 뒤에 '('가 있으면 함수 호출로 취급.
+    // 그렇지 않으면 변수나 배열 원소 참조로 취급.
     if (CurTok != '(')
     {
-        //  
+        // 변수 참조
         if (CurTok != '[')
-            return std::make_shared<VariableExprAST>(IdName);
+            return New<VariableExprAST>(IdName);
 
-        // 迭  
-        GetNextToken(Code, Idx); // eat '['.
+        // 배열 원소 참조
+        GetNextToken(Toks); // eat '['.
 
-        std::vector<std::shared_ptr<ExprAST>> Indices;
+        ScratchList Indices;
         if (CurTok != ']')
         {
             while (true)
             {
-                if (auto ArrIdx = ParseExpression(Code, Idx))
-                    Indices.push_back(std::move(ArrIdx));
+                if (auto ArrIdx = ParseExpression(Toks))
+                    Indices.push_back(ArrIdx);
                 else return nullptr;
 
                 if (CurTok == ']')
                 {
-                    GetNextToken(Code, Idx); // eat ']'.
+                    GetNextToken(Toks); // eat ']'.
 
-                    if (CurTok != '[') break; // ε  ̻ ־ ʴ 
-                    else GetNextToken(Code, Idx); // ε  ־ 
+                    if (CurTok != '[') break; // 인덱스가 더 이상 주어지지 않는 경우
+                    else GetNextToken(Toks); // 인덱스가 계속 주어지는 경우
                 }
             }
         }
         else return LogError("Array index missing");
 
-        return std::make_shared<VariableExprAST>(IdName, std::move(Indices));
+        return New<VariableExprAST>(IdName, Indices.take());
     }
 
-    // Լ ȣϴ 
-    GetNextToken(Code, Idx); // eat '('.
+    // 함수를 호출하는 경우
+    GetNextToken(Toks); // eat '('.
 
-    std::vector<std::shared_ptr<ExprAST>> Args;
+    ScratchList Args;
     if (CurTok != ')')
     {
         while (true)
         {
-            if (auto Arg = ParseExpression(Code, Idx))
-                Args.push_back(std::move(Arg));
+            if (auto Arg = ParseExpression(Toks))
+                Args.push_back(Arg);
             else return nullptr;
 
             if (CurTok == ')') break;
@@ -143,176 +222,242 @@ std::shared_ptr<ExprAST> ParseIdentifierExpr(const std::string& Code, int& Idx)
             if (CurTok != ',')
                 return LogError("Expected ')' or ',' in argument list");
 
-            GetNextToken(Code, Idx);
+            GetNextToken(Toks);
         }
     }
     // eat ')'.
-    GetNextToken(Code, Idx);
+    GetNextToken(Toks);
 
-    return std::make_shared<CallExprAST>(IdName, std::move(Args));
+    return New<CallExprAST>(IdName, Args.take());
 }
 
 /// derefexpr
 ///   ::= '@' expression
-std::shared_ptr<ExprAST> ParseDeRefExpr(const std::string& Code, int& Idx)
+ExprAST* ParseDeRefExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat '@'.
+    GetNextToken(Toks); // eat '@'.
 
-    auto Primary = ParsePrimary(Code, Idx);
+    auto Primary = ParsePrimary(Toks);
     if (!Primary) return nullptr;
 
-    return std::make_shared<DeRefExprAST>(std::move(Primary));
+    return New<DeRefExprAST>(Primary);
 }
 
 /// arrdeclexpr ::= 'arr' identifier ('[' number ']')+
-std::shared_ptr<ExprAST> ParseArrDeclExpr(const std::string& Code, int& Idx)
+ExprAST* ParseArrDeclExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat "arr".
+    GetNextToken(Toks); // eat "arr".
 
-    std::string IdName = IdStr;
-    GetNextToken(Code, Idx); // eat identifier string.
+    if (CurTok != tok_identifier) return LogError("Expected array name after 'arr'");
+    std::string IdName = Toks.getName();
+    GetNextToken(Toks); // eat identifier string.
 
     if (CurTok != '[') return LogError("Expected '[' after array name");
 
-    GetNextToken(Code, Idx); // eat '['.
+    GetNextToken(Toks); // eat '['.
 
     std::vector<int> Indices;
     if (CurTok != ']')
     {
         while (true)
         {
-            // 迭   ʺ 1 ̻ ̾ .
-            //  ( δ Ǽ ) 1 ̻  üũ.
-            if (CurTok == tok_number && trunc(NumVal) == NumVal && (int)NumVal >= 1)
-                Indices.push_back((int)NumVal);
+            // 배열의 각 차원의 너비는 1 이상의 정수이어야 함.
+            // 값이 (비록 내부적으로는 실수형으로 저장되지만) 1 이상의 정수인지 체크함.
+            if (CurTok == tok_number && trunc(Toks.getNum()) == Toks.getNum() && (int)Toks.getNum() >= 1)
+                Indices.push_back((int)Toks.getNum());
             else return LogError("Length of each dimension must be an integer 1 or higher");
             
-            GetNextToken(Code, Idx);
+            GetNextToken(Toks);
 
             if (CurTok == ']')
             {
-                if (LastChar != '[') break; //    ̻ ־ ʴ 
+                // 바로 뒤에 '['가 붙어 있지 않으면 차원 정보가 더 이상 주어지지 않는 경우
+                const Lexeme& Next = Toks.peek(1);
+                if (Next.Kind != '[' || Next.Offset != Toks.peek().Offset + 1) break;
 
-                GetNextToken(Code, Idx); // eat ']'.
-                GetNextToken(Code, Idx); // eat '['.
+                GetNextToken(Toks); // eat ']'.
+                GetNextToken(Toks); // eat '['.
             }
         }
     }
     else return LogError("Array dimension missing");
 
-    GetNextToken(Code, Idx);
+    GetNextToken(Toks);
 
-    return std::make_shared<ArrDeclExprAST>(IdName, std::move(Indices));
+    return New<ArrDeclExprAST>(IdName, std::move(Indices));
 }
 
 /// ifexpr ::= 'if' expression 'then' blockexpr 'else' blockexpr
-std::shared_ptr<ExprAST> ParseIfExpr(const std::string& Code, int& Idx)
+ExprAST* ParseIfExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat "if".
+    GetNextToken(Toks); // eat "if".
 
-    auto Cond = ParseExpression(Code, Idx);
+    auto Cond = ParseExpression(Toks);
     if (!Cond) return nullptr;
 
     if (CurTok != tok_then)
         return LogError("Expected then");
 
-    GetNextToken(Code, Idx); // eat "then".
+    GetNextToken(Toks); // eat "then".
 
-    auto Then = ParseBlockExpression(Code, Idx);
+    auto Then = ParseBlockExpression(Toks);
     if (!Then) return nullptr;
 
     // else expression is optional.
     if (CurTok == tok_else)
     {
-        GetNextToken(Code, Idx); // eat "else".
+        GetNextToken(Toks); // eat "else".
 
-        auto Else = ParseBlockExpression(Code, Idx);
+        auto Else = ParseBlockExpression(Toks);
         if (!Else) return nullptr;
 
-        return std::make_shared<IfExprAST>(std::move(Cond), std::move(Then),
-            std::move(Else));
+        return New<IfExprAST>(Cond, Then,
+            Else);
     }
-    return std::make_shared<IfExprAST>(std::move(Cond), std::move(Then));
+    return New<IfExprAST>(Cond, Then);
 }
 
 /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? blockexpr
-std::shared_ptr<ExprAST> ParseForExpr(const std::string& Code, int& Idx)
+ExprAST* ParseForExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat "for".
+    unsigned int Line, Col;
+    Toks.locate(Line, Col);
+    GetNextToken(Toks); // eat "for".
 
     if (CurTok != tok_identifier)
         return LogError("Expected identifier");
 
-    std::string IdName = IdStr;
-    GetNextToken(Code, Idx); // eat identifier string.
+    std::string IdName = Toks.getName();
+    GetNextToken(Toks); // eat identifier string.
 
     if (CurTok != '=')
         return LogError("Expected '=' after identifier");
-    GetNextToken(Code, Idx); // eat '='.
+    GetNextToken(Toks); // eat '='.
 
-    auto Start = ParseExpression(Code, Idx);
+    auto Start = ParseExpression(Toks);
     if (!Start) return nullptr;
 
     if (CurTok != ',')
         return LogError("Expected ','");
-    GetNextToken(Code, Idx);
+    GetNextToken(Toks);
 
-    auto End = ParseExpression(Code, Idx);
+    auto End = ParseExpression(Toks);
     if (!End) return nullptr;
 
     // step value is optional.
-    std::shared_ptr<ExprAST> Step;
+    ExprAST* Step = nullptr;
     if (CurTok == ',')
     {
-        GetNextToken(Code, Idx);
+        GetNextToken(Toks);
 
-        Step = ParseExpression(Code, Idx);
+        Step = ParseExpression(Toks);
         if (!Step) return nullptr;
     }
 
-    auto Body = ParseBlockExpression(Code, Idx);
+    auto Body = ParseBlockExpression(Toks);
+    if (!Body) return nullptr;
+
+    return Located(New<ForExprAST>(IdName, Start, End,
+        Step, Body), Line, Col);
+}
+
+/// pforexpr ::= 'pfor' identifier '=' expr ',' expr (':' reduceop identifier)? blockexpr
+/// reduceop ::= 'sum' | 'min' | 'max'
+ExprAST* ParsePforExpr(TokenStream& Toks)
+{
+    unsigned int Line, Col;
+    Toks.locate(Line, Col);
+    GetNextToken(Toks); // eat "pfor".
+
+    if (CurTok != tok_identifier)
+        return LogError("Expected identifier");
+
+    std::string IdName = Toks.getName();
+    GetNextToken(Toks); // eat identifier string.
+
+    if (CurTok != '=')
+        return LogError("Expected '=' after identifier");
+    GetNextToken(Toks); // eat '='.
+
+    auto Start = ParseExpression(Toks);
+    if (!Start) return nullptr;
+
+    if (CurTok != ',')
+        return LogError("Expected ','");
+    GetNextToken(Toks);
+
+    auto End = ParseExpression(Toks);
+    if (!End) return nullptr;
+
+    // 리덕션은 생략할 수 있음.
+    reduceOp Reduce = reduce_none;
+    std::string AccName;
+    if (CurTok == ':')
+    {
+        GetNextToken(Toks); // eat ':'.
+
+        if (CurTok == tok_identifier)
+        {
+            const std::string& OpName = Toks.getName();
+            if (OpName == "sum") Reduce = reduce_sum;
+            else if (OpName == "min") Reduce = reduce_min;
+            else if (OpName == "max") Reduce = reduce_max;
+        }
+        if (Reduce == reduce_none)
+            return LogError("Expected sum, min or max after ':'");
+        GetNextToken(Toks); // eat reduction.
+
+        if (CurTok != tok_identifier)
+            return LogError("Expected the name of the reduction variable");
+        AccName = Toks.getName();
+        GetNextToken(Toks); // eat identifier string.
+    }
+
+    auto Body = ParseBlockExpression(Toks);
     if (!Body) return nullptr;
 
-    return std::make_shared<ForExprAST>(IdName, std::move(Start), std::move(End),
-        std::move(Step), std::move(Body));
+    return Located(New<PforExprAST>(IdName, Start, End,
+        Reduce, AccName, Body), Line, Col);
 }
 
 /// whileexpr ::= 'while' expr blockexpr
-std::shared_ptr<ExprAST> ParseWhileExpr(const std::string& Code, int& Idx)
+ExprAST* ParseWhileExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat "while".
+    unsigned int Line, Col;
+    Toks.locate(Line, Col);
+    GetNextToken(Toks); // eat "while".
 
-    auto Cond = ParseExpression(Code, Idx);
+    auto Cond = ParseExpression(Toks);
     if (!Cond) return nullptr;
 
-    auto Body = ParseBlockExpression(Code, Idx);
+    auto Body = ParseBlockExpression(Toks);
     if (!Body) return nullptr;
 
-    return std::make_shared<WhileExprAST>(std::move(Cond), std::move(Body));
+    return Located(New<WhileExprAST>(Cond, Body), Line, Col);
 }
 
 /// breakexpr
 ///   ::= 'break' expr
-std::shared_ptr<ExprAST> ParseBreakExpr(const std::string& Code, int& Idx)
+ExprAST* ParseBreakExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat "break".
+    GetNextToken(Toks); // eat "break".
 
-    auto Expr = ParseExpression(Code, Idx);
+    auto Expr = ParseExpression(Toks);
     if (!Expr) return nullptr;
 
-    return std::make_shared<BreakExprAST>(std::move(Expr));
+    return New<BreakExprAST>(Expr);
 }
 
 /// returnexpr
 ///   ::= 'return' expr
-std::shared_ptr<ExprAST> ParseReturnExpr(const std::string& Code, int& Idx)
+ExprAST* ParseReturnExpr(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat "return".
+    GetNextToken(Toks); // eat "return".
 
-    auto Expr = ParseExpression(Code, Idx);
+    auto Expr = ParseExpression(Toks);
     if (!Expr) return nullptr;
 
-    return std::make_shared<ReturnExprAST>(std::move(Expr));
+    return New<ReturnExprAST>(Expr);
 }
 
 /// primary
@@ -322,27 +467,30 @@ std::shared_ptr<ExprAST> ParseReturnExpr(const std::string& Code, int& Idx)
 ///   ::= parenexpr
 ///   ::= ifexpr
 ///   ::= forexpr
+///   ::= pforexpr
 ///   ::= whileexpr
 ///   ::= reptexpr
 ///   ::= loopexpr
-std::shared_ptr<ExprAST> ParsePrimary(const std::string& Code, int& Idx)
+ExprAST* ParsePrimary(TokenStream& Toks)
 {
     switch (CurTok)
     {
     case tok_identifier:
-        return ParseIdentifierExpr(Code, Idx);
+        return ParseIdentifierExpr(Toks);
     case '@':
-        return ParseDeRefExpr(Code, Idx);
+        return ParseDeRefExpr(Toks);
     case tok_number:
-        return ParseNumberExpr(Code, Idx);
+        return ParseNumberExpr(Toks);
     case tok_for:
-        return ParseForExpr(Code, Idx);
+        return ParseForExpr(Toks);
     case tok_while:
-        return ParseWhileExpr(Code, Idx);
+        return ParseWhileExpr(Toks);
+    case tok_pfor:
+        return ParsePforExpr(Toks);
     case tok_if:
-        return ParseIfExpr(Code, Idx);
+        return ParseIfExpr(Toks);
     case '(':
-        return ParseParenExpr(Code, Idx);
+        return ParseParenExpr(Toks);
     default:
         return LogError("Unknown token when expecting an expression");
     }
@@ -351,85 +499,70 @@ std::shared_ptr<ExprAST> ParsePrimary(const std::string& Code, int& Idx)
 /// unary
 ///   ::= primary
 ///   ::= unaryop unary
-std::shared_ptr<ExprAST> ParseUnary(const std::string& Code, int& Idx)
+ExprAST* ParseUnary(TokenStream& Toks)
 {
     // If the current token is not an operator, it must be a primary expr.
     if (!isascii(CurTok) || CurTok == '(' || CurTok == ',' || CurTok == '@')
-        return ParsePrimary(Code, Idx);
+        return ParsePrimary(Toks);
 
     // If this is a unary operator, read it.
     int Opc;
     if (OpChrList.find(CurTok) != std::string::npos)
     {
         Opc = CurTok;
-        GetNextToken(Code, Idx);
+        GetNextToken(Toks);
     }
     else return LogError(((std::string)"Unknown token '" + (char)CurTok + (std::string)"'").c_str());
 
-    if (auto Operand = ParseUnary(Code, Idx))
-        return std::make_shared<UnaryExprAST>(Opc, std::move(Operand));
+    if (auto Operand = ParseUnary(Toks))
+        return New<UnaryExprAST>(Opc, Operand);
     return nullptr;
 }
 
 /// binoprhs
 ///   ::= (binop unary)*
-std::shared_ptr<ExprAST> ParseBinOpRHS(const std::string& Code, int& Idx, int ExprPrec, std::shared_ptr<ExprAST> LHS)
+ExprAST* ParseBinOpRHS(TokenStream& Toks, int ExprPrec, ExprAST* LHS)
 {
     while (true)
     {
-        bool DoubleCh = false;
-        std::string BinOp;
-        BinOp += (char)CurTok;
-
-        //  ڰ    ̷ 
-        if (OpChrList.find(CurTok) != std::string::npos &&
-            OpChrList.find(LastChar) != std::string::npos)
-        {
-            BinOp += (char)LastChar;
-            DoubleCh = true;
-        }
-        int TokPrec = GetPrecedence(BinOp); //   켱 
+        binOp BinOp = GetBinOp(CurTok);
+        int TokPrec = GetPrecedence(BinOp); // 이항 연산자의 우선순위 얻기
 
-        // Ӱ   (BinOp) ù ° Ľ̵  ̰ų,
-        // 켱   ں    .
-        // ׷  LHS ϰ Ż.
+        // 새롭게 얻은 이항 연산자(BinOp)가 첫 번째로 파싱된 이항 연산자이거나,
+        // 우선순위가 이전의 이항 연산자보다 높은 경우 계속 진행함.
+        // 그렇지 않으면 LHS를 리턴하고 탈출함.
         if (TokPrec <= ExprPrec) return LHS;
 
-        GetNextToken(Code, Idx);
-        if (DoubleCh) GetNextToken(Code, Idx);
+        GetNextToken(Toks);
 
-        //    ġϴ ׽ м
-        auto RHS = ParseUnary(Code, Idx);
+        // 이항 연산자 우측에 위치하는 단항식 분석
+        auto RHS = ParseUnary(Toks);
         if (!RHS) return nullptr;
 
-        //    ·  Ǿ Ѵ.
-        // , (a + b) binop rhs  a + (b binop rhs)  ϳ̾ Ѵ.
-        //   ׽     NextOp ̸ ȮϿ
-        // 켱  ؾ Ѵ.
+        // 이제 식이 어떠한 형태로 묶일지 결정되어야 한다.
+        // 예컨대, (a + b) binop rhs 와 a + (b binop rhs) 중 하나이어야 한다.
+        // 따라서 우측 단항식 다음에 올 이항 연산자 NextOp를 미리 확인하여
+        // 우선 순위를 비교해야 한다.
         
-        std::string NextOp;
-        NextOp += (char)CurTok;
-
-        if (OpChrList.find(CurTok) != std::string::npos &&
-            OpChrList.find(LastChar) != std::string::npos)
-        {
-            NextOp += (char)LastChar;
-        }
+        binOp NextOp = GetBinOp(CurTok);
 
         int NextPrec = GetPrecedence(NextOp);
 
-        // NextOp BinOp 켱   ,
-        //  a + (b binop rhs)   ·  Ѵ. ex) a + (b * rhs)
+        // NextOp가 BinOp의 우선 순위보다 높은 경우,
+        // 식은 a + (b binop rhs) 와 같은 형태로 묶여야 한다. ex) a + (b * rhs)
         if (TokPrec < NextPrec)
         {
-            RHS = ParseBinOpRHS(Code, Idx, TokPrec, std::move(RHS));
+            RHS = ParseBinOpRHS(Toks, TokPrec, RHS);
             if (!RHS) return nullptr;
         }
 
-        // NextOp BinOp 켱   ,
-        //  (a + b) binop rhs   ·  Ѵ.
-        // LHS RHS ϰ  ĽѴ. ex) (a + b) || rhs
-        LHS = std::make_shared<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
+        // NextOp가 BinOp의 우선 순위보다 낮은 경우,
+        // 식은 (a + b) binop rhs 와 같은 형태로 묶여야 한다.
+        // LHS와 RHS를 병합하고 계속 파싱한다. ex) (a + b) || rhs
+        if (BinOp == binop_and || BinOp == binop_or)
+            LHS = New<LogicalExprAST>(BinOp, LHS, RHS);
+        else
+            LHS = New<BinaryExprAST>(BinOp, LHS, RHS);
     }
 }
 
@@ -438,60 +571,61 @@ std::shared_ptr<ExprAST> ParseBinOpRHS(const std::string& Code, int& Idx, int Ex
 ///   ::= arrdeclexpr
 ///   ::= breakexpr
 ///   ::= returnexpr
-std::shared_ptr<ExprAST> ParseExpression(const std::string& Code, int& Idx)
+ExprAST* ParseExpression(TokenStream& Toks)
 {
     switch (CurTok)
     {
     case tok_arr:
-        return ParseArrDeclExpr(Code, Idx);
+        return ParseArrDeclExpr(Toks);
     case tok_break:
-        return ParseBreakExpr(Code, Idx);
+        return ParseBreakExpr(Toks);
     case tok_return:
-        return ParseReturnExpr(Code, Idx);
+        return ParseReturnExpr(Toks);
     default:
-        auto LHS = ParseUnary(Code, Idx);
+        auto LHS = ParseUnary(Toks);
         if (!LHS) return nullptr;
-        return ParseBinOpRHS(Code, Idx, 0, std::move(LHS));
+        return ParseBinOpRHS(Toks, 0, LHS);
     }
 }
 
 /// blockexpr
 ///   ::= expression
 ///   ::= '{' expression+ '}'
-std::shared_ptr<ExprAST> ParseBlockExpression(const std::string& Code, int& Idx)
+ExprAST* ParseBlockExpression(TokenStream& Toks)
 {
     if (CurTok != tok_openblock)
-        return ParseExpression(Code, Idx);
+        return ParseExpression(Toks);
 
-    GetNextToken(Code, Idx);
+    GetNextToken(Toks);
 
-    std::vector<std::shared_ptr<ExprAST>> ExprSeq;
+    ScratchList ExprSeq;
     while (true)
     {
-        auto Expr = ParseBlockExpression(Code, Idx);
-        ExprSeq.push_back(std::move(Expr));
+        auto Expr = ParseBlockExpression(Toks);
+        if (!Expr) return nullptr;
+        ExprSeq.push_back(Expr);
 
         if (CurTok == ';')
-            GetNextToken(Code, Idx);
+            GetNextToken(Toks);
 
         if (CurTok == tok_closeblock)
         {
-            GetNextToken(Code, Idx);
+            GetNextToken(Toks);
             break;
         }
     }
-    return std::make_shared<BlockExprAST>(ExprSeq);
+    return New<BlockExprAST>(ExprSeq.take());
 }
 
 /// prototype
 ///   ::= id '(' id* ')'
-std::shared_ptr<PrototypeAST> ParsePrototype(const std::string& Code, int& Idx)
+PrototypeAST* ParsePrototype(TokenStream& Toks)
 {
     std::string FnName;
     if (CurTok == tok_identifier)
     {
-        FnName = IdStr;
-        GetNextToken(Code, Idx);
+        FnName = Toks.getName();
+        GetNextToken(Toks);
     }
     else return LogErrorP("Expected function name in prototype");
 
@@ -499,47 +633,52 @@ std::shared_ptr<PrototypeAST> ParsePrototype(const std::string& Code, int& Idx)
         return LogErrorP("Expected '(' in prototype");
 
     std::vector<std::string> ArgNames;
-    if (GetNextToken(Code, Idx) != ')')
+    if (GetNextToken(Toks) != ')')
     {
         while (true)
         {
             if (CurTok == tok_identifier)
-                ArgNames.push_back(IdStr);
+                ArgNames.push_back(Toks.getName());
 
-            GetNextToken(Code, Idx);
+            GetNextToken(Toks);
             if (CurTok == ')') break;
             if (CurTok != ',')
                 return LogErrorP("Expected ',' or ')'");
 
-            GetNextToken(Code, Idx);
+            GetNextToken(Toks);
         }
     }
-    GetNextToken(Code, Idx); // eat ')'.
+    GetNextToken(Toks); // eat ')'.
 
-    return std::make_shared<PrototypeAST>(FnName, ArgNames);
+    return New<PrototypeAST>(FnName, ArgNames);
 }
 
 /// definition ::= 'func' prototype expression
-std::shared_ptr<FunctionAST> ParseDefinition(const std::string& Code, int& Idx)
+std::shared_ptr<FunctionAST> ParseDefinition(TokenStream& Toks)
 {
-    GetNextToken(Code, Idx); // eat "func".
+    auto Nodes = std::unique_ptr<Arena>(new Arena());
+    CurArena = Nodes.get();
 
-    auto Proto = ParsePrototype(Code, Idx);
+    GetNextToken(Toks); // eat "func".
+
+    auto Proto = ParsePrototype(Toks);
     if (!Proto) return nullptr;
 
-    if (auto BlockExpr = ParseBlockExpression(Code, Idx))
-        return std::make_shared<FunctionAST>(std::move(Proto), std::move(BlockExpr));
+    if (auto BlockExpr = ParseBlockExpression(Toks))
+        return std::make_shared<FunctionAST>(std::move(Nodes), Proto, BlockExpr);
     return nullptr;
 }
 
 /// toplevelexpr ::= expression
-std::shared_ptr<FunctionAST> ParseTopLevelExpr(const std::string& Code, int& Idx)
+std::shared_ptr<FunctionAST> ParseTopLevelExpr(TokenStream& Toks)
 {
-    if (auto BlockExpr = ParseBlockExpression(Code, Idx)) {
+    auto Nodes = std::unique_ptr<Arena>(new Arena());
+    CurArena = Nodes.get();
+
+    if (auto BlockExpr = ParseBlockExpression(Toks)) {
         // Make an anonymous proto.
-        auto Proto = std::make_shared<PrototypeAST>("__anon_expr",
-            std::vector<std::string>());
-        return std::make_shared<FunctionAST>(std::move(Proto), std::move(BlockExpr));
+        auto Proto = New<PrototypeAST>("__anon_expr", std::vector<std::string>());
+        return std::make_shared<FunctionAST>(std::move(Nodes), Proto, BlockExpr);
     }
     return nullptr;
-}
\ No newline at end of file
+}
@@ -0,0 +1,288 @@
+// MicroSEL
+// pfor.cpp
+
+#include "pfor.h"
+#include "execute.h"
+#include "jit.h"
+#include "profile.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+unsigned int PforThreads = 0;
+
+const size_t ChunksPerWorker = 8; // chunks dealt to each worker before stealing starts
+
+//===----------------------------------------------------------------------===//
+// Worker pool
+//===----------------------------------------------------------------------===//
+
+PforPool::PforPool(unsigned int Threads)
+{
+    for (unsigned int i = 1; i < Threads; i++)
+        Helpers.emplace_back(&PforPool::helper, this, i);
+}
+
+PforPool::~PforPool()
+{
+    {
+        std::lock_guard<std::mutex> Lock(M);
+        Quit = true;
+    }
+    Wake.notify_all();
+    for (auto& T : Helpers) T.join();
+}
+
+void PforPool::helper(unsigned int Id)
+{
+    unsigned long long Seen = 0;
+    std::unique_lock<std::mutex> Lock(M);
+    while (true)
+    {
+        Wake.wait(Lock, [&] { return Quit || Round != Seen; });
+        if (Quit) return;
+        Seen = Round;
+        if (Id >= Workers) continue;
+
+        const std::function<void(unsigned int)>* Fn = Job;
+        Lock.unlock();
+        (*Fn)(Id);
+        Lock.lock();
+        if (--Busy == 0) Done.notify_one();
+    }
+}
+
+/// run - calls Fn(0) on this thread and Fn(1) .. Fn(Count - 1) on helpers.
+void PforPool::run(unsigned int Count, const std::function<void(unsigned int)>& Fn)
+{
+    {
+        std::lock_guard<std::mutex> Lock(M);
+        Job = &Fn;
+        Workers = Count;
+        Busy = Count - 1;
+        Round++;
+    }
+    Wake.notify_all();
+
+    Fn(0);
+
+    std::unique_lock<std::mutex> Lock(M);
+    Done.wait(Lock, [&] { return Busy == 0; });
+    Job = nullptr;
+}
+
+/// PforWorkers - how many threads a parallel pfor uses.
+unsigned int PforWorkers()
+{
+    unsigned int Threads = PforThreads ? PforThreads : std::thread::hardware_concurrency();
+    return Threads ? Threads : 1;
+}
+
+//===----------------------------------------------------------------------===//
+// Work stealing
+//===----------------------------------------------------------------------===//
+
+/// ChunkQueue - the chunks a worker has left. The owner takes them from the
+/// front; a worker that has run out steals from the back, so the two seldom
+/// want the same chunk.
+struct alignas(64) ChunkQueue
+{
+    std::mutex M;
+    size_t Front = 0, Back = 0;
+};
+
+/// ChunkQueues - the iterations of one parallel pfor cut into chunks, dealt
+/// out to the workers in contiguous runs so that each starts on its own
+/// part of the arrays.
+class ChunkQueues
+{
+    std::unique_ptr<ChunkQueue[]> Queues;
+    unsigned int Workers;
+
+    static bool take(ChunkQueue& Q, bool Steal, size_t& Chunk)
+    {
+        std::lock_guard<std::mutex> Lock(Q.M);
+        if (Q.Front == Q.Back) return false;
+        Chunk = Steal ? --Q.Back : Q.Front++;
+        return true;
+    }
+
+public:
+    size_t ChunkSize;
+
+    ChunkQueues(size_t N, unsigned int Workers) : Queues(new ChunkQueue[Workers]), Workers(Workers)
+    {
+        ChunkSize = std::max<size_t>(1, N / ((size_t)Workers * ChunksPerWorker));
+        size_t Chunks = (N + ChunkSize - 1) / ChunkSize;
+        for (unsigned int w = 0; w < Workers; w++)
+        {
+            Queues[w].Front = Chunks * w / Workers;
+            Queues[w].Back = Chunks * (w + 1) / Workers;
+        }
+    }
+
+    /// next - the next chunk for worker W, stolen from another worker once
+    /// its own queue is empty; false when no chunks are left anywhere.
+    bool next(unsigned int W, size_t& Chunk)
+    {
+        if (take(Queues[W], false, Chunk)) return true;
+        for (unsigned int k = 1; k < Workers; k++)
+            if (take(Queues[(W + k) % Workers], true, Chunk)) return true;
+        return false;
+    }
+};
+
+//===----------------------------------------------------------------------===//
+// pfor
+//===----------------------------------------------------------------------===//
+
+static double Identity(reduceOp Op)
+{
+    switch (Op)
+    {
+    case reduce_min: return HUGE_VAL;
+    case reduce_max: return -HUGE_VAL;
+    default: return 0;
+    }
+}
+
+static double Combine(reduceOp Op, double Acc, double Val)
+{
+    switch (Op)
+    {
+    case reduce_sum: return Acc + Val;
+    case reduce_min: return Val < Acc ? Val : Acc;
+    case reduce_max: return Val > Acc ? Val : Acc;
+    default: return Acc;
+    }
+}
+
+/// CallsScript - links the calls of a pfor body and tells whether one of
+/// them calls a script function. Script calls push frames on the value
+/// stack, which only the interpreter's own thread may grow, so such a loop
+/// runs on that thread alone.
+static bool CallsScript(const std::vector<CallLink*>& Calls)
+{
+    for (CallLink* Link : Calls)
+    {
+        LinkCall(*Link);
+        if (Link->State == link_script) return true;
+    }
+    return false;
+}
+
+/// runRange - runs iterations From .. To - 1 in the current frame and folds
+/// their values into Acc. Stops early once another worker has failed.
+bool PforExprAST::runRange(double First, size_t From, size_t To, double& Acc, const std::atomic<bool>* Stop)
+{
+    Memory& StackMemory = CurInterp->StackMemory;
+    unsigned int VarAddr = FrameBase + Ref.Slot;
+    for (size_t k = From; k < To; k++)
+    {
+        if (Stop && Stop->load(std::memory_order_relaxed)) return false;
+
+        StackMemory.setValue(VarAddr, Value(First + (double)k));
+        Value Val = Body->execute();
+        if (Flow.Type != flow_normal)
+        {
+            if (Flow.Type != flow_err) LogError("Cannot break or return out of a pfor body");
+            return false;
+        }
+        Acc = Combine(Reduce, Acc, Val.getNum());
+    }
+    return true;
+}
+
+/// The body runs once for every integer offset k with Start + k < End. The
+/// outermost pfor of a function splits those iterations among PforWorkers()
+/// threads: each runs its share in a private copy of the loop's own slots,
+/// while everything bound outside the loop, arrays included, stays shared
+/// in the frame at OuterBase.
+Value PforExprAST::execute()
+{
+    Value StartVal = Start->execute();
+    if (Flow.Type != flow_normal) return Value();
+    Value EndVal = End->execute();
+    if (Flow.Type != flow_normal) return Value();
+
+    ProfileScope Prof(*this);
+    double First = StartVal.getNum();
+    double Span = ceil(EndVal.getNum() - First);
+    if (Span >= 9007199254740992.0) return LogErrorV("pfor range is too large");
+    size_t N = Span > 0 ? (size_t)Span : 0;
+    Prof.Iterations = N;
+
+    unsigned int Workers = 1;
+    if (!Nested && N > 1)
+    {
+        Workers = (unsigned int)std::min<size_t>(PforWorkers(), N);
+        if (Workers > 1 && CallsScript(Calls)) Workers = 1;
+    }
+
+    Interpreter& Interp = *CurInterp;
+    unsigned int SavedOuter = OuterBase;
+    if (!Nested) OuterBase = FrameBase;
+
+    double Acc = Identity(Reduce);
+    bool Ok;
+    if (Workers == 1) Ok = runRange(First, 0, N, Acc, nullptr);
+    else
+    {
+        unsigned int Parent = FrameBase;
+        unsigned int Private = PrivateHi - PrivateLo;
+        unsigned int Region;
+        Ok = Interp.StackMemory.pushFrame(Private * (Workers - 1), Region);
+        if (Ok)
+        {
+            if (!Interp.Pool || Interp.Pool->size() < Workers) Interp.Pool.reset(new PforPool(Workers));
+
+            ChunkQueues Chunks(N, Workers);
+            std::vector<double> Partial(Workers, Acc);
+            std::atomic<bool> Stop{ false };
+            Interp.Pool->run(Workers, [&](unsigned int W) {
+                InterpreterScope Scope(Interp);
+                unsigned int SavedBase = FrameBase, SavedWorkerOuter = OuterBase;
+                bool SavedPaused = JitPaused;
+                Completion SavedFlow = Flow;
+                Profiler* SavedProfile = CurProfile;
+                // Worker 0 is this thread and keeps the frame the loop runs in.
+                FrameBase = W == 0 ? Parent : Region + (W - 1) * Private - PrivateLo;
+                OuterBase = Parent;
+                JitPaused = true;
+                Flow = Completion();
+                CurProfile = nullptr; // the profiler is not thread-safe; the pfor counts as a whole
+
+                double WorkerAcc = Identity(Reduce);
+                size_t Chunk;
+                while (Chunks.next(W, Chunk))
+                {
+                    size_t From = Chunk * Chunks.ChunkSize;
+                    if (!runRange(First, From, std::min(N, From + Chunks.ChunkSize), WorkerAcc, &Stop))
+                    {
+                        Stop = true;
+                        break;
+                    }
+                }
+                Partial[W] = WorkerAcc;
+
+                FrameBase = SavedBase;
+                OuterBase = SavedWorkerOuter;
+                JitPaused = SavedPaused;
+                Flow = SavedFlow;
+                CurProfile = SavedProfile;
+            });
+            Interp.StackMemory.deleteScope(Region);
+
+            Ok = !Stop;
+            if (!Ok) Flow.Type = flow_err; // reported by whichever worker failed
+            for (double P : Partial) Acc = Combine(Reduce, Acc, P);
+        }
+    }
+
+    if (Ok && Reduce != reduce_none) StoreVar(AccRef, FrameBase, Value(Acc));
+    OuterBase = SavedOuter;
+
+    if (!Ok) return Value();
+    return Value(Reduce != reduce_none ? Acc : 0);
+}
@@ -0,0 +1,40 @@
+// MicroSEL
+// pfor.h
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern unsigned int PforThreads; // threads per parallel pfor, 0 for one per core
+
+/// PforPool - threads that help the interpreter owning them run parallel
+/// pfor loops. They sleep between loops; run() hands one job to the calling
+/// thread and to as many helpers as needed, and returns once all are done.
+class PforPool
+{
+    std::vector<std::thread> Helpers;
+    std::mutex M;
+    std::condition_variable Wake, Done;
+    const std::function<void(unsigned int)>* Job = nullptr;
+    unsigned long long Round = 0;
+    unsigned int Workers = 0; // workers taking part in the current round
+    unsigned int Busy = 0; // helpers still running it
+    bool Quit = false;
+
+    void helper(unsigned int Id);
+
+public:
+    explicit PforPool(unsigned int Threads);
+    ~PforPool();
+    PforPool(const PforPool&) = delete;
+    PforPool& operator=(const PforPool&) = delete;
+
+    unsigned int size() const { return Helpers.size() + 1; }
+    void run(unsigned int Workers, const std::function<void(unsigned int)>& Job);
+};
+
+unsigned int PforWorkers();
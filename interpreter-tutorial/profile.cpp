@@ -0,0 +1,193 @@
+
+// MicroSEL
+// profile.cpp
+
+#include "profile.h"
+#include "interpreter.h"
+#include <algorithm>
+
+bool UseProfile = false;
+std::string ProfileFile = "profile.folded";
+
+static const char* const TopLevel = "<script>"; // label of __anon_expr
+
+static double Ms(ProfileClock::duration D)
+{
+    return std::chrono::duration<double, std::milli>(D).count();
+}
+
+Profiler::Profiler()
+{
+    Sites.emplace_back();
+    Paths.push_back({ 0, 0, 0, {}, {} });
+}
+
+/// site - the site a function or loop is counted under, found by label the
+/// first time so that redefinitions and every top-level expression share
+/// one row.
+unsigned int Profiler::site(ProfileSlot& Slot, bool IsLoop, const std::string& Label)
+{
+    if (Slot.Site) return Slot.Site;
+
+    auto It = SiteIds.find(Label);
+    if (It == SiteIds.end())
+    {
+        It = SiteIds.emplace(Label, (unsigned int)Sites.size()).first;
+        Sites.emplace_back();
+        Sites.back().Label = Label;
+        Sites.back().IsLoop = IsLoop;
+    }
+    return Slot.Site = It->second;
+}
+
+/// LoopLabel - names a loop after its variable and where it starts, e.g.
+/// "for(i)@3:5". Loops typed into the shell have no position.
+static std::string LoopLabel(const char* Kind, const std::string& Var, const ProfileSlot& Slot)
+{
+    std::string Label = Kind;
+    if (!Var.empty()) Label += "(" + Var + ")";
+    if (Slot.Line) Label += "@" + std::to_string(Slot.Line) + ":" + std::to_string(Slot.Col);
+    return Label;
+}
+
+void Profiler::enter(FunctionAST& Fn)
+{
+    ProfileSlot& Slot = Fn.getProfile();
+    if (!Slot.Site)
+    {
+        std::string Name = Fn.getFuncName();
+        site(Slot, false, Name == "__anon_expr" ? TopLevel : Name);
+    }
+    enter(Slot.Site);
+}
+
+void Profiler::enter(ForExprAST& Loop)
+{
+    if (!Loop.Prof.Site) site(Loop.Prof, true, LoopLabel("for", Loop.getVarName(), Loop.Prof));
+    enter(Loop.Prof.Site);
+}
+
+void Profiler::enter(WhileExprAST& Loop)
+{
+    if (!Loop.Prof.Site) site(Loop.Prof, true, LoopLabel("while", "", Loop.Prof));
+    enter(Loop.Prof.Site);
+}
+
+void Profiler::enter(PforExprAST& Loop)
+{
+    if (!Loop.Prof.Site) site(Loop.Prof, true, LoopLabel("pfor", Loop.getVarName(), Loop.Prof));
+    enter(Loop.Prof.Site);
+}
+
+void Profiler::enter(unsigned int Site)
+{
+    unsigned int Path = Current;
+    if (Paths[Current].Site != Site && Paths[Current].Depth < ProfileMaxDepth)
+    {
+        const std::vector<unsigned int>& Children = Paths[Current].Children;
+        auto It = std::find_if(Children.begin(), Children.end(),
+            [&](unsigned int Child) { return Paths[Child].Site == Site; });
+        if (It != Children.end()) Path = *It;
+        else
+        {
+            Path = (unsigned int)Paths.size();
+            unsigned int Depth = Paths[Current].Depth + 1;
+            Paths.push_back({ Site, Current, Depth, {}, {} });
+            Paths[Current].Children.push_back(Path);
+        }
+    }
+
+    ProfileSite& S = Sites[Site];
+    S.Entries++;
+    S.Active++;
+    Stack.push_back({ Site, Current, ProfileClock::now(), {} });
+    Current = Path;
+}
+
+/// leave - ends the innermost activation. Its time less that of the
+/// activations it started is its own; all of it counts for its caller's
+/// children.
+void Profiler::leave(unsigned long long Iterations)
+{
+    Frame F = Stack.back();
+    Stack.pop_back();
+
+    ProfileClock::duration Elapsed = ProfileClock::now() - F.Start;
+    ProfileClock::duration Self = Elapsed - F.Children;
+    ProfileSite& S = Sites[F.Site];
+    S.Iterations += Iterations;
+    S.Exclusive += Self;
+    if (--S.Active == 0) S.Inclusive += Elapsed;
+    Paths[Current].Exclusive += Self;
+
+    Current = F.Caller;
+    if (!Stack.empty()) Stack.back().Children += Elapsed;
+}
+
+std::string Profiler::stackOf(unsigned int Path) const
+{
+    std::vector<unsigned int> Chain;
+    for (; Path != 0; Path = Paths[Path].Parent) Chain.push_back(Paths[Path].Site);
+
+    std::string Stack;
+    for (auto It = Chain.rbegin(); It != Chain.rend(); ++It)
+    {
+        if (!Stack.empty()) Stack += ';';
+        Stack += Sites[*It].Label;
+    }
+    return Stack;
+}
+
+/// writeFolded - writes one line per call path, "a;b;c <microseconds>",
+/// with the time spent in c itself along that path. This is the folded
+/// format flamegraph.pl, speedscope and inferno read.
+bool Profiler::writeFolded(const char* FileName) const
+{
+    FILE* F = fopen(FileName, "w");
+    if (F == nullptr) return false;
+
+    for (unsigned int i = 1; i < Paths.size(); i++)
+    {
+        long long Us = std::chrono::duration_cast<std::chrono::microseconds>(Paths[i].Exclusive).count();
+        if (Us > 0) fprintf(F, "%s %lld\n", stackOf(i).c_str(), Us);
+    }
+    return fclose(F) == 0;
+}
+
+/// printTable - the TopN sites that took the most time themselves.
+void Profiler::printTable(FILE* Out, unsigned int TopN) const
+{
+    std::vector<unsigned int> Order;
+    ProfileClock::duration Total{};
+    for (unsigned int i = 1; i < Sites.size(); i++)
+    {
+        Order.push_back(i);
+        Total += Sites[i].Exclusive;
+    }
+    std::sort(Order.begin(), Order.end(), [&](unsigned int A, unsigned int B) {
+        return Sites[A].Exclusive > Sites[B].Exclusive;
+    });
+    if (Order.size() > TopN) Order.resize(TopN);
+
+    fprintf(Out, "  %-24s %12s %12s %12s %12s %7s\n", "function or loop", "calls", "iterations", "incl ms", "excl ms", "excl %");
+    for (unsigned int i : Order)
+    {
+        const ProfileSite& S = Sites[i];
+        char Iterations[24] = "-";
+        if (S.IsLoop) snprintf(Iterations, sizeof(Iterations), "%llu", S.Iterations);
+        fprintf(Out, "  %-24s %12llu %12s %12.3f %12.3f %7.1f\n", S.Label.c_str(), S.Entries, Iterations,
+            Ms(S.Inclusive), Ms(S.Exclusive), Total.count() > 0 ? 100.0 * S.Exclusive.count() / Total.count() : 0.0);
+    }
+}
+
+/// PrintProfile - the report --profile gives on exit: the table on the
+/// diagnostics stream and the folded stacks in ProfileFile.
+void PrintProfile(Profiler& Prof)
+{
+    FILE* Err = CurInterp->Err;
+    fprintf(Err, "\nProfile (top %u by own time)\n", ProfileTopN);
+    Prof.printTable(Err, ProfileTopN);
+    if (Prof.writeFolded(ProfileFile.c_str()))
+        fprintf(Err, "  folded stacks written to %s\n", ProfileFile.c_str());
+    else fprintf(Err, "  could not write folded stacks to %s\n", ProfileFile.c_str());
+}
@@ -0,0 +1,112 @@
+
+// MicroSEL
+// profile.h
+
+#pragma once
+
+#include "ast.h"
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+extern bool UseProfile;
+extern std::string ProfileFile;
+
+const unsigned int ProfileTopN = 20; // rows of the table printed on exit
+const unsigned int ProfileMaxDepth = 128; // deeper paths are charged to their ancestor at this depth
+
+typedef std::chrono::steady_clock ProfileClock;
+
+/// ProfileSite - one script function or loop, summed over every path that
+/// reached it. Inclusive time is only added when the outermost activation
+/// ends, so recursion does not count the same time twice.
+struct ProfileSite
+{
+    std::string Label;
+    bool IsLoop = false;
+    unsigned long long Entries = 0; // calls, or times the loop was started
+    unsigned long long Iterations = 0;
+    ProfileClock::duration Inclusive{}, Exclusive{};
+    unsigned int Active = 0; // activations on the stack right now
+};
+
+/// ProfilePath - one distinct chain of sites from the top level down: a
+/// node of the call tree the folded stacks are written from. A function
+/// calling itself directly stays in its own path, so recursion does not
+/// nest.
+struct ProfilePath
+{
+    unsigned int Site;
+    unsigned int Parent;
+    unsigned int Depth;
+    std::vector<unsigned int> Children;
+    ProfileClock::duration Exclusive{};
+};
+
+/// Profiler - the call tree of one interpreter under --profile. Functions
+/// and loops report entering and leaving through ProfileScope; the rest of
+/// the tree walker does not know about it.
+class Profiler
+{
+    struct Frame
+    {
+        unsigned int Site;
+        unsigned int Caller; // path to return to
+        ProfileClock::time_point Start;
+        ProfileClock::duration Children;
+    };
+
+    std::vector<ProfileSite> Sites; // Sites[0] is unused, 0 meaning no site yet
+    std::vector<ProfilePath> Paths; // Paths[0] is the root
+    std::map<std::string, unsigned int> SiteIds; // label -> Sites index
+    std::vector<Frame> Stack;
+    unsigned int Current = 0;
+
+    unsigned int site(ProfileSlot& Slot, bool IsLoop, const std::string& Label);
+    void enter(unsigned int Site);
+    std::string stackOf(unsigned int Path) const;
+
+public:
+    Profiler();
+
+    void enter(FunctionAST& Fn);
+    void enter(ForExprAST& Loop);
+    void enter(WhileExprAST& Loop);
+    void enter(PforExprAST& Loop);
+    void leave(unsigned long long Iterations);
+
+    bool writeFolded(const char* FileName) const;
+    void printTable(FILE* Out, unsigned int TopN) const;
+};
+
+/// CurProfile - the profiler of this thread, or nullptr when it is not
+/// profiling: always without --profile, and on the workers of a pfor.
+inline thread_local Profiler* CurProfile = nullptr;
+
+/// ProfileScope - times the function or loop it is declared in. Without a
+/// profiler it costs one thread-local load; loops count their iterations
+/// in it either way.
+class ProfileScope
+{
+    Profiler* P;
+
+public:
+    unsigned long long Iterations = 0;
+
+    template <typename Node>
+    explicit ProfileScope(Node& N) : P(CurProfile)
+    {
+        if (P) P->enter(N);
+    }
+    ~ProfileScope()
+    {
+        if (P) P->leave(Iterations);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+void PrintProfile(Profiler& Prof);
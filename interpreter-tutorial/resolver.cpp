@@ -0,0 +1,364 @@
+
+// MicroSEL
+// resolver.cpp
+
+#include "resolver.h"
+#include "execute.h"
+#include "stdfunc.h"
+#include <map>
+
+enum LookupKind
+{
+    look_var,
+    look_arr,
+    look_any,
+};
+
+/// InternGlobal - returns the global symbol table entry for Name, creating
+/// an undefined one if the name has never been seen.
+unsigned int InternGlobal(const std::string& Name)
+{
+    auto It = CurInterp->GlobalIds.find(Name);
+    if (It != CurInterp->GlobalIds.end()) return It->second;
+
+    namedValue Var;
+    Var.Name = Name;
+    Var.Addr = 0;
+    CurInterp->SymTbl.push_back(Var);
+    return CurInterp->GlobalIds[Name] = CurInterp->SymTbl.size() - 1;
+}
+
+/// InternFunction - returns the function table entry for Name. Standard
+/// functions are bound when their entry is created.
+unsigned int InternFunction(const std::string& Name)
+{
+    auto It = CurInterp->FunctionIds.find(Name);
+    if (It != CurInterp->FunctionIds.end()) return It->second;
+
+    functionEntry Func;
+    Func.Name = Name;
+    Func.Std = LookupStdFunc(Name);
+    CurInterp->FuncTbl.push_back(Func);
+    return CurInterp->FunctionIds[Name] = CurInterp->FuncTbl.size() - 1;
+}
+
+static VarRef GlobalRef(const std::string& Name)
+{
+    VarRef Ref;
+    Ref.Depth = ref_global;
+    Ref.Global = InternGlobal(Name);
+    return Ref;
+}
+
+void Resolver::openScope()
+{
+    ScopeStarts.push_back(Bindings.size());
+    SlotStarts.push_back(NextSlot);
+}
+
+void Resolver::closeScope()
+{
+    Bindings.resize(ScopeStarts.back());
+    NextSlot = SlotStarts.back();
+    ScopeStarts.pop_back();
+    SlotStarts.pop_back();
+}
+
+const Resolver::Binding* Resolver::find(const std::string& Name, int Kind) const
+{
+    for (size_t i = Bindings.size(); i-- > 0;)
+    {
+        const Binding& B = Bindings[i];
+        if (B.Name != Name) continue;
+        if (Kind == look_any || B.IsArr == (Kind == look_arr)) return &B;
+    }
+    return nullptr;
+}
+
+/// bound - the location of a binding as seen from the current scope. Inside
+/// a pfor body, names bound outside the loop are marked Outer, since the
+/// body may run in a worker's private frame.
+VarRef Resolver::bound(const Binding& B) const
+{
+    VarRef Ref = B.Ref;
+    if (PforCalls && (size_t)(&B - Bindings.data()) < PforBindings && Ref.Depth != ref_global)
+        Ref.Outer = true;
+    return Ref;
+}
+
+/// declare - allocates slots in the innermost scope. Declarations in the
+/// outermost scope of a top-level expression become globals; variables
+/// created by assignment inside a function still write to a global of the
+/// same name if one exists when they run.
+VarRef Resolver::declare(const std::string& Name, bool IsArr, unsigned int Size, const ArrShape* Shape)
+{
+    VarRef Ref;
+    Ref.Depth = ref_local;
+    Ref.Slot = NextSlot;
+    Ref.Shape = Shape;
+
+    NextSlot += Size;
+    if (NextSlot > MaxSlot) MaxSlot = NextSlot;
+
+    if (TopLevel && ScopeStarts.size() == 1)
+    {
+        Ref.Declares = true;
+        Ref.Global = InternGlobal(Name);
+        KeepSlots = NextSlot;
+    }
+    else if (!TopLevel && !IsArr)
+    {
+        Ref.Depth = ref_either;
+        Ref.Global = InternGlobal(Name);
+    }
+
+    Bindings.push_back({ Name, Ref, IsArr });
+    return Ref;
+}
+
+VarRef Resolver::lookupVar(const std::string& Name)
+{
+    if (const Binding* B = find(Name, look_var)) return bound(*B);
+    return GlobalRef(Name);
+}
+
+VarRef Resolver::lookupArr(const std::string& Name)
+{
+    if (const Binding* B = find(Name, look_arr)) return bound(*B);
+    return GlobalRef(Name);
+}
+
+VarRef Resolver::lookupAny(const std::string& Name)
+{
+    if (const Binding* B = find(Name, look_any)) return bound(*B);
+    return GlobalRef(Name);
+}
+
+VarRef Resolver::assignTarget(const std::string& Name)
+{
+    if (const Binding* B = find(Name, look_any)) return bound(*B);
+
+    // Top-level code runs right after it is resolved, so whether the global
+    // exists is already known.
+    if (TopLevel && CurInterp->SymTbl[InternGlobal(Name)].Defined) return GlobalRef(Name);
+    return declare(Name, false, 1, nullptr);
+}
+
+VarRef Resolver::declareArr(const std::string& Name, const ArrShape& Shape)
+{
+    return declare(Name, true, Shape.Size, &Shape);
+}
+
+void Resolver::declareParam(const std::string& Name)
+{
+    VarRef Ref;
+    Ref.Depth = ref_local;
+    Ref.Slot = NextSlot++;
+    if (NextSlot > MaxSlot) MaxSlot = NextSlot;
+    Bindings.push_back({ Name, Ref, false });
+}
+
+/// declarePrivate - a plain frame slot that never stands for a global, for
+/// variables each pfor iteration must own.
+VarRef Resolver::declarePrivate(const std::string& Name)
+{
+    declareParam(Name);
+    return Bindings.back().Ref;
+}
+
+/// beginPfor - starts the body of a pfor whose scope has just been opened.
+/// Only the outermost pfor of a function runs in parallel; it collects the
+/// call sites of its body, and its private slots start at FirstSlot.
+bool Resolver::beginPfor(std::vector<CallLink*>& Calls, unsigned int& FirstSlot)
+{
+    if (PforCalls) return false;
+    PforCalls = &Calls;
+    PforBindings = Bindings.size();
+    PforMaxSlot = MaxSlot;
+    MaxSlot = FirstSlot = NextSlot;
+    return true;
+}
+
+/// endPfor - ends the outermost pfor, returning one past its last private slot.
+unsigned int Resolver::endPfor()
+{
+    unsigned int End = MaxSlot;
+    if (PforMaxSlot > MaxSlot) MaxSlot = PforMaxSlot;
+    PforCalls = nullptr;
+    return End;
+}
+
+void NumberExprAST::resolve(Resolver&) {}
+
+void VariableExprAST::resolve(Resolver& R)
+{
+    for (auto& Idx : Indices) Idx->resolve(R);
+    Ref = Indices.empty() ? R.lookupVar(Name) : R.lookupArr(Name);
+}
+
+void DeRefExprAST::resolve(Resolver& R)
+{
+    AddrExpr->resolve(R);
+}
+
+void ArrDeclExprAST::resolve(Resolver& R)
+{
+    Ref = R.declareArr(Name, Shape);
+}
+
+void UnaryExprAST::resolve(Resolver& R)
+{
+    if (Opcode == '&' && Operand->getNodeType() == node_var)
+    {
+        VariableExprAST* Op = static_cast<VariableExprAST*>(Operand);
+        if (!Op->getIndices().empty()) Op->resolve(R);
+        else Op->setRef(R.lookupAny(Op->getName()));
+        R.noteAddrOf(Op->getRef());
+        return;
+    }
+    Operand->resolve(R);
+}
+
+void BinaryExprAST::resolve(Resolver& R)
+{
+    RHS->resolve(R);
+    if (Op != binop_assign || LHS->getNodeType() != node_var)
+    {
+        LHS->resolve(R);
+        return;
+    }
+
+    VariableExprAST* LHSE = static_cast<VariableExprAST*>(LHS);
+    if (!LHSE->getIndices().empty())
+    {
+        LHSE->resolve(R);
+        return;
+    }
+    LHSE->setRef(R.assignTarget(LHSE->getName()));
+}
+
+void LogicalExprAST::resolve(Resolver& R)
+{
+    LHS->resolve(R);
+    RHS->resolve(R);
+}
+
+void CallExprAST::resolve(Resolver& R)
+{
+    for (auto& Arg : Args) Arg->resolve(R);
+    Link.Func = InternFunction(Callee);
+    Link.Argc = Args.size();
+    R.noteCall(Link);
+}
+
+void IfExprAST::resolve(Resolver& R)
+{
+    CondExpr->resolve(R);
+
+    R.openScope();
+    ThenExpr->resolve(R);
+    R.closeScope();
+
+    if (ElseExpr != nullptr)
+    {
+        R.openScope();
+        ElseExpr->resolve(R);
+        R.closeScope();
+    }
+}
+
+void ForExprAST::resolve(Resolver& R)
+{
+    Start->resolve(R);
+
+    R.openScope();
+    // A loop inside a pfor body counts with its own variable, which other
+    // iterations running at the same time must not see.
+    Ref = R.inPfor() ? R.declarePrivate(VarName) : R.assignTarget(VarName);
+    if (Step) Step->resolve(R);
+    End->resolve(R);
+    Body->resolve(R);
+    R.closeScope();
+}
+
+void PforExprAST::resolve(Resolver& R)
+{
+    Start->resolve(R);
+    End->resolve(R);
+    if (Reduce != reduce_none) AccRef = R.assignTarget(AccName);
+
+    R.openScope();
+    Nested = !R.beginPfor(Calls, PrivateLo);
+    Ref = R.declarePrivate(VarName);
+    Body->resolve(R);
+    if (!Nested) PrivateHi = R.endPfor();
+    R.closeScope();
+}
+
+void WhileExprAST::resolve(Resolver& R)
+{
+    R.openScope();
+    Cond->resolve(R);
+    Body->resolve(R);
+    R.closeScope();
+}
+
+void BlockExprAST::resolve(Resolver& R)
+{
+    R.openScope();
+    for (auto& Expr : Expressions) Expr->resolve(R);
+    R.closeScope();
+}
+
+void BreakExprAST::resolve(Resolver& R)
+{
+    Expr->resolve(R);
+}
+
+void ReturnExprAST::resolve(Resolver& R)
+{
+    Expr->resolve(R);
+}
+
+void IfExprAST::markTailCalls()
+{
+    ThenExpr->markTailCalls();
+    if (ElseExpr != nullptr) ElseExpr->markTailCalls();
+}
+
+void ForExprAST::markTailCalls()
+{
+    Body->markTailCalls();
+}
+
+void WhileExprAST::markTailCalls()
+{
+    Body->markTailCalls();
+}
+
+void BlockExprAST::markTailCalls()
+{
+    for (auto& Expr : Expressions) Expr->markTailCalls();
+}
+
+void ReturnExprAST::markTailCalls()
+{
+    TailCall = Expr->getNodeType() == node_call;
+}
+
+void FunctionAST::resolve()
+{
+    bool TopLevel = Proto->getName() == "__anon_expr";
+    Resolver R(TopLevel);
+    for (auto& Arg : Proto->getArgs()) R.declareParam(Arg);
+    Body->resolve(R);
+
+    // A returned call value passes through blocks, branches and loops
+    // unchanged, so the callee can take over the frame. Top-level code
+    // keeps its frame for the globals it declares, and a function that
+    // takes the address of one of its slots may pass it to the callee.
+    if (!TopLevel && !R.isFrameAddrTaken()) Body->markTailCalls();
+
+    FrameSize = R.getFrameSize();
+    KeepSlots = R.getKeepSlots();
+}
@@ -0,0 +1,69 @@
+
+// MicroSEL
+// resolver.h
+
+#pragma once
+
+#include "ast.h"
+#include <string>
+#include <vector>
+
+/// Resolver - binds the identifiers of one function to frame slots or to
+/// the global symbol table. Every scope of the function shares one frame;
+/// sibling scopes reuse the same slots.
+class Resolver
+{
+    struct Binding
+    {
+        std::string Name;
+        VarRef Ref;
+        bool IsArr;
+    };
+
+    bool TopLevel;
+    std::vector<Binding> Bindings;
+    std::vector<size_t> ScopeStarts;
+    std::vector<unsigned int> SlotStarts;
+    unsigned int NextSlot = 0;
+    unsigned int MaxSlot = 0;
+    unsigned int KeepSlots = 0;
+    bool FrameAddrTaken = false; // '&' was applied to a slot of the frame
+
+    // The outermost pfor being resolved: its call sites, and how many
+    // bindings were made before it, i.e. are shared with its body.
+    std::vector<CallLink*>* PforCalls = nullptr;
+    size_t PforBindings = 0;
+    unsigned int PforMaxSlot = 0; // MaxSlot outside the pfor
+
+    const Binding* find(const std::string& Name, int Kind) const;
+    VarRef bound(const Binding& B) const;
+    VarRef declare(const std::string& Name, bool IsArr, unsigned int Size, const ArrShape* Shape);
+
+public:
+    Resolver(bool TopLevel) : TopLevel(TopLevel) { openScope(); }
+
+    void openScope();
+    void closeScope();
+
+    VarRef lookupVar(const std::string& Name);
+    VarRef lookupArr(const std::string& Name);
+    VarRef lookupAny(const std::string& Name);
+    VarRef assignTarget(const std::string& Name);
+    VarRef declareArr(const std::string& Name, const ArrShape& Shape);
+    void declareParam(const std::string& Name);
+    VarRef declarePrivate(const std::string& Name);
+
+    bool inPfor() const { return PforCalls != nullptr; }
+    bool beginPfor(std::vector<CallLink*>& Calls, unsigned int& FirstSlot);
+    unsigned int endPfor();
+    void noteCall(CallLink& Link) { if (PforCalls) PforCalls->push_back(&Link); }
+    void noteAddrOf(const VarRef& Ref) { if (Ref.Depth != ref_global) FrameAddrTaken = true; }
+
+    unsigned int getFrameSize() const { return MaxSlot; }
+    unsigned int getKeepSlots() const { return KeepSlots; }
+    bool isFrameAddrTaken() const { return FrameAddrTaken; }
+};
+
+unsigned int InternGlobal(const std::string& Name);
+
+unsigned int InternFunction(const std::string& Name);
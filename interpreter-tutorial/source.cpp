@@ -0,0 +1,83 @@
+
+// MicroSEL
+// source.cpp
+
+#include "source.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+ScriptFile::~ScriptFile()
+{
+    if (Data == nullptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(Data);
+    CloseHandle(Mapping);
+#else
+    munmap((void*)Data, Size);
+#endif
+}
+
+/// open - maps FileName. An empty file opens as an empty range.
+bool ScriptFile::open(const char* FileName)
+{
+#ifdef _WIN32
+    HANDLE File = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (File == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER FileSize;
+    if (!GetFileSizeEx(File, &FileSize))
+    {
+        CloseHandle(File);
+        return false;
+    }
+    size_t Len = (size_t)FileSize.QuadPart;
+    if (Len == 0)
+    {
+        CloseHandle(File);
+        return true;
+    }
+
+    Mapping = CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(File);
+    if (Mapping == nullptr) return false;
+    Data = (const char*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+    if (Data == nullptr)
+    {
+        CloseHandle(Mapping);
+        return false;
+    }
+    Size = Len;
+#else
+    int Fd = ::open(FileName, O_RDONLY);
+    if (Fd < 0) return false;
+
+    struct stat St;
+    if (fstat(Fd, &St) != 0 || !S_ISREG(St.st_mode))
+    {
+        close(Fd);
+        return false;
+    }
+    size_t Len = (size_t)St.st_size;
+    if (Len == 0)
+    {
+        close(Fd);
+        return true;
+    }
+
+    void* Mem = mmap(nullptr, Len, PROT_READ, MAP_PRIVATE, Fd, 0);
+    close(Fd);
+    if (Mem == MAP_FAILED) return false;
+    madvise(Mem, Len, MADV_SEQUENTIAL);
+    Data = (const char*)Mem;
+    Size = Len;
+#endif
+    return true;
+}
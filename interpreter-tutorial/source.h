@@ -0,0 +1,35 @@
+
+// MicroSEL
+// source.h
+
+#pragma once
+
+#include <cstddef>
+
+/// Source - the script text the lexer reads, as the range [Cur, End).
+struct Source
+{
+    const char* Cur = nullptr;
+    const char* End = nullptr;
+};
+
+/// ScriptFile - a script file mapped read-only into memory. The lexer reads
+/// the mapping in place, so loading costs no copy and no terminator is
+/// appended.
+class ScriptFile
+{
+    const char* Data = nullptr;
+    size_t Size = 0;
+#ifdef _WIN32
+    void* Mapping = nullptr;
+#endif
+
+public:
+    ScriptFile() = default;
+    ScriptFile(const ScriptFile&) = delete;
+    ScriptFile& operator=(const ScriptFile&) = delete;
+    ~ScriptFile();
+
+    bool open(const char* FileName);
+    Source getSource() const { return { Data, Data + Size }; }
+};
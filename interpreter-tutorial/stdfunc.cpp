@@ -4,31 +4,34 @@
     
 #include "stdfunc.h"
 #include "execute.h"
+#include "kernels.h"
 #include "value.h"
+#include <chrono>
 
-std::vector<std::string> StdFuncList = {
-    "print",
-    "println",
-    "printch",
-    "input",
-    "inputch",
-};
-
-Value CallStdFunc(const std::string& Name, const std::vector<Value>& Args)
+/// LookupStdFunc - the standard function called Name, or nullptr.
+StdFunc LookupStdFunc(const std::string& Name)
 {
-    if (Name == "print") return print(Args);
-    else if (Name == "println") return println(Args);
-    else if (Name == "printch") return println(Args);
-    else if (Name == "input") return input(Args);
-    else if (Name == "inputch") return inputch(Args);
+    if (Name == "print") return print;
+    else if (Name == "println") return println;
+    else if (Name == "printch") return println;
+    else if (Name == "input") return input;
+    else if (Name == "inputch") return inputch;
+    else if (Name == "vsum") return vsum;
+    else if (Name == "vdot") return vdot;
+    else if (Name == "vmin") return vmin;
+    else if (Name == "vmax") return vmax;
+    else if (Name == "vfill") return vfill;
+    else if (Name == "vscale") return vscale;
+    else if (Name == "vaxpy") return vaxpy;
+    else if (Name == "clock") return clocksec;
 
-    return Value(val_err);
+    return nullptr;
 }
 
 Value print(const std::vector<Value>& Args)
 {
     for (auto Arg : Args)
-        fprintf(stderr, "%f ", Arg.getNum());
+        fprintf(CurInterp->Out, "%f ", Arg.getNum());
 
     return Value(0);
 }
@@ -36,18 +39,18 @@ Value print(const std::vector<Value>& Args)
 Value println(const std::vector<Value>& Args)
 {
     for (auto Arg : Args)
-        fprintf(stderr, "%f ", Arg.getNum());
+        fprintf(CurInterp->Out, "%f ", Arg.getNum());
 
-    fprintf(stderr, "\n");
+    fprintf(CurInterp->Out, "\n");
     return Value(0);
 }
 
 Value printch(const std::vector<Value>& Args)
 {
     for (auto Arg : Args)
-        fprintf(stderr, "%c", (char)Arg.getNum());
+        fprintf(CurInterp->Out, "%c", (char)Arg.getNum());
 
-    fprintf(stderr, "\n");
+    fprintf(CurInterp->Out, "\n");
     return Value(0);
 }
 
@@ -56,7 +59,7 @@ Value input(const std::vector<Value>& Args)
     if (Args.size() != 0) return LogErrorV("input() requires no arguments");
 
     double Val;
-    fscanf(stdin, "%lf", &Val);
+    fscanf(CurInterp->In, "%lf", &Val);
 
     if (trunc(Val) == Val) return Value((int)Val);
     else return Value(Val);
@@ -67,6 +70,127 @@ Value inputch(const std::vector<Value>& Args)
     if (Args.size() != 0) return LogErrorV("inputch() requires no arguments");
 
     char Val;
-    fscanf(stdin, "%c", &Val);
+    fscanf(CurInterp->In, "%c", &Val);
     return Value(Val);
-}
\ No newline at end of file
+}
+
+/// Start - when the interpreter started; clock() counts from here.
+static const std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+/// clock() - seconds on a monotonic clock since the interpreter started,
+/// for timing parts of a script: t = clock(); ...; println(clock() - t).
+Value clocksec(const std::vector<Value>& Args)
+{
+    if (Args.size() != 0) return LogErrorV("clock() requires no arguments");
+
+    return Value(std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count());
+}
+
+/// ArrayRun - the Len values starting at memory address Addr. Arrays are
+/// passed as the address of their first element, e.g. vsum(&a[0], 10), and
+/// the whole run must lie in the part of Memory in use.
+static Cell* ArrayRun(Value Addr, Value Len, size_t& N)
+{
+    if (!Addr.isUInt() || !Len.isUInt())
+    {
+        LogError("Array address and length must be unsigned integers");
+        return nullptr;
+    }
+    if (Addr.getNum() + Len.getNum() > CurInterp->StackMemory.getSize())
+    {
+        LogError("Array range out of bounds");
+        return nullptr;
+    }
+    N = (size_t)Len.getNum();
+    return CurInterp->StackMemory.data() + (size_t)Addr.getNum();
+}
+
+/// vsum(a, n) - a[0] + ... + a[n - 1]; see kernels.cpp for rounding.
+Value vsum(const std::vector<Value>& Args)
+{
+    if (Args.size() != 2) return LogErrorV("vsum() requires an address and a length");
+
+    size_t N;
+    const Cell* A = ArrayRun(Args[0], Args[1], N);
+    if (!A) return Value();
+    return Value(GetArrayKernels().Sum(A, N));
+}
+
+/// vdot(a, b, n) - a[0] * b[0] + ... + a[n - 1] * b[n - 1].
+Value vdot(const std::vector<Value>& Args)
+{
+    if (Args.size() != 3) return LogErrorV("vdot() requires two addresses and a length");
+
+    size_t N;
+    const Cell* A = ArrayRun(Args[0], Args[2], N);
+    const Cell* B = A ? ArrayRun(Args[1], Args[2], N) : nullptr;
+    if (!B) return Value();
+    return Value(GetArrayKernels().Dot(A, B, N));
+}
+
+/// vmin(a, n) - the smallest of a[0] .. a[n - 1], inf if n is 0.
+Value vmin(const std::vector<Value>& Args)
+{
+    if (Args.size() != 2) return LogErrorV("vmin() requires an address and a length");
+
+    size_t N;
+    const Cell* A = ArrayRun(Args[0], Args[1], N);
+    if (!A) return Value();
+    return Value(GetArrayKernels().Min(A, N));
+}
+
+/// vmax(a, n) - the largest of a[0] .. a[n - 1], -inf if n is 0.
+Value vmax(const std::vector<Value>& Args)
+{
+    if (Args.size() != 2) return LogErrorV("vmax() requires an address and a length");
+
+    size_t N;
+    const Cell* A = ArrayRun(Args[0], Args[1], N);
+    if (!A) return Value();
+    return Value(GetArrayKernels().Max(A, N));
+}
+
+/// vfill(a, n, x) - sets a[0] .. a[n - 1] to x.
+Value vfill(const std::vector<Value>& Args)
+{
+    if (Args.size() != 3) return LogErrorV("vfill() requires an address, a length and a value");
+
+    size_t N;
+    Cell* A = ArrayRun(Args[0], Args[1], N);
+    if (!A) return Value();
+    GetArrayKernels().Fill(A, N, Value(Args[2]).getNum());
+    return Value(0);
+}
+
+/// vscale(a, n, k) - multiplies a[0] .. a[n - 1] by k.
+Value vscale(const std::vector<Value>& Args)
+{
+    if (Args.size() != 3) return LogErrorV("vscale() requires an address, a length and a factor");
+
+    size_t N;
+    Cell* A = ArrayRun(Args[0], Args[1], N);
+    if (!A) return Value();
+    GetArrayKernels().Scale(A, N, Value(Args[2]).getNum());
+    return Value(0);
+}
+
+/// vaxpy(y, x, n, k) - adds k * x[i] to y[i] for i = 0 .. n - 1 in turn,
+/// like the loop written in the script.
+Value vaxpy(const std::vector<Value>& Args)
+{
+    if (Args.size() != 4) return LogErrorV("vaxpy() requires two addresses, a length and a factor");
+
+    size_t N;
+    Cell* Y = ArrayRun(Args[0], Args[2], N);
+    const Cell* X = Y ? ArrayRun(Args[1], Args[2], N) : nullptr;
+    if (!X) return Value();
+
+    double K = Value(Args[3]).getNum();
+    // If the runs overlap in part, later elements read values stored by
+    // earlier ones. The vector kernels load several at once, so only an
+    // in-order loop gives the same result on every CPU and with --no-simd.
+    if (X != Y && X < Y + N && Y < X + N)
+        for (size_t i = 0; i < N; i++) Y[i] += K * X[i];
+    else GetArrayKernels().Axpy(Y, X, N, K);
+    return Value(0);
+}
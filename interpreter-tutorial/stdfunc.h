@@ -8,9 +8,7 @@
 #include "ast.h"
 #include "value.h"
 
-extern std::vector<std::string> StdFuncList;
-
-Value CallStdFunc(const std::string& Name, const std::vector<Value>& Args);
+StdFunc LookupStdFunc(const std::string& Name);
 
 Value print(const std::vector<Value>& Args);
 
@@ -19,3 +17,19 @@ Value println(const std::vector<Value>& Args);
 Value input(const std::vector<Value>& Args);
 
 Value inputch(const std::vector<Value>& Args);
+
+Value clocksec(const std::vector<Value>& Args);
+
+Value vsum(const std::vector<Value>& Args);
+
+Value vdot(const std::vector<Value>& Args);
+
+Value vmin(const std::vector<Value>& Args);
+
+Value vmax(const std::vector<Value>& Args);
+
+Value vfill(const std::vector<Value>& Args);
+
+Value vscale(const std::vector<Value>& Args);
+
+Value vaxpy(const std::vector<Value>& Args);
@@ -6,29 +6,42 @@
 
 #include <cmath>
 
-typedef enum ValueType
+typedef enum FlowType
 {
-    val_data = 0,
-    val_return = 1,
-    val_break = 2,
-    val_err = 3,
-} vType;
+    flow_normal = 0,
+    flow_return = 1,
+    flow_break = 2,
+    flow_err = 3,
+    flow_tail = 4, // tail call waiting for its caller's frame
+} fType;
+
+/// Completion - how the expression running on a thread stopped early, if
+/// it did: the kind of the return, break, tail call or error on its way to
+/// the node that handles it, and the value a return or break carries.
+struct Completion
+{
+    fType Type = flow_normal;
+    double Val = 0;
+};
 
+/// Value - the number an expression evaluates to. Control flow travels in
+/// the thread's Completion instead; a node that stops early returns Value()
+/// and leaves the reason there.
 class Value
 {
-    vType vt = val_data;
-    double num;
+    double num = 0;
 public:
     Value() {}
-    Value(vType valType, double dVal) : vt(valType), num(dVal) {}
     Value(double dVal) : num(dVal) {}
 
-    void setType(vType valType) { vt = valType; }
-
-    bool isErr() { return vt == val_err; }
     bool isInt() { return trunc(num) == num; }
     bool isUInt() { return isInt() && num >= 0; }
 
-    vType getType() { return vt; }
     double getNum() { return num; }
-};
\ No newline at end of file
+};
+
+/// Cell - one slot of Memory: an 8-byte IEEE double, so every number
+/// round-trips unchanged.
+typedef double Cell;
+
+static_assert(sizeof(Cell) == 8, "Memory cells are 8 bytes");
\ No newline at end of file
@@ -0,0 +1,356 @@
+
+// MicroSEL
+// vm.cpp
+
+#include "vm.h"
+#include "execute.h"
+#include "jit.h"
+#include "memo.h"
+#include "stdfunc.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/// EnsureStack - grows the operand stack so that Need slots are available.
+static void EnsureStack(size_t Need, double*& Sp)
+{
+    std::vector<double>& Operands = CurInterp->VM.Operands;
+    if (Need <= Operands.size()) return;
+    size_t Top = Sp - Operands.data();
+    Operands.resize(std::max(Need, Operands.size() * 2));
+    Sp = Operands.data() + Top;
+}
+
+/// ElemAddr - computes the address of an array element from N indices.
+static bool ElemAddr(const Chunk& C, const ChunkRef& R, unsigned int Fp, const double* Idx, unsigned int N, unsigned int& Addr)
+{
+    const ArrShape* Shape;
+    if (!ArrBase(R.Ref, Fp, Addr, Shape))
+    {
+        LogError(("\"" + C.Names[R.Name] + "\" is not an array").c_str());
+        return false;
+    }
+    if (N != Shape->Dims.size())
+    {
+        LogError("Dimension mismatch");
+        return false;
+    }
+
+    int AddVal = 0;
+    for (unsigned int l = 0; l < N; l++)
+    {
+        if (trunc(Idx[l]) != Idx[l])
+        {
+            LogError("Index must be an integer");
+            return false;
+        }
+        if (CheckBounds && !(Idx[l] >= 0 && Idx[l] < Shape->Dims[l]))
+        {
+            LogError("Index out of range");
+            return false;
+        }
+        AddVal += (int)Idx[l] * Shape->Strides[l];
+    }
+    Addr += AddVal;
+    if (!CheckBounds && Addr >= CurInterp->StackMemory.getSize())
+    {
+        LogError("Address out of range");
+        return false;
+    }
+    return true;
+}
+
+/// IsAddress - true if Addr is an address in the part of Memory in use.
+static bool IsAddress(double Addr)
+{
+    if (!Value(Addr).isUInt())
+    {
+        LogError("Address must be an unsigned integer");
+        return false;
+    }
+    if (Addr >= CurInterp->StackMemory.getSize())
+    {
+        LogError("Address out of range");
+        return false;
+    }
+    return true;
+}
+
+static unsigned int ReadArg(const unsigned char*& IP)
+{
+    unsigned int Arg;
+    memcpy(&Arg, IP, 4);
+    IP += 4;
+    return Arg;
+}
+
+#define BINARY_OP(Expr) { double R = *--Sp; double L = Sp[-1]; Sp[-1] = (Expr); break; }
+
+Value ExecuteBytecode(FunctionAST& Fn)
+{
+    // The running interpreter's stacks, bound once for the whole dispatch loop.
+    Memory& StackMemory = CurInterp->StackMemory;
+    std::vector<double>& Operands = CurInterp->VM.Operands;
+    std::vector<CallFrame>& Frames = CurInterp->VM.Frames;
+
+    const Chunk* C = &Fn.getBytecode();
+    const unsigned char* IP = C->Code.data();
+    double* Sp = Operands.data();
+    EnsureStack(C->MaxDepth, Sp);
+
+    unsigned int Fp;
+    if (!StackMemory.pushFrame(C->FrameSize, Fp)) return Value();
+    Frames.push_back({ C, nullptr, 0, Fp });
+
+    while (true)
+    {
+        switch ((opCode)*IP++)
+        {
+        case op_const:
+            *Sp++ = C->Consts[ReadArg(IP)];
+            break;
+        case op_pop:
+            --Sp;
+            break;
+        case op_unwind:
+        {
+            double Top = Sp[-1];
+            Sp -= ReadArg(IP);
+            Sp[-1] = Top;
+            break;
+        }
+        case op_load_local:
+            *Sp++ = StackMemory.getValue(Fp + ReadArg(IP)).getNum();
+            break;
+        case op_store_local:
+            StackMemory.setValue(Fp + ReadArg(IP), Value(Sp[-1]));
+            break;
+        case op_load_var:
+        {
+            const ChunkRef& R = C->Refs[ReadArg(IP)];
+            unsigned int Addr;
+            if (!RefAddr(R.Ref, Fp, false, Addr))
+            {
+                LogError(("Identifier \"" + C->Names[R.Name] + "\" not found").c_str());
+                goto fail;
+            }
+            *Sp++ = StackMemory.getValue(Addr).getNum();
+            break;
+        }
+        case op_store_var:
+            StoreVar(C->Refs[ReadArg(IP)].Ref, Fp, Value(Sp[-1]));
+            break;
+        case op_addr_var:
+        {
+            const ChunkRef& R = C->Refs[ReadArg(IP)];
+            unsigned int Addr;
+            if (!RefAddr(R.Ref, Fp, true, Addr))
+            {
+                LogError(("Variable \"" + C->Names[R.Name] + "\" not found").c_str());
+                goto fail;
+            }
+            *Sp++ = Addr;
+            break;
+        }
+        case op_load_elem:
+        case op_store_elem:
+        case op_addr_elem:
+        {
+            opCode Op = (opCode)IP[-1];
+            const ChunkRef& R = C->Refs[ReadArg(IP)];
+            unsigned int N = ReadArg(IP);
+            unsigned int Addr;
+            Sp -= N;
+            if (!ElemAddr(*C, R, Fp, Sp, N, Addr)) goto fail;
+
+            if (Op == op_load_elem) *Sp++ = StackMemory.getValue(Addr).getNum();
+            else if (Op == op_addr_elem) *Sp++ = Addr;
+            else StackMemory.setValue(Addr, Value(Sp[-1]));
+            break;
+        }
+        case op_deref:
+            if (!IsAddress(Sp[-1])) goto fail;
+            Sp[-1] = StackMemory.getValue((unsigned int)Sp[-1]).getNum();
+            break;
+        case op_store_deref:
+        {
+            double Addr = *--Sp;
+            if (!IsAddress(Addr)) goto fail;
+            StackMemory.setValue((unsigned int)Addr, Value(Sp[-1]));
+            break;
+        }
+        case op_decl_arr:
+        {
+            const VarRef& Ref = C->Refs[ReadArg(IP)].Ref;
+            unsigned int Addr = Fp + Ref.Slot;
+
+            int Size = Ref.Shape->Size;
+            for (int i = 0; i < Size; i++) StackMemory.setValue(Addr + i, Value(0));
+            if (Ref.Declares) PublishGlobal(Ref, Addr, Ref.Shape);
+            *Sp++ = Size;
+            break;
+        }
+        case op_neg:
+            Sp[-1] = -Sp[-1];
+            break;
+        case op_not:
+            Sp[-1] = !Sp[-1];
+            break;
+        case op_bool:
+            Sp[-1] = Sp[-1] != 0;
+            break;
+        case op_add: BINARY_OP(L + R)
+        case op_sub: BINARY_OP(L - R)
+        case op_mul: BINARY_OP(L * R)
+        case op_div: BINARY_OP(L / R)
+        case op_mod: BINARY_OP(fmod(L, R))
+        case op_pow: BINARY_OP(pow(L, R))
+        case op_eq: BINARY_OP(L == R)
+        case op_ne: BINARY_OP(L != R)
+        case op_lt: BINARY_OP(L < R)
+        case op_gt: BINARY_OP(L > R)
+        case op_le: BINARY_OP(L <= R)
+        case op_ge: BINARY_OP(L >= R)
+        case op_jmp:
+        {
+            int Offset = (int)ReadArg(IP);
+            IP += Offset;
+            break;
+        }
+        case op_jmp_false:
+        {
+            int Offset = (int)ReadArg(IP);
+            if (!*--Sp) IP += Offset;
+            break;
+        }
+        case op_for_var:
+        {
+            unsigned int Addr;
+            RefAddr(C->Refs[ReadArg(IP)].Ref, Fp, true, Addr);
+            StackMemory.setValue(Addr, Value(Sp[-1]));
+            Sp[-1] = Addr;
+            break;
+        }
+        case op_for_step:
+        {
+            unsigned int Addr = (unsigned int)Sp[-3];
+            StackMemory.setValue(Addr, Value(StackMemory.getValue(Addr).getNum() + Sp[-2]));
+            break;
+        }
+        case op_call:
+        case op_tail_call:
+        {
+            bool Tail = IP[-1] == op_tail_call;
+            CallLink& Link = *C->Calls[ReadArg(IP)];
+            unsigned int Argc = ReadArg(IP);
+            double* Args = Sp - Argc;
+
+            LinkCall(Link);
+            if (Link.State == link_std)
+            {
+                Value RetVal = Link.Std(std::vector<Value>(Args, Sp));
+                if (Flow.Type == flow_err) goto fail;
+                Sp = Args;
+                *Sp++ = RetVal.getNum();
+                break;
+            }
+            if (Link.State != link_script)
+            {
+                LogError(Link.State == link_arity ? "Incorrect number of arguments passed"
+                    : "Unknown function referenced");
+                goto fail;
+            }
+            FunctionAST& CalleeF = *Link.Script;
+
+            // A tail call reuses the caller's memory frame and VM frame.
+            const Chunk* CalleeC = &CalleeF.getBytecode();
+            if (Tail) StackMemory.deleteScope(Fp);
+            unsigned int CalleeFp;
+            if (!StackMemory.pushFrame(CalleeC->FrameSize, CalleeFp)) goto fail;
+            for (unsigned int i = 0; i < Argc; i++)
+                StackMemory.setValue(CalleeFp + i, Value(Args[i]));
+
+            // Memoized functions run through FunctionAST::execute, which
+            // owns their result cache.
+            if (UseMemo && !Tail && MemoPure(CalleeF))
+            {
+                Value RetVal = CalleeF.execute(CalleeFp);
+                if (Flow.Type == flow_err) goto fail;
+                Sp = Args;
+                *Sp++ = RetVal.getNum();
+                break;
+            }
+
+            // Hot functions run as native code instead of a new VM frame.
+            // After a tail call the op_ret that follows returns the result.
+            Value JitVal;
+            if (CalleeF.runJit(CalleeFp, JitVal))
+            {
+                if (Flow.Type == flow_tail) JitVal = RunTailCalls(CalleeFp);
+                if (!Tail) StackMemory.deleteScope(CalleeFp + CalleeC->KeepSlots);
+                if (Flow.Type == flow_err) goto fail;
+                Sp = Args;
+                *Sp++ = JitVal.getNum();
+                break;
+            }
+
+            if (Tail)
+            {
+                Sp = Operands.data() + Frames.back().Base;
+                Frames.back().Code = CalleeC;
+            }
+            else
+            {
+                // A VM frame counts like one value, so that recursion
+                // through empty frames is bounded as well.
+                if (Frames.size() >= StackMemory.getCapacity())
+                {
+                    LogError("Stack overflow");
+                    goto fail;
+                }
+                Frames.back().IP = IP;
+                Frames.push_back({ CalleeC, nullptr, (size_t)(Args - Operands.data()), CalleeFp });
+                Sp = Args;
+            }
+            Fp = CalleeFp;
+            C = CalleeC;
+            IP = C->Code.data();
+            EnsureStack(Frames.back().Base + C->MaxDepth, Sp);
+            break;
+        }
+        case op_ret:
+        {
+            double RetVal = Sp[-1];
+            StackMemory.deleteScope(Fp + C->KeepSlots);
+            Sp = Operands.data() + Frames.back().Base;
+            Frames.pop_back();
+            if (Frames.empty()) return Value(RetVal);
+
+            *Sp++ = RetVal;
+            C = Frames.back().Code;
+            IP = Frames.back().IP;
+            Fp = Frames.back().MemBase;
+            break;
+        }
+        case op_pfor:
+        {
+            ExprAST* Node = C->Nodes[ReadArg(IP)];
+            unsigned int CallerBase = FrameBase;
+            FrameBase = Fp;
+            Value RetVal = Node->execute();
+            FrameBase = CallerBase;
+            if (Flow.Type == flow_err) goto fail;
+            *Sp++ = RetVal.getNum();
+            break;
+        }
+        case op_error:
+            LogError(C->Names[ReadArg(IP)].c_str());
+            goto fail;
+        }
+    }
+
+fail:
+    StackMemory.deleteScope(Frames.front().MemBase + Frames.front().Code->KeepSlots);
+    Frames.clear();
+    return Value();
+}
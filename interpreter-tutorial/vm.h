@@ -0,0 +1,28 @@
+
+// MicroSEL
+// vm.h
+
+#pragma once
+
+#include "value.h"
+#include "ast.h"
+#include "bytecode.h"
+
+struct CallFrame
+{
+    const Chunk* Code;
+    const unsigned char* IP; // resume point while a callee runs
+    size_t Base; // first operand stack slot of this frame
+    unsigned int MemBase; // memory address of frame slot 0
+};
+
+/// VMStacks - the operand and call stacks of one interpreter's VM.
+struct VMStacks
+{
+    std::vector<double> Operands;
+    std::vector<CallFrame> Frames;
+};
+
+/// ExecuteBytecode - runs a parameterless function (normally __anon_expr)
+/// on the bytecode VM. Script calls made from it stay inside the VM.
+Value ExecuteBytecode(FunctionAST& Fn);
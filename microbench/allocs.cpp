@@ -0,0 +1,137 @@
+
+// MicroSEL
+// allocs.cpp
+//
+// Checks that calling a script function does not allocate. A recursive
+// fib runs on the tree walker, the JIT and the VM with operator new
+// counting; once everything a script needs has been compiled and warmed
+// up, fib(15) and fib(20) must both run without a single allocation.
+// Exits with 1 if any engine allocates.
+//
+//   allocs
+
+#include "ast.h"
+#include "execute.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "lexer.h"
+#include "vm.h"
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+static unsigned long long Allocations = 0; // this program is single-threaded
+
+void* operator new(size_t Size)
+{
+    Allocations++;
+    if (void* P = malloc(Size ? Size : 1)) return P;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* P) noexcept
+{
+    free(P);
+}
+
+void operator delete(void* P, size_t) noexcept
+{
+    free(P);
+}
+
+static const char* const Setup = "func fib(n) { if n < 2 then { return n }; return fib(n - 1) + fib(n - 2) }\n";
+
+static Source SourceOf(const std::string& Text)
+{
+    return { Text.data(), Text.data() + Text.size() };
+}
+
+/// Parse - the top-level expression Toks was made from, ready to run.
+static std::shared_ptr<FunctionAST> Parse(TokenStream& Toks)
+{
+    Toks.tokenize();
+    GetNextToken(Toks);
+    auto Fn = ParseTopLevelExpr(Toks);
+    if (Fn)
+    {
+        Fn->optimize();
+        Fn->resolve();
+    }
+    return Fn;
+}
+
+/// Run - runs a parsed top-level expression on the engine selected by the
+/// options, as HandleTopLevelExpression does.
+static Value Run(FunctionAST& Fn)
+{
+    Flow.Type = flow_normal;
+    if (UseBytecode) return ExecuteBytecode(Fn);
+
+    unsigned int Base = 0;
+    if (!CurInterp->StackMemory.pushFrame(Fn.getFrameSize(), Base)) return Value();
+    return Fn.execute(Base);
+}
+
+/// Check - counts the allocations of fib(15) and fib(20) on one engine;
+/// false if either allocated or failed.
+static bool Check(const char* Engine)
+{
+    Interpreter Interp;
+    InterpreterScope Scope(Interp);
+    Interp.IsInteractive = false;
+    if (!Interp.StackMemory.reserve((size_t)DefaultStackMB << 20))
+    {
+        fprintf(stderr, "Error: Could not reserve %u MB for the stack\n", DefaultStackMB);
+        return false;
+    }
+    MarkNativeStack();
+
+    std::string SetupText = Setup;
+    TokenStream SetupToks(SourceOf(SetupText));
+    SetupToks.tokenize();
+    GetNextToken(SetupToks);
+    MainLoop(SetupToks);
+
+    const int Args[] = { 15, 20 };
+    const double Expected[] = { 610, 6765 };
+    bool Ok = true;
+    for (int k = 0; k < 2; k++)
+    {
+        std::string Text = "fib(" + std::to_string(Args[k]) + ")";
+        TokenStream Toks(SourceOf(Text));
+        auto Fn = Parse(Toks);
+        if (!Fn) return false;
+
+        Run(*Fn); // compiles bytecode, tiers up to the JIT, touches the stack
+        unsigned long long Before = Allocations;
+        Value Result = Run(*Fn);
+        unsigned long long Count = Allocations - Before;
+
+        bool Pass = Count == 0 && Flow.Type != flow_err && Result.getNum() == Expected[k];
+        fprintf(stderr, "  %-5s fib(%d) = %-6g %llu allocations  %s\n", Engine, Args[k], Result.getNum(), Count,
+            Pass ? "ok" : "FAILED");
+        Ok = Ok && Pass;
+    }
+    return Ok;
+}
+
+int main()
+{
+    bool Ok = true;
+
+    UseJit = false;
+    UseBytecode = false;
+    Ok = Check("tree") && Ok;
+
+    UseJit = true;
+    Ok = Check("jit") && Ok;
+
+    UseJit = false;
+    UseBytecode = true;
+    Ok = Check("vm") && Ok;
+
+    fprintf(stderr, Ok ? "Script calls do not allocate.\n" : "Script calls allocate.\n");
+    return Ok ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+
+// MicroSEL
+// microbench.cpp
+//
+// Component microbenchmarks: the lexer, the parser and single node kinds
+// of the tree walker, each timed on its own on synthetic input. Results go
+// to stdout as JSON so they can be collected and charted across releases;
+// a readable summary goes to stderr.
+//
+//   microbench [--min-time SECONDS] [--filter TEXT]
+
+#include "ast.h"
+#include "execute.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "lexer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+extern thread_local int CurTok;
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double MinTime = 0.5; // seconds each benchmark runs for at least
+static const char* Filter = nullptr;
+
+/// BenchResult - one benchmark: how many items a round handles and how
+/// long the rounds took.
+struct BenchResult
+{
+    std::string Name;
+    const char* Unit;
+    size_t Items = 0;
+    std::vector<double> Rounds;
+
+    double best() const { return *std::min_element(Rounds.begin(), Rounds.end()); }
+    double median() const
+    {
+        std::vector<double> Sorted = Rounds;
+        std::sort(Sorted.begin(), Sorted.end());
+        size_t Mid = Sorted.size() / 2;
+        return Sorted.size() % 2 ? Sorted[Mid] : (Sorted[Mid - 1] + Sorted[Mid]) / 2;
+    }
+};
+
+static std::vector<BenchResult> Results;
+
+/// Measure - runs Round until at least MinTime has passed and five rounds
+/// were made, as --lex-bench does. Round returns the items it handled and
+/// sets Seconds to the time it measured, so it can leave set-up and
+/// clean-up out.
+static void Measure(const char* Name, const char* Unit, const std::function<size_t(double& Seconds)>& Round)
+{
+    if (Filter && !strstr(Name, Filter)) return;
+
+    BenchResult R;
+    R.Name = Name;
+    R.Unit = Unit;
+    double Total = 0;
+    while (R.Rounds.size() < 5 || (Total < MinTime && R.Rounds.size() < 1000))
+    {
+        double Seconds = 0;
+        R.Items = Round(Seconds);
+        R.Rounds.push_back(Seconds);
+        Total += Seconds;
+    }
+
+    fprintf(stderr, "  %-24s %10zu %-7s %10.3f ms  %12.0f %s/s\n", Name, R.Items, Unit, R.median() * 1000,
+        R.Items / R.median(), Unit);
+    Results.push_back(std::move(R));
+}
+
+static double Since(BenchClock::time_point Start)
+{
+    return std::chrono::duration<double>(BenchClock::now() - Start).count();
+}
+
+//===----------------------------------------------------------------------===//
+// Synthetic input
+//===----------------------------------------------------------------------===//
+
+/// Definitions - Count function definitions with a bit of every construct.
+static std::string Definitions(unsigned int Count)
+{
+    std::string Text;
+    char Line[256];
+    for (unsigned int i = 0; i < Count; i++)
+    {
+        snprintf(Line, sizeof(Line),
+            "func f%u(a, b, c) { t = a * %u + b - c / 3; if t > %u then { return t %% 7 } "
+            "else { arr v[4]; v[%u] = t; return v[%u] + (b && c || !a) } }\n",
+            i, i % 17 + 1, i % 50, i % 4, i % 4);
+        Text += Line;
+    }
+    return Text;
+}
+
+/// Expressions - Count top-level expressions of calls, indexing and
+/// arithmetic.
+static std::string Expressions(unsigned int Count)
+{
+    std::string Text;
+    char Line[256];
+    for (unsigned int i = 0; i < Count; i++)
+    {
+        snprintf(Line, sizeof(Line), "s = s + f%u(%u, x, 2.5) * (g[%u][j] - @(p + %u)) / (1 + y ** 2)\n",
+            i % 100, i % 9, i % 16, i % 32);
+        Text += Line;
+    }
+    return Text;
+}
+
+static Source SourceOf(const std::string& Text)
+{
+    return { Text.data(), Text.data() + Text.size() };
+}
+
+//===----------------------------------------------------------------------===//
+// Lexer and parser
+//===----------------------------------------------------------------------===//
+
+static void BenchLexer()
+{
+    std::string Text = Definitions(2000) + Expressions(2000);
+    Measure("lex/tokenize", "tokens", [&](double& Seconds) {
+        TokenStream Toks(SourceOf(Text));
+        auto Start = BenchClock::now();
+        Toks.tokenize();
+        Seconds = Since(Start);
+        return Toks.size();
+    });
+}
+
+/// ParseAll - parses every unit of a lexed script with Parse and counts
+/// the nodes made. The trees are freed after the clock stops.
+template <typename ParseFn>
+static size_t ParseAll(TokenStream& Toks, ParseFn Parse, double& Seconds)
+{
+    std::vector<std::shared_ptr<FunctionAST>> Units;
+    Toks.rewind();
+    auto Start = BenchClock::now();
+    GetNextToken(Toks);
+    while (CurTok != tok_eof)
+    {
+        if (auto Fn = Parse(Toks)) Units.push_back(std::move(Fn));
+        else GetNextToken(Toks);
+    }
+    Seconds = Since(Start);
+
+    size_t Nodes = 0;
+    for (auto& Fn : Units) Nodes += Fn->getNodes().getObjectCount();
+    return Nodes;
+}
+
+static void BenchParser()
+{
+    std::string Defs = Definitions(2000);
+    TokenStream DefToks(SourceOf(Defs));
+    DefToks.tokenize();
+    Measure("parse/definition", "nodes", [&](double& Seconds) {
+        return ParseAll(DefToks, ParseDefinition, Seconds);
+    });
+
+    std::string Exprs = Expressions(2000);
+    TokenStream ExprToks(SourceOf(Exprs));
+    ExprToks.tokenize();
+    Measure("parse/expression", "nodes", [&](double& Seconds) {
+        return ParseAll(ExprToks, ParseTopLevelExpr, Seconds);
+    });
+}
+
+//===----------------------------------------------------------------------===//
+// Node evaluation
+//===----------------------------------------------------------------------===//
+
+/// Setup - globals and the functions whose bodies are evaluated. Each body
+/// is a single node of the kind named, over the parameters x, y, i and j.
+static const char* const Setup =
+    "gv = 7\n"
+    "arr g[16][16]\n"
+    "func id(v) v\n"
+    "func b_local(x, y, i, j) x\n"
+    "func b_global(x, y, i, j) gv\n"
+    "func b_binary(x, y, i, j) x * y\n"
+    "func b_call(x, y, i, j) id(x)\n"
+    "func b_arr_get(x, y, i, j) g[i][j]\n"
+    "func b_arr_set(x, y, i, j) g[i][j] = x\n";
+
+static const unsigned int Evaluations = 1 << 20; // per round
+
+/// BenchNode - evaluates the body of Func over and over in one frame,
+/// without the call around it.
+static void BenchNode(const char* Name, const char* Func)
+{
+    Interpreter& Interp = *CurInterp;
+    auto It = Interp.FunctionIds.find(Func);
+    if (It == Interp.FunctionIds.end() || !Interp.FuncTbl[It->second].Fn)
+    {
+        fprintf(stderr, "Error: %s was not defined\n", Func);
+        return;
+    }
+    FunctionAST& Fn = *Interp.FuncTbl[It->second].Fn;
+    ExprAST* Body = Fn.getBody();
+
+    unsigned int Base;
+    if (!Interp.StackMemory.pushFrame(Fn.getFrameSize(), Base)) return;
+    const double Args[] = { 3, 4, 5, 6 }; // x, y, i, j
+    for (unsigned int k = 0; k < 4; k++) Interp.StackMemory.setValue(Base + k, Value(Args[k]));
+    FrameBase = Base;
+
+    volatile double Sink = 0;
+    Measure(Name, "evals", [&](double& Seconds) {
+        double Sum = 0;
+        auto Start = BenchClock::now();
+        for (unsigned int n = 0; n < Evaluations; n++) Sum += Body->execute().getNum();
+        Seconds = Since(Start);
+        Sink = Sum;
+        return (size_t)Evaluations;
+    });
+
+    if (Flow.Type != flow_normal) fprintf(stderr, "Error: %s did not run cleanly\n", Func);
+    Flow.Type = flow_normal;
+    FrameBase = 0;
+    Interp.StackMemory.deleteScope(Base);
+}
+
+static void BenchExecutor()
+{
+    std::string Text = Setup;
+    TokenStream Toks(SourceOf(Text));
+    Toks.tokenize();
+    GetNextToken(Toks);
+    MainLoop(Toks);
+    MarkNativeStack();
+
+    BenchNode("eval/variable-local", "b_local");
+    BenchNode("eval/variable-global", "b_global");
+    BenchNode("eval/binary", "b_binary");
+    BenchNode("eval/call", "b_call");
+    BenchNode("eval/arr-get", "b_arr_get");
+    BenchNode("eval/arr-set", "b_arr_set");
+}
+
+//===----------------------------------------------------------------------===//
+// Output
+//===----------------------------------------------------------------------===//
+
+static void PrintJson()
+{
+    printf("{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < Results.size(); i++)
+    {
+        const BenchResult& R = Results[i];
+        printf("    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %zu, \"rounds\": %zu, "
+            "\"best_s\": %.9f, \"median_s\": %.9f, \"per_second\": %.1f, \"ns_per_item\": %.3f}%s\n",
+            R.Name.c_str(), R.Unit, R.Items, R.Rounds.size(), R.best(), R.median(), R.Items / R.median(),
+            R.median() * 1e9 / R.Items, i + 1 < Results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--min-time") && i + 1 < argc && atof(argv[i + 1]) > 0) MinTime = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc) Filter = argv[++i];
+        else
+        {
+            fprintf(stderr, "Unknown option \"%s\".\nusage: %s [--min-time SECONDS] [--filter TEXT]\n", argv[i], argv[0]);
+            return 1;
+        }
+    }
+
+    Interpreter Interp;
+    InterpreterScope Scope(Interp);
+    Interp.IsInteractive = false;
+    if (!Interp.StackMemory.reserve((size_t)DefaultStackMB << 20))
+    {
+        fprintf(stderr, "Error: Could not reserve %u MB for the stack\n", DefaultStackMB);
+        return 1;
+    }
+    // Nodes are timed on the tree walker; loops must not tier up.
+    UseJit = false;
+
+    fprintf(stderr, "  %-24s %10s %-7s %13s  %14s\n", "benchmark", "items", "", "median", "rate");
+    BenchLexer();
+    BenchParser();
+    BenchExecutor();
+    PrintJson();
+    return Interp.Errors != 0;
+}